@@ -0,0 +1,64 @@
+#ifndef APP_HPP
+#define APP_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "qrcode.hpp"
+
+// Entry points of the demo application which are not a part of the library.
+
+bool runTests();
+
+void runBenchmarks();
+
+// Headless processing of a directory, a list of files (.txt or .lst) or a
+// single image or video. Inputs are processed by up to jobs threads (0 to
+// use all the cores). Prints a JSON line per frame and a summary. With
+// profile, histograms of detection stats are printed to stderr. Frames are
+// binarized by a local threshold if detector.adaptive is set, and
+// detector.budgetMs limits every frame.
+// @returns Exit code.
+int runBatch(const std::string& input, int jobs, bool profile = false,
+             const QrDetector::Params& detector = QrDetector::Params());
+
+// Several inputs (files or camera indices) processed concurrently by a shared
+// pool of jobs workers (see MultiStream). Prints a JSON line per frame tagged
+// with a stream index and summaries per stream. Policy is drop or block (an
+// empty one drops frames of cameras and blocks files).
+// @returns Exit code.
+int runStreams(const std::vector<std::string>& inputs, int jobs, int queueSize,
+               const std::string& policy, bool profile = false,
+               const QrDetector::Params& detector = QrDetector::Params());
+
+// Decoding service on a UNIX domain socket (see DecodeServer) until SIGINT or
+// SIGTERM. Requests are decoded in batches of up to maxBatch images by jobs
+// workers, the first request of a batch waits at most maxLatencyMs for others.
+// @returns Exit code.
+int runServer(const std::string& path, int jobs, int maxBatch, double maxLatencyMs,
+              const QrDetector::Params& detector = QrDetector::Params());
+
+// Send encoded images to a server and print a JSON line with a response per image.
+// @returns Exit code.
+int runClient(const std::string& path, const std::vector<std::string>& inputs);
+
+// Load generator for a server: numRequests requests over numClients
+// connections. Sends an encoded input image or, if it's empty, raw pixels of
+// a synthetic frame. Prints throughput and round trip latencies.
+// @returns Exit code.
+int runLoad(const std::string& path, const std::string& input, int numClients, int numRequests);
+
+// JSON output shared by the headless modes.
+
+// String with escapes. Valid UTF-8 is written as is and other bytes as \u00XX
+// so the output is always valid JSON.
+void writeJsonString(std::ostream& out, const std::string& str);
+
+// Codes as an array:
+// [{"payload": "...", "version": 1, "confidence": 1.0, "corners": [[x, y], ...]}]
+void writeCodes(std::ostream& out, const std::vector<QrCode>& codes);
+
+// {"p50": ..., "p95": ..., "p99": ...} of sorted latencies.
+void writePercentiles(std::ostream& out, const std::vector<double>& sorted);
+#endif  // APP_HPP
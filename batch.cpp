@@ -0,0 +1,365 @@
+#include "app.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "qrcode.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+// Input paths: files of a directory, lines of a list file (.txt or .lst) or
+// a single image or video.
+static void listInputs(const std::string& input, std::vector<std::string>& paths)
+{
+    paths.clear();
+    const size_t dot = input.rfind('.');
+    const std::string ext = dot == std::string::npos ? "" : input.substr(dot);
+    if (ext == ".txt" || ext == ".lst")
+    {
+        std::ifstream file(input.c_str());
+        if (!file.is_open())
+            CV_Error(cv::Error::StsError, "Cannot open a list of inputs " + input);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty())
+                paths.push_back(line);
+        }
+    }
+    else
+    {
+        // Directory is listed and a single file is kept as is.
+        cv::glob(input, paths, false);
+    }
+}
+
+// Length of a valid UTF-8 sequence of 2-4 bytes at position i, 0 if there
+// is none. Overlong forms, surrogates and code points above U+10FFFF are invalid.
+static size_t utf8Length(const std::string& str, size_t i)
+{
+    const unsigned char c = str[i];
+    size_t length;
+    unsigned char lo = 0x80, hi = 0xBF;  // Range of the second byte.
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+        length = 2;
+    }
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+        length = 3;
+        if (c == 0xE0)
+            lo = 0xA0;
+        else if (c == 0xED)
+            hi = 0x9F;
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+        length = 4;
+        if (c == 0xF0)
+            lo = 0x90;
+        else if (c == 0xF4)
+            hi = 0x8F;
+    }
+    else
+    {
+        return 0;
+    }
+    if (i + length > str.size())
+        return 0;
+    for (size_t j = 1; j < length; ++j)
+    {
+        const unsigned char next = str[i + j];
+        if (next < (j == 1 ? lo : 0x80) || next > (j == 1 ? hi : 0xBF))
+            return 0;
+    }
+    return length;
+}
+
+void writeJsonString(std::ostream& out, const std::string& str)
+{
+    out << '"';
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        const unsigned char c = str[i];
+        size_t length;
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (c == '\n')
+        {
+            out << "\\n";
+        }
+        else if (c >= 0x80 && (length = utf8Length(str, i)) != 0)
+        {
+            out.write(&str[i], length);
+            i += length - 1;
+        }
+        else if (c < 0x20 || c >= 0x80)
+        {
+            // Control characters and bytes which are not UTF-8 (as Latin-1).
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+                << std::dec << std::setfill(' ');
+        }
+        else
+        {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void writeCodes(std::ostream& out, const std::vector<QrCode>& codes)
+{
+    out << "[" << std::fixed << std::setprecision(1);
+    for (size_t i = 0; i < codes.size(); ++i)
+    {
+        out << (i ? ", " : "") << "{\"payload\": ";
+        writeJsonString(out, codes[i].payload);
+        out << ", \"version\": " << codes[i].version << std::setprecision(2)
+            << ", \"confidence\": " << codes[i].confidence << std::setprecision(1)
+            << ", \"corners\": [";
+        for (int j = 0; j < 4; ++j)
+            out << (j ? ", " : "") << "[" << codes[i].corners[j].x << ", " << codes[i].corners[j].y << "]";
+        out << "]}";
+    }
+    out << "]";
+}
+
+// Frames of all the inputs processed by workers. Every worker has its own
+// detector and takes the next input when it's done with the previous one.
+class BatchRunner
+{
+public:
+    BatchRunner(const std::vector<std::string>& paths, int jobs,
+                const QrDetector::Params& detectorParams, std::ostream& out)
+        : paths(paths), jobs(jobs), detectorParams(detectorParams), out(out), nextInput(0) {}
+
+    void run()
+    {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < jobs; ++i)
+            workers.push_back(std::thread(&BatchRunner::work, this));
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    // Latencies of all the frames in milliseconds.
+    std::vector<double> latencies;
+    // Detection stats of all the frames.
+    QrProfile profile;
+
+private:
+    void work()
+    {
+        // Inputs are already processed in parallel so a frame is binarized
+        // and scanned by a single thread.
+        QrDetector::Params params = detectorParams;
+        if (jobs > 1)
+        {
+            params.numStripes = 1;
+            params.adaptiveThreshold.numTiles = 1;
+        }
+        QrDetector detector(params);
+        cv::Mat img, bin;
+        AdaptiveBuffers buffers;
+        std::vector<double> workerLatencies;
+        QrProfile workerProfile;
+        for (size_t i = nextInput++; i < paths.size(); i = nextInput++)
+        {
+            // Images are read by imread and the rest by a video capture.
+            cv::VideoCapture cap;
+            img = cv::imread(paths[i]);
+            if (img.empty() && (!cap.open(paths[i]) || !cap.read(img)))
+            {
+                std::lock_guard<std::mutex> lock(outMutex);
+                std::cerr << "Cannot read " << paths[i] << std::endl;
+                continue;
+            }
+            for (int frame = 0; !img.empty(); ++frame)
+            {
+                // Latency covers binarization and detection but not reading.
+                const int64_t start = cv::getTickCount();
+                if (params.adaptive)
+                    bgr2bin(img, bin, params.adaptiveThreshold, buffers);
+                else
+                    bgr2bin(img, bin);
+                const std::vector<QrCode>& codes = detector.detectMulti(bin);
+                const double latency = (cv::getTickCount() - start) * 1e3 / cv::getTickFrequency();
+                workerLatencies.push_back(latency);
+                workerProfile.add(detector.stats());
+                write(paths[i], frame, latency, codes);
+
+                img.release();
+                if (cap.isOpened())
+                    cap.read(img);
+            }
+        }
+        std::lock_guard<std::mutex> lock(outMutex);
+        latencies.insert(latencies.end(), workerLatencies.begin(), workerLatencies.end());
+        profile.merge(workerProfile);
+    }
+
+    // Write a JSON line per frame:
+    // {"input": "...", "frame": 0, "latency_ms": 1.5,
+    //  "codes": [{"payload": "...", "version": 1, "confidence": 1.0, "corners": [[x, y], ...]}]}
+    void write(const std::string& path, int frame, double latency, const std::vector<QrCode>& codes)
+    {
+        std::ostringstream line;
+        line << "{\"input\": ";
+        writeJsonString(line, path);
+        line << ", \"frame\": " << frame << ", \"latency_ms\": " << std::fixed
+             << std::setprecision(3) << latency << ", \"codes\": ";
+        writeCodes(line, codes);
+        line << "}\n";
+
+        std::lock_guard<std::mutex> lock(outMutex);
+        out << line.str();
+    }
+
+    const std::vector<std::string>& paths;
+    int jobs;
+    QrDetector::Params detectorParams;
+    std::ostream& out;
+    std::atomic<size_t> nextInput;
+    std::mutex outMutex;
+};
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    const size_t idx = std::min(sorted.size() - 1, (size_t)(p * 0.01 * sorted.size()));
+    return sorted[idx];
+}
+
+int runBatch(const std::string& input, int jobs, bool profile, const QrDetector::Params& detector)
+{
+    std::vector<std::string> paths;
+    listInputs(input, paths);
+    if (paths.empty())
+    {
+        std::cerr << "No inputs found at " << input << std::endl;
+        return 1;
+    }
+    if (jobs < 1)
+        jobs = std::max(1, (int)std::thread::hardware_concurrency());
+    jobs = std::min(jobs, (int)paths.size());
+
+    const int64_t start = cv::getTickCount();
+    BatchRunner runner(paths, jobs, detector, std::cout);
+    runner.run();
+    const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    // Summary is the last JSON line.
+    std::vector<double>& latencies = runner.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "{\"summary\": {\"inputs\": " << paths.size() << ", \"frames\": " << latencies.size()
+              << std::fixed << std::setprecision(3) << ", \"seconds\": " << seconds
+              << ", \"fps\": " << (seconds > 0 ? latencies.size() / seconds : 0)
+              << ", \"latency_ms\": {\"p50\": " << percentile(latencies, 50)
+              << ", \"p95\": " << percentile(latencies, 95)
+              << ", \"p99\": " << percentile(latencies, 99) << "}}}" << std::endl;
+    if (profile)
+        runner.profile.print(std::cerr);
+    return 0;
+}
+
+void writePercentiles(std::ostream& out, const std::vector<double>& sorted)
+{
+    out << std::fixed << std::setprecision(3) << "{\"p50\": " << percentile(sorted, 50)
+        << ", \"p95\": " << percentile(sorted, 95) << ", \"p99\": " << percentile(sorted, 99) << "}";
+}
+
+int runStreams(const std::vector<std::string>& inputs, int jobs, int queueSize,
+               const std::string& policy, bool profile, const QrDetector::Params& detector)
+{
+    // A number is an index of a camera.
+    std::vector<cv::VideoCapture> caps(inputs.size());
+    std::vector<MultiStream::Input> streams(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        const bool camera = !inputs[i].empty() &&
+                            inputs[i].find_first_not_of("0123456789") == std::string::npos;
+        if (camera)
+            caps[i].open(std::atoi(inputs[i].c_str()));
+        else
+            caps[i].open(inputs[i]);
+        if (!caps[i].isOpened())
+        {
+            std::cerr << "Cannot open " << inputs[i] << std::endl;
+            return 1;
+        }
+        // Cameras shouldn't build latency but every frame of a file is processed.
+        streams[i].cap = &caps[i];
+        if (policy == "block" || (policy.empty() && !camera))
+            streams[i].policy = Pipeline::BLOCK;
+        else
+            streams[i].policy = Pipeline::DROP_OLDEST;
+    }
+
+    MultiStream::Params params;
+    params.numWorkers = jobs;
+    params.queueSize = queueSize;
+    params.detector = detector;
+
+    // A JSON line per frame:
+    // {"stream": 0, "input": "...", "frame": 0, "latency_ms": 1.5, "codes": [...]}
+    std::mutex outMutex;
+    auto write = [&](int stream, const Frame& frame, const std::vector<QrCode>& codes, double latency)
+    {
+        std::ostringstream line;
+        line << "{\"stream\": " << stream << ", \"input\": ";
+        writeJsonString(line, inputs[stream]);
+        line << ", \"frame\": " << frame.index << ", \"latency_ms\": " << std::fixed
+             << std::setprecision(3) << latency << ", \"codes\": ";
+        writeCodes(line, codes);
+        line << "}\n";
+
+        std::lock_guard<std::mutex> lock(outMutex);
+        std::cout << line.str();
+    };
+
+    const int64_t start = cv::getTickCount();
+    MultiStream multiStream(streams, write, params);
+    multiStream.wait();
+    const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    // Summary of every stream and a total one are the last JSON lines.
+    std::vector<double> latencies;
+    QrProfile total;
+    for (int i = 0; i < multiStream.numStreams(); ++i)
+    {
+        MultiStream::StreamStats stats = multiStream.stats(i);
+        std::sort(stats.latencies.begin(), stats.latencies.end());
+        std::cout << "{\"summary\": {\"stream\": " << i << ", \"input\": ";
+        writeJsonString(std::cout, inputs[i]);
+        std::cout << ", \"frames\": " << stats.latencies.size() << ", \"drops\": " << stats.drops
+                  << std::fixed << std::setprecision(3)
+                  << ", \"fps\": " << (seconds > 0 ? stats.latencies.size() / seconds : 0)
+                  << ", \"latency_ms\": ";
+        writePercentiles(std::cout, stats.latencies);
+        std::cout << "}}" << std::endl;
+        latencies.insert(latencies.end(), stats.latencies.begin(), stats.latencies.end());
+        total.merge(stats.profile);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "{\"summary\": {\"streams\": " << inputs.size() << ", \"frames\": "
+              << latencies.size() << std::fixed << std::setprecision(3) << ", \"seconds\": " << seconds
+              << ", \"fps\": " << (seconds > 0 ? latencies.size() / seconds : 0)
+              << ", \"latency_ms\": ";
+    writePercentiles(std::cout, latencies);
+    std::cout << "}}" << std::endl;
+    if (profile)
+        total.print(std::cerr);
+    return 0;
+}
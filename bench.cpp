@@ -0,0 +1,382 @@
+#include "app.hpp"
+#include "qrcode.hpp"
+
+#include <climits>
+#include <iomanip>
+#include <iostream>
+
+#define RUN_BENCH(name) \
+    std::cout << "run benchmark " << #name << std::endl; \
+    name(); \
+    std::cout << std::endl;
+
+static const char* simdPathName(SimdPath path)
+{
+    switch (path)
+    {
+    case SIMD_SCALAR: return "scalar";
+    case SIMD_SSSE3: return "ssse3";
+    case SIMD_AVX2: return "avx2";
+    case SIMD_NEON: return "neon";
+    default: return "auto";
+    }
+}
+
+// Minimal number of CPU cycles over several runs of a functor.
+template <typename Func>
+static int64_t minCycles(Func func, int iters = 20)
+{
+    int64_t best = 0;
+    for (int i = 0; i < iters; ++i)
+    {
+        int64_t start = cv::getCPUTickCount();
+        func();
+        int64_t cycles = cv::getCPUTickCount() - start;
+        if (i == 0 || cycles < best)
+            best = cycles;
+    }
+    return std::max(best, (int64_t)1);
+}
+
+struct TwoPassBinarization
+{
+    const cv::Mat& src; cv::Mat& gray; cv::Mat& bin; SimdPath path;
+    void operator()() const { bgr2gray(src, gray, path); gray2bin(gray, bin, 127, path); }
+};
+
+struct FusedBinarization
+{
+    const cv::Mat& src; cv::Mat& bin; SimdPath path;
+    void operator()() const { bgr2bin(src, bin, 127, path); }
+};
+
+// Compare separate bgr2gray + gray2bin passes with the fused bgr2bin kernel.
+// Throughput is reported in bytes of input BGR image per CPU cycle.
+void bench_binarization()
+{
+    const cv::Size sizes[] = {cv::Size(640, 480), cv::Size(1920, 1080), cv::Size(3840, 2160)};
+    const SimdPath paths[] = {SIMD_SCALAR, SIMD_SSSE3, SIMD_AVX2, SIMD_NEON};
+
+    std::cout << std::setw(12) << "size" << std::setw(10) << "path"
+              << std::setw(16) << "two-pass B/cyc" << std::setw(16) << "fused B/cyc" << std::endl;
+    for (int i = 0; i < 3; ++i)
+    {
+        cv::Mat src(sizes[i], CV_8UC3), gray, bin;
+        randu(src, 0, 255);
+        const double bytes = (double)src.total() * src.elemSize();
+        for (int j = 0; j < 4; ++j)
+        {
+            if (!hasSimdPath(paths[j]))
+                continue;
+            TwoPassBinarization twoPass = {src, gray, bin, paths[j]};
+            FusedBinarization fused = {src, bin, paths[j]};
+            std::stringstream size;
+            size << src.cols << "x" << src.rows;
+            std::cout << std::setw(12) << size.str() << std::setw(10) << simdPathName(paths[j])
+                      << std::setw(16) << std::fixed << std::setprecision(3) << bytes / minCycles(twoPass)
+                      << std::setw(16) << bytes / minCycles(fused) << std::endl;
+        }
+    }
+}
+
+// Draw a finder pattern 7x7 modules with top-left corner at (x, y).
+static void drawFinderPattern(cv::Mat& bin, int x, int y, int module)
+{
+    bin(cv::Rect(x, y, 7 * module, 7 * module)).setTo(0);
+    bin(cv::Rect(x + module, y + module, 5 * module, 5 * module)).setTo(255);
+    bin(cv::Rect(x + 2 * module, y + 2 * module, 3 * module, 3 * module)).setTo(0);
+}
+
+template <typename Image>
+struct SerialScan
+{
+    const Image& bin; std::vector<cv::Rect>& candidates; std::vector<int>& rows;
+    void operator()() const { findCandidates(bin, candidates, rows, 1); }
+};
+
+// Serial rows scan over images with a byte per pixel and packed ones. Frames
+// have a few finder patterns and random noise blocks so most of the time is
+// spent in countPixels.
+void bench_scan_packed()
+{
+    const cv::Size sizes[] = {cv::Size(640, 480), cv::Size(1920, 1080), cv::Size(3840, 2160)};
+
+    std::cout << std::setw(12) << "size" << std::setw(14) << "byte MB"
+              << std::setw(14) << "packed MB" << std::setw(16) << "byte Mcyc"
+              << std::setw(16) << "packed Mcyc" << std::endl;
+    for (int i = 0; i < 3; ++i)
+    {
+        cv::Mat bin(sizes[i], CV_8UC1, cv::Scalar(255));
+        for (int j = 0; j < 200; ++j)
+        {
+            int size = cv::theRNG().uniform(2, 40);
+            cv::Rect block(cv::theRNG().uniform(0, bin.cols - size), cv::theRNG().uniform(0, bin.rows - size), size, size);
+            bin(block).setTo(0);
+        }
+        const int module = bin.rows / 100;
+        drawFinderPattern(bin, 10 * module, 10 * module, module);
+        drawFinderPattern(bin, 50 * module, 10 * module, module);
+        drawFinderPattern(bin, 10 * module, 50 * module, module);
+
+        BitImage packed;
+        gray2bin(bin, packed);
+
+        std::vector<cv::Rect> candidates;
+        std::vector<int> rows;
+        SerialScan<cv::Mat> byteScan = {bin, candidates, rows};
+        SerialScan<BitImage> packedScan = {packed, candidates, rows};
+        std::stringstream size;
+        size << bin.cols << "x" << bin.rows;
+        std::cout << std::setw(12) << size.str() << std::fixed << std::setprecision(2)
+                  << std::setw(14) << bin.total() * 1e-6
+                  << std::setw(14) << packed.data.size() * sizeof(uint64_t) * 1e-6
+                  << std::setw(16) << minCycles(byteScan, 5) * 1e-6
+                  << std::setw(16) << minCycles(packedScan, 5) * 1e-6 << std::endl;
+    }
+}
+
+struct DetectorRun
+{
+    QrDetector& detector; const cv::Mat& bin; cv::Mat& img;
+    void operator()() const { detector.decode(bin, img); }
+};
+
+// Vertical and diagonal checks by pixel walks and by run-length indices. Frames
+// are covered by a grid of finder patterns so there are lots of candidates to verify.
+void bench_verification()
+{
+    const cv::Size sizes[] = {cv::Size(640, 480), cv::Size(1920, 1080), cv::Size(3840, 2160)};
+
+    std::cout << std::setw(12) << "size" << std::setw(12) << "candidates"
+              << std::setw(16) << "walk Mcyc" << std::setw(16) << "index Mcyc"
+              << std::setw(18) << "index/2 Mcyc" << std::endl;
+    for (int i = 0; i < 3; ++i)
+    {
+        cv::Mat bin(sizes[i], CV_8UC1, cv::Scalar(255)), img;
+        const int module = std::max(1, bin.rows / 180);
+        for (int y = module; y + 8 * module <= bin.rows; y += 9 * module)
+        {
+            for (int x = module; x + 8 * module <= bin.cols; x += 9 * module)
+                drawFinderPattern(bin, x, y, module);
+        }
+
+        QrDetector::Params params;
+        params.numStripes = 1;
+        QrDetector walk(params);
+        params.verification = QrDetector::Params::VERIFY_RUN_INDEX;
+        QrDetector index(params);
+        params.indexStep = 2;
+        QrDetector sampled(params);
+
+        DetectorRun walkRun = {walk, bin, img};
+        DetectorRun indexRun = {index, bin, img};
+        DetectorRun sampledRun = {sampled, bin, img};
+        const int64_t walkCycles = minCycles(walkRun, 5);
+        std::stringstream size;
+        size << bin.cols << "x" << bin.rows;
+        std::cout << std::setw(12) << size.str() << std::setw(12) << walk.candidates().size()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(16) << walkCycles * 1e-6
+                  << std::setw(16) << minCycles(indexRun, 5) * 1e-6
+                  << std::setw(18) << minCycles(sampledRun, 5) * 1e-6 << std::endl;
+    }
+}
+
+// Full scan against coarse-to-fine search for a code which takes a small part
+// of a frame with random noise around.
+void bench_coarse()
+{
+    const cv::Size sizes[] = {cv::Size(1920, 1080), cv::Size(3840, 2160)};
+    const int scales[] = {1, 2, 4};
+
+    std::cout << std::setw(12) << "size" << std::setw(8) << "scale"
+              << std::setw(12) << "Mcyc" << std::setw(12) << "candidates" << std::endl;
+    for (int i = 0; i < 2; ++i)
+    {
+        cv::Mat bin(sizes[i], CV_8UC1, cv::Scalar(255)), img;
+        for (int j = 0; j < 500; ++j)
+        {
+            int size = cv::theRNG().uniform(2, 20);
+            cv::Rect block(cv::theRNG().uniform(0, bin.cols - size), cv::theRNG().uniform(0, bin.rows - size), size, size);
+            bin(block).setTo(0);
+        }
+        const int module = 8;
+        bin(cv::Rect(bin.cols / 2 - module, bin.rows / 2 - module, 23 * module, 23 * module)).setTo(255);
+        drawFinderPattern(bin, bin.cols / 2, bin.rows / 2, module);
+        drawFinderPattern(bin, bin.cols / 2 + 14 * module, bin.rows / 2, module);
+        drawFinderPattern(bin, bin.cols / 2, bin.rows / 2 + 14 * module, module);
+
+        for (int j = 0; j < 3; ++j)
+        {
+            QrDetector::Params params;
+            params.numStripes = 1;
+            params.coarseScale = scales[j];
+            QrDetector detector(params);
+            DetectorRun run = {detector, bin, img};
+            std::stringstream size;
+            size << bin.cols << "x" << bin.rows;
+            std::cout << std::setw(12) << size.str() << std::setw(8) << scales[j]
+                      << std::setw(12) << std::fixed << std::setprecision(2) << minCycles(run, 5) * 1e-6
+                      << std::setw(12) << detector.candidates().size() << std::endl;
+        }
+    }
+}
+
+// Latency of a full scan and of tracking mode for a static scene.
+void bench_tracking()
+{
+    cv::Mat bin(2160, 3840, CV_8UC1, cv::Scalar(255)), img;
+    const int module = 8;
+    drawFinderPattern(bin, 1800, 1000, module);
+    drawFinderPattern(bin, 1800 + 14 * module, 1000, module);
+    drawFinderPattern(bin, 1800, 1000 + 14 * module, module);
+
+    QrDetector::Params params;
+    params.numStripes = 1;
+    QrDetector full(params);
+    params.tracking = true;
+    params.trackingRefresh = INT_MAX;
+    QrDetector tracking(params);
+
+    DetectorRun fullRun = {full, bin, img};
+    DetectorRun trackingRun = {tracking, bin, img};
+    std::cout << std::setw(12) << "full Mcyc" << std::setw(16) << "tracking Mcyc" << std::endl;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(12) << minCycles(fullRun, 5) * 1e-6
+              << std::setw(16) << minCycles(trackingRun, 5) * 1e-6 << std::endl;
+}
+
+struct CentersRun
+{
+    const std::vector<cv::Rect>& rects; std::vector<cv::Point>& centers;
+    void operator()() const { computeCenters(rects, centers); }
+};
+
+// Grouping of lots of candidates from noisy textured frames. Time per
+// candidate should stay about the same with growing number of them.
+void bench_computeCenters()
+{
+    const int nums[] = {1000, 10000, 100000};
+
+    std::cout << std::setw(12) << "candidates" << std::setw(10) << "centers"
+              << std::setw(12) << "Mcyc" << std::setw(16) << "cyc/candidate" << std::endl;
+    for (int i = 0; i < 3; ++i)
+    {
+        // Clusters of about 30 jittered rectangles over a 4K frame.
+        std::vector<cv::Rect> rects;
+        cv::RNG rng(i + 1);
+        while (rects.size() < nums[i])
+        {
+            const int size = rng.uniform(5, 60), x = rng.uniform(0, 3840), y = rng.uniform(0, 2160);
+            for (int j = 0; j < 30; ++j)
+                rects.push_back(cv::Rect(x + rng.uniform(-3, 4), y + rng.uniform(-3, 4),
+                                         size + rng.uniform(-2, 3), size + rng.uniform(-2, 3)));
+        }
+        for (int j = (int)rects.size() - 1; j > 0; --j)
+            std::swap(rects[j], rects[rng.uniform(0, j + 1)]);
+
+        std::vector<cv::Point> centers;
+        CentersRun run = {rects, centers};
+        const int64_t cycles = minCycles(run, 5);
+        std::cout << std::setw(12) << rects.size() << std::setw(10) << centers.size()
+                  << std::setw(12) << std::fixed << std::setprecision(2) << cycles * 1e-6
+                  << std::setw(16) << std::setprecision(1) << (double)cycles / rects.size() << std::endl;
+    }
+}
+
+struct SerialBatchRun
+{
+    const std::vector<cv::Mat>& images; QrDetector& detector; BitImage& bin;
+    void operator()() const
+    {
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            gray2bin(images[i], bin);
+            detector.detectMulti(bin);
+        }
+    }
+};
+
+struct DecodeBatchRun
+{
+    const std::vector<cv::Mat>& images; std::vector<std::vector<QrCode> >& results;
+    void operator()() const { decodeBatch(images, results); }
+};
+
+// A burst of images where a few ones with lots of markers cost much more
+// than the rest. They are grouped at the beginning so a static split of
+// images between threads would leave most of them idle.
+void bench_decodeBatch()
+{
+    std::vector<cv::Mat> images;
+    for (int i = 0; i < 96; ++i)
+    {
+        cv::Mat img(720, 1280, CV_8UC1, cv::Scalar(255));
+        if (i < 12)
+        {
+            for (int y = 40; y < img.rows - 40; y += 70)
+                for (int x = 40; x < img.cols - 40; x += 70)
+                    drawFinderPattern(img, x, y, 4);
+        }
+        else
+        {
+            drawFinderPattern(img, 100, 100, 6);
+            drawFinderPattern(img, 100 + 20 * 6, 100, 6);
+            drawFinderPattern(img, 100, 100 + 20 * 6, 6);
+        }
+        images.push_back(img);
+    }
+
+    QrDetector::Params params;
+    params.numStripes = 1;
+    QrDetector detector(params);
+    BitImage bin;
+    std::vector<std::vector<QrCode> > results;
+    SerialBatchRun serial = {images, detector, bin};
+    DecodeBatchRun batch = {images, results};
+    const int64_t serialCycles = minCycles(serial, 3), batchCycles = minCycles(batch, 3);
+    std::cout << std::setw(12) << "serial Mcyc" << std::setw(12) << "batch Mcyc"
+              << std::setw(10) << "speedup" << std::endl;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(12) << serialCycles * 1e-6
+              << std::setw(12) << batchCycles * 1e-6
+              << std::setw(10) << (double)serialCycles / batchCycles << std::endl;
+}
+
+struct ViewBinarization
+{
+    const ImageView& view; BitImage& bin;
+    void operator()() const { view2bin(view, bin); }
+};
+
+// Binarization of raw frames. YUV frames are thresholded by their luma plane
+// so they should be as cheap as grayscale ones.
+void bench_raw_input()
+{
+    const int width = 1920, height = 1080;
+    std::vector<uint8_t> frame(width * height * 4);
+    cv::Mat noise(1, (int)frame.size(), CV_8UC1, &frame[0]);
+    randu(noise, 0, 255);
+
+    const PixelFormat formats[] = {PIXEL_GRAY, PIXEL_NV12, PIXEL_BGR, PIXEL_BGRA};
+    const char* names[] = {"gray", "nv12", "bgr", "bgra"};
+    std::cout << std::setw(10) << "format" << std::setw(12) << "cyc/pixel" << std::endl;
+    for (int i = 0; i < 4; ++i)
+    {
+        const ImageView view(&frame[0], width, height, 0, formats[i]);
+        BitImage bin;
+        ViewBinarization run = {view, bin};
+        std::cout << std::setw(10) << names[i] << std::setw(12) << std::fixed << std::setprecision(3)
+                  << (double)minCycles(run) / (width * height) << std::endl;
+    }
+}
+
+void runBenchmarks()
+{
+    RUN_BENCH(bench_binarization);
+    RUN_BENCH(bench_scan_packed);
+    RUN_BENCH(bench_verification);
+    RUN_BENCH(bench_coarse);
+    RUN_BENCH(bench_tracking);
+    RUN_BENCH(bench_computeCenters);
+    RUN_BENCH(bench_decodeBatch);
+    RUN_BENCH(bench_raw_input);
+}
@@ -0,0 +1,250 @@
+// Per-stage microbenchmarks on synthetic frames. Results are printed as CSV
+// or JSON lines with a row per stage and resolution so runs of different
+// versions can be compared by diff.
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "generator.hpp"
+#include "qrcode.hpp"
+
+#include <opencv2/opencv.hpp>
+
+const char* keys =
+    "{ help   h |     | Print help message. }"
+    "{ format f | csv | Output format: csv or json. }"
+    "{ iters  n | 20  | Number of runs of every stage. }"
+    "{ noise    | 8   | Standard deviation of noise of synthetic frames. }"
+    "{ blur     | 3   | Blur kernel size of synthetic frames. }"
+    "{ angle    | 10  | Rotation of synthetic codes in degrees. }"
+    "{ seed     | 1   | Seed of synthetic frames. }";
+
+static const char* kMessage = "BENCHMARK";
+
+// Frame and results of every stage which the next one consumes.
+struct StageData
+{
+    cv::Mat img, gray, bin, modules;
+    std::vector<int> counts, xs;
+    std::vector<uint64_t> matches;
+    std::vector<cv::Point> hits;
+    std::vector<cv::Rect> candidates;
+    std::vector<int> rows;
+    std::vector<cv::Point> centers;
+    cv::Point topLeft, topRight, bottomLeft;
+    std::string msg;
+};
+
+struct Result
+{
+    std::string stage;
+    cv::Size size;
+    double minMs, medianMs;
+    bool ok;
+};
+
+// Times of several runs of a functor in milliseconds. There is at least a single run.
+template <typename Func>
+static void measure(Func func, int iters, double& minMs, double& medianMs)
+{
+    CV_Assert(iters > 0);
+    std::vector<double> times(iters);
+    for (int i = 0; i < iters; ++i)
+    {
+        const int64_t start = cv::getTickCount();
+        func();
+        times[i] = (cv::getTickCount() - start) * 1e3 / cv::getTickFrequency();
+    }
+    std::sort(times.begin(), times.end());
+    minMs = times[0];
+    medianMs = times[iters / 2];
+}
+
+static void countRows(StageData& d)
+{
+    for (int y = 0; y < d.bin.rows; ++y)
+        countPixels(d.bin.ptr<uint8_t>(y), d.bin.cols, d.counts, d.xs);
+}
+
+// Centers of 1:1:3:1:1 sequences over all rows. checkRatios checks all the
+// windows of five groups of a row at once.
+static void checkRows(StageData& d)
+{
+    d.hits.clear();
+    for (int y = 0; y < d.bin.rows; ++y)
+    {
+        countPixels(d.bin.ptr<uint8_t>(y), d.bin.cols, d.counts, d.xs);
+        checkRatios(d.counts.data(), (int)d.counts.size(), d.matches);
+        for (int k = 0; 2 * k + 5 <= (int)d.counts.size(); ++k)
+        {
+            const int i = 2 * k;
+            if ((d.matches[k >> 6] >> (k & 63)) & 1)
+                d.hits.push_back(cv::Point(d.xs[i + 2] + d.counts[i + 2] / 2, y));
+        }
+    }
+}
+
+static bool verifyHits(const StageData& d)
+{
+    bool found = false;
+    for (size_t i = 0; i < d.hits.size(); ++i)
+    {
+        int top, bottom;
+        found |= verifyVertical(d.bin, d.hits[i].x, d.hits[i].y, &top, &bottom);
+    }
+    return found;
+}
+
+// Run stages in order. Every stage is measured on outputs of the previous one.
+static void benchFrame(const cv::Size& size, const SyntheticParams& synthetic, int iters,
+                       std::vector<Result>& results)
+{
+    StageData d;
+    cv::Mat modules;
+    encodeQr(kMessage, modules);
+    d.img.create(size, CV_8UC3);
+    renderQr(modules, synthetic, d.img);
+
+    QrDetector::Params params;
+    params.tracking = false;
+    QrDetector detector(params);
+    cv::Mat noImg;
+
+    Result r;
+    r.size = size;
+
+    r.stage = "bgr2gray";
+    measure([&] { bgr2gray(d.img, d.gray); }, iters, r.minMs, r.medianMs);
+    r.ok = true;
+    results.push_back(r);
+
+    r.stage = "gray2bin";
+    measure([&] { gray2bin(d.gray, d.bin); }, iters, r.minMs, r.medianMs);
+    results.push_back(r);
+
+    // Adaptive binarization isn't used by the following stages.
+    cv::Mat adaptiveBin;
+    r.stage = "gray2binAdaptive";
+    measure([&] { gray2bin(d.gray, adaptiveBin, AdaptiveThreshold()); }, iters, r.minMs, r.medianMs);
+    results.push_back(r);
+
+    r.stage = "countPixels";
+    measure([&] { countRows(d); }, iters, r.minMs, r.medianMs);
+    results.push_back(r);
+
+    r.stage = "checkRatios";
+    measure([&] { checkRows(d); }, iters, r.minMs, r.medianMs);
+    r.ok = !d.hits.empty();
+    results.push_back(r);
+
+    r.stage = "verifyVertical";
+    measure([&] { r.ok = verifyHits(d); }, iters, r.minMs, r.medianMs);
+    results.push_back(r);
+
+    findCandidates(d.bin, d.candidates, d.rows);
+    r.stage = "computeCenters";
+    measure([&] { computeCenters(d.candidates, d.centers); }, iters, r.minMs, r.medianMs);
+    r.ok = d.centers.size() == 3;
+    results.push_back(r);
+
+    r.stage = "extract";
+    if (d.centers.size() == 3)
+    {
+        sortMarkers(d.centers, d.topLeft, d.topRight, d.bottomLeft);
+        measure([&] { extract(d.bin, d.topLeft, d.topRight, d.bottomLeft, d.modules); },
+                iters, r.minMs, r.medianMs);
+        r.ok = d.modules.size() == modules.size() && cv::countNonZero(d.modules != modules) == 0;
+    }
+    else
+    {
+        r.minMs = r.medianMs = 0;
+        r.ok = false;
+    }
+    results.push_back(r);
+
+    r.stage = "decode";
+    measure([&] { d.msg = detector.decode(d.bin, noImg); }, iters, r.minMs, r.medianMs);
+    r.ok = d.msg == kMessage;
+    results.push_back(r);
+
+    // Sparse scan assuming modules are at least a half of the actual size.
+    params.minModuleSize = std::max(1, synthetic.moduleSize / 2);
+    QrDetector sparse(params);
+    r.stage = "decodeSparse";
+    measure([&] { d.msg = sparse.decode(d.bin, noImg); }, iters, r.minMs, r.medianMs);
+    r.ok = d.msg == kMessage;
+    results.push_back(r);
+}
+
+static void printCsv(const std::vector<Result>& results)
+{
+    std::cout << "stage,width,height,min_ms,median_ms,mpix_per_s,ok" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        std::cout << r.stage << "," << r.size.width << "," << r.size.height << ","
+                  << std::fixed << std::setprecision(4) << r.minMs << "," << r.medianMs << ","
+                  << std::setprecision(1) << (r.minMs > 0 ? r.size.area() * 1e-3 / r.minMs : 0.0)
+                  << "," << r.ok << std::endl;
+    }
+}
+
+static void printJson(const std::vector<Result>& results)
+{
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        std::cout << "{\"stage\":\"" << r.stage << "\",\"width\":" << r.size.width
+                  << ",\"height\":" << r.size.height << std::fixed << std::setprecision(4)
+                  << ",\"min_ms\":" << r.minMs << ",\"median_ms\":" << r.medianMs
+                  << std::setprecision(1)
+                  << ",\"mpix_per_s\":" << (r.minMs > 0 ? r.size.area() * 1e-3 / r.minMs : 0.0)
+                  << ",\"ok\":" << (r.ok ? "true" : "false") << "}" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    cv::CommandLineParser parser(argc, argv, keys);
+    parser.about("Per-stage benchmarks of QR codes detector on synthetic frames");
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+    const std::string format = parser.get<std::string>("format");
+    const int iters = parser.get<int>("iters");
+    if (format != "csv" && format != "json")
+    {
+        std::cerr << "Unknown format " << format << std::endl;
+        return 1;
+    }
+    if (iters < 1)
+    {
+        std::cerr << "Number of iterations must be positive" << std::endl;
+        return 1;
+    }
+
+    SyntheticParams synthetic;
+    synthetic.noise = parser.get<double>("noise");
+    synthetic.blur = parser.get<int>("blur");
+    synthetic.angle = parser.get<float>("angle");
+    synthetic.perspective = 0.03f;
+    synthetic.seed = parser.get<int>("seed");
+
+    const cv::Size sizes[] = {cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080),
+                              cv::Size(3840, 2160)};
+    std::vector<Result> results;
+    for (int i = 0; i < 4; ++i)
+    {
+        // Code with a quiet zone takes about a half of the frame height.
+        synthetic.moduleSize = std::max(2, sizes[i].height / 60);
+        benchFrame(sizes[i], synthetic, iters, results);
+    }
+
+    if (format == "csv")
+        printCsv(results);
+    else
+        printJson(results);
+    return 0;
+}
@@ -0,0 +1,1100 @@
+#include "qrcode.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define QR_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define QR_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Kernels for a specific instruction set are compiled with a function-level
+// target so the whole project doesn't need -mavx2. Which one actually runs is
+// decided at runtime by cv::checkHardwareSupport.
+#if defined(__GNUC__)
+#define QR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define QR_TARGET(isa)
+#endif
+
+// Fixed-point weights of BGR to grayscale conversion (the same cv::cvtColor uses):
+// gray = (B * kB + G * kG + R * kR + kHalf) >> kShift
+// Weights sum up to 1 << kShift so white stays 255.
+enum { kB = 1868, kG = 9617, kR = 4899, kShift = 14, kHalf = 1 << (kShift - 1) };
+
+// Fused kernel compares weighted sums without a rounding shift:
+// gray > thresh  <=>  B * kB + G * kG + R * kR >= binLimit(thresh)
+static inline int binLimit(uint8_t thresh)
+{
+    return ((thresh + 1) << kShift) - kHalf;
+}
+
+typedef void (*Bgr2GrayRow)(const uint8_t* src, uint8_t* dst, int width);
+typedef void (*Bgra2GrayRow)(const uint8_t* src, uint8_t* dst, int width);
+typedef void (*Gray2BinRow)(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh);
+typedef void (*Bgr2BinRow)(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh);
+typedef void (*Gray2BitsRow)(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh);
+typedef void (*Bgr2BitsRow)(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh);
+typedef void (*Bgra2BitsRow)(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh);
+typedef void (*AdaptiveBinRow)(const uint8_t* src, const int32_t* sums, uint8_t* dst, int width,
+                               int area, int delta);
+
+struct RowKernels
+{
+    Bgr2GrayRow bgr2gray;
+    Bgra2GrayRow bgra2gray;
+    Gray2BinRow gray2bin;
+    Bgr2BinRow bgr2bin;
+    Gray2BitsRow gray2bits;
+    Bgr2BitsRow bgr2bits;
+    Bgra2BitsRow bgra2bits;
+    AdaptiveBinRow adaptiveBin;
+};
+
+//
+// Scalar code path. Vectorized kernels use it for row tails.
+//
+static void bgr2grayRow_scalar(const uint8_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; ++x, src += 3)
+        dst[x] = (uint8_t)((src[0] * kB + src[1] * kG + src[2] * kR + kHalf) >> kShift);
+}
+
+static void bgra2grayRow_scalar(const uint8_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; ++x, src += 4)
+        dst[x] = (uint8_t)((src[0] * kB + src[1] * kG + src[2] * kR + kHalf) >> kShift);
+}
+
+static void gray2binRow_scalar(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    for (int x = 0; x < width; ++x)
+        dst[x] = src[x] > thresh ? 255 : 0;
+}
+
+static void bgr2binRow_scalar(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const int limit = binLimit(thresh);
+    for (int x = 0; x < width; ++x, src += 3)
+        dst[x] = src[0] * kB + src[1] * kG + src[2] * kR >= limit ? 255 : 0;
+}
+
+// Packed kernels fill whole words so vectorized ones process 64 pixels per
+// iteration and leave the last incomplete word to the scalar code.
+static void gray2bitsRow_scalar(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    for (int x = 0; x < width; x += 64)
+    {
+        const int n = std::min(64, width - x);
+        uint64_t word = 0;
+        for (int i = 0; i < n; ++i)
+            word |= (uint64_t)(src[x + i] > thresh) << i;
+        dst[x >> 6] = word;
+    }
+}
+
+static void bgr2bitsRow_scalar(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const int limit = binLimit(thresh);
+    for (int x = 0; x < width; x += 64)
+    {
+        const int n = std::min(64, width - x);
+        uint64_t word = 0;
+        for (int i = 0; i < n; ++i, src += 3)
+            word |= (uint64_t)(src[0] * kB + src[1] * kG + src[2] * kR >= limit) << i;
+        dst[x >> 6] = word;
+    }
+}
+
+// The same with alpha channel which is skipped.
+static void bgra2bitsRow_scalar(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const int limit = binLimit(thresh);
+    for (int x = 0; x < width; x += 64)
+    {
+        const int n = std::min(64, width - x);
+        uint64_t word = 0;
+        for (int i = 0; i < n; ++i, src += 4)
+            word |= (uint64_t)(src[0] * kB + src[1] * kG + src[2] * kR >= limit) << i;
+        dst[x >> 6] = word;
+    }
+}
+
+// Local threshold without division: src > sum / area - delta.
+// sums are sums of windows around pixels, area is a number of pixels in a window.
+static void adaptiveBinRow_scalar(const uint8_t* src, const int32_t* sums, uint8_t* dst, int width,
+                                  int area, int delta)
+{
+    for (int x = 0; x < width; ++x)
+        dst[x] = (src[x] + delta) * area > sums[x] ? 255 : 0;
+}
+
+#ifdef QR_X86
+//
+// SSSE3 code path: 16 pixels per iteration.
+//
+
+// Splits 16 interleaved BGR pixels to separate channels.
+QR_TARGET("ssse3")
+static inline void deinterleave_ssse3(const uint8_t* src, __m128i& b, __m128i& g, __m128i& r)
+{
+    const __m128i v0 = _mm_loadu_si128((const __m128i*)src);
+    const __m128i v1 = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i v2 = _mm_loadu_si128((const __m128i*)(src + 32));
+
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0), _mm_shuffle_epi8(v1, b1)),
+                     _mm_shuffle_epi8(v2, b2));
+    g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0), _mm_shuffle_epi8(v1, g1)),
+                     _mm_shuffle_epi8(v2, g2));
+    r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0), _mm_shuffle_epi8(v1, r1)),
+                     _mm_shuffle_epi8(v2, r2));
+}
+
+// Splits 16 BGRA pixels to separate channels. Every 4 pixels are grouped by
+// channels and then 4x4 blocks of 32-bit groups are transposed.
+QR_TARGET("ssse3")
+static inline void deinterleaveBgra_ssse3(const uint8_t* src, __m128i& b, __m128i& g, __m128i& r)
+{
+    const __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    const __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), group);
+    const __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 16)), group);
+    const __m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 32)), group);
+    const __m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 48)), group);
+
+    // (B0 B1 G0 G1), (R0 R1 A0 A1) where digits are indices of 4-pixel groups.
+    const __m128i t0 = _mm_unpacklo_epi32(v0, v1), t1 = _mm_unpackhi_epi32(v0, v1);
+    const __m128i t2 = _mm_unpacklo_epi32(v2, v3), t3 = _mm_unpackhi_epi32(v2, v3);
+    b = _mm_unpacklo_epi64(t0, t2);
+    g = _mm_unpackhi_epi64(t0, t2);
+    r = _mm_unpacklo_epi64(t1, t3);
+}
+
+// Computes B * kB + G * kG + R * kR + kHalf for 8 pixels with 16-bit channels.
+// Multiplications are done by pmaddwd over (B, G) and (R, 1) pairs.
+QR_TARGET("ssse3")
+static inline void weightedSums_ssse3(__m128i b, __m128i g, __m128i r, __m128i& lo, __m128i& hi)
+{
+    const __m128i kBG = _mm_set1_epi32((kG << 16) | kB);
+    const __m128i kRH = _mm_set1_epi32((kHalf << 16) | kR);
+    const __m128i one = _mm_set1_epi16(1);
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b, g), kBG),
+                       _mm_madd_epi16(_mm_unpacklo_epi16(r, one), kRH));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b, g), kBG),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(r, one), kRH));
+}
+
+// Weighted sums of 16 pixels with 8-bit channels in order.
+QR_TARGET("ssse3")
+static inline void channelSums_ssse3(__m128i b, __m128i g, __m128i r, __m128i s[4])
+{
+    const __m128i zero = _mm_setzero_si128();
+    weightedSums_ssse3(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero),
+                       _mm_unpacklo_epi8(r, zero), s[0], s[1]);
+    weightedSums_ssse3(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero),
+                       _mm_unpackhi_epi8(r, zero), s[2], s[3]);
+}
+
+// Weighted sums of 16 BGR pixels in order.
+QR_TARGET("ssse3")
+static inline void bgrSums_ssse3(const uint8_t* src, __m128i s[4])
+{
+    __m128i b, g, r;
+    deinterleave_ssse3(src, b, g, r);
+    channelSums_ssse3(b, g, r, s);
+}
+
+QR_TARGET("ssse3")
+static void bgr2grayRow_ssse3(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m128i s[4];
+        bgrSums_ssse3(src + x * 3, s);
+        const __m128i lo = _mm_packs_epi32(_mm_srli_epi32(s[0], kShift), _mm_srli_epi32(s[1], kShift));
+        const __m128i hi = _mm_packs_epi32(_mm_srli_epi32(s[2], kShift), _mm_srli_epi32(s[3], kShift));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    bgr2grayRow_scalar(src + x * 3, dst + x, width - x);
+}
+
+QR_TARGET("ssse3")
+static void bgra2grayRow_ssse3(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m128i s[4], b, g, r;
+        deinterleaveBgra_ssse3(src + x * 4, b, g, r);
+        channelSums_ssse3(b, g, r, s);
+        const __m128i lo = _mm_packs_epi32(_mm_srli_epi32(s[0], kShift), _mm_srli_epi32(s[1], kShift));
+        const __m128i hi = _mm_packs_epi32(_mm_srli_epi32(s[2], kShift), _mm_srli_epi32(s[3], kShift));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    bgra2grayRow_scalar(src + x * 4, dst + x, width - x);
+}
+
+// 0xFF for pixels brighter than threshold, 0 otherwise. There is no unsigned
+// bytes comparison so the sign bit is flipped on both sides (see grayThresh_ssse3).
+QR_TARGET("ssse3")
+static inline __m128i grayMask_ssse3(const uint8_t* src, __m128i t)
+{
+    const __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)src), _mm_set1_epi8((char)0x80));
+    return _mm_cmpgt_epi8(v, t);
+}
+
+QR_TARGET("ssse3")
+static inline __m128i grayThresh_ssse3(uint8_t thresh)
+{
+    return _mm_set1_epi8((char)(thresh ^ 0x80));
+}
+
+// 0xFF for white pixels among 16 ones with weighted sums s, 0 for black.
+// limit is a threshold for sums which already include kHalf.
+QR_TARGET("ssse3")
+static inline __m128i sumsMask_ssse3(const __m128i s[4], __m128i limit)
+{
+    // Masks of 0 and -1 stay the same after signed saturation.
+    const __m128i lo = _mm_packs_epi32(_mm_cmpgt_epi32(s[0], limit), _mm_cmpgt_epi32(s[1], limit));
+    const __m128i hi = _mm_packs_epi32(_mm_cmpgt_epi32(s[2], limit), _mm_cmpgt_epi32(s[3], limit));
+    return _mm_packs_epi16(lo, hi);
+}
+
+QR_TARGET("ssse3")
+static inline __m128i bgrMask_ssse3(const uint8_t* src, __m128i limit)
+{
+    __m128i s[4];
+    bgrSums_ssse3(src, s);
+    return sumsMask_ssse3(s, limit);
+}
+
+QR_TARGET("ssse3")
+static inline __m128i bgraMask_ssse3(const uint8_t* src, __m128i limit)
+{
+    __m128i s[4], b, g, r;
+    deinterleaveBgra_ssse3(src, b, g, r);
+    channelSums_ssse3(b, g, r, s);
+    return sumsMask_ssse3(s, limit);
+}
+
+QR_TARGET("ssse3")
+static void gray2binRow_ssse3(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const __m128i t = grayThresh_ssse3(thresh);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+        _mm_storeu_si128((__m128i*)(dst + x), grayMask_ssse3(src + x, t));
+    gray2binRow_scalar(src + x, dst + x, width - x, thresh);
+}
+
+QR_TARGET("ssse3")
+static void bgr2binRow_ssse3(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const __m128i limit = _mm_set1_epi32(binLimit(thresh) + kHalf - 1);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+        _mm_storeu_si128((__m128i*)(dst + x), bgrMask_ssse3(src + x * 3, limit));
+    bgr2binRow_scalar(src + x * 3, dst + x, width - x, thresh);
+}
+
+QR_TARGET("ssse3")
+static void gray2bitsRow_ssse3(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const __m128i t = grayThresh_ssse3(thresh);
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= (uint64_t)(uint16_t)_mm_movemask_epi8(grayMask_ssse3(src + x + i * 16, t)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    gray2bitsRow_scalar(src + x, dst + (x >> 6), width - x, thresh);
+}
+
+QR_TARGET("ssse3")
+static void bgr2bitsRow_ssse3(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const __m128i limit = _mm_set1_epi32(binLimit(thresh) + kHalf - 1);
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= (uint64_t)(uint16_t)_mm_movemask_epi8(bgrMask_ssse3(src + (x + i * 16) * 3, limit)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    bgr2bitsRow_scalar(src + x * 3, dst + (x >> 6), width - x, thresh);
+}
+
+QR_TARGET("ssse3")
+static void bgra2bitsRow_ssse3(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const __m128i limit = _mm_set1_epi32(binLimit(thresh) + kHalf - 1);
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= (uint64_t)(uint16_t)_mm_movemask_epi8(bgraMask_ssse3(src + (x + i * 16) * 4, limit)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    bgra2bitsRow_scalar(src + x * 4, dst + (x >> 6), width - x, thresh);
+}
+
+// Low halves of products of 32-bit lanes. pmulld is SSE4.1 so two pmuludq
+// multiply even and odd lanes instead.
+QR_TARGET("ssse3")
+static inline __m128i mullo_ssse3(__m128i a, __m128i b)
+{
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+QR_TARGET("ssse3")
+static void adaptiveBinRow_ssse3(const uint8_t* src, const int32_t* sums, uint8_t* dst, int width,
+                                 int area, int delta)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a = _mm_set1_epi32(area), d = _mm_set1_epi32(delta);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+        const __m128i v16[] = {_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)};
+        __m128i m[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const __m128i v32 = (i & 1) ? _mm_unpackhi_epi16(v16[i >> 1], zero)
+                                        : _mm_unpacklo_epi16(v16[i >> 1], zero);
+            const __m128i s = _mm_loadu_si128((const __m128i*)(sums + x + i * 4));
+            m[i] = _mm_cmpgt_epi32(mullo_ssse3(_mm_add_epi32(v32, d), a), s);
+        }
+        _mm_storeu_si128((__m128i*)(dst + x),
+                         _mm_packs_epi16(_mm_packs_epi32(m[0], m[1]), _mm_packs_epi32(m[2], m[3])));
+    }
+    adaptiveBinRow_scalar(src + x, sums + x, dst + x, width - x, area, delta);
+}
+
+//
+// AVX2 code path. Pixels are deinterleaved by SSSE3 shuffles (they don't cross
+// 128-bit lanes) and all the arithmetic is done on 16 pixels at once.
+//
+QR_TARGET("avx2")
+static inline void channelSums_avx2(__m128i b8, __m128i g8, __m128i r8, __m256i& lo, __m256i& hi)
+{
+    const __m256i kBG = _mm256_set1_epi32((kG << 16) | kB);
+    const __m256i kRH = _mm256_set1_epi32((kHalf << 16) | kR);
+    const __m256i one = _mm256_set1_epi16(1);
+
+    const __m256i b = _mm256_cvtepu8_epi16(b8);
+    const __m256i g = _mm256_cvtepu8_epi16(g8);
+    const __m256i r = _mm256_cvtepu8_epi16(r8);
+
+    // Unpacking works within lanes: lo keeps pixels 0-3 and 8-11, hi keeps 4-7 and 12-15.
+    // Packing back in the same manner restores the original order.
+    lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(b, g), kBG),
+                          _mm256_madd_epi16(_mm256_unpacklo_epi16(r, one), kRH));
+    hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(b, g), kBG),
+                          _mm256_madd_epi16(_mm256_unpackhi_epi16(r, one), kRH));
+}
+
+QR_TARGET("avx2")
+static inline void bgrSums_avx2(const uint8_t* src, __m256i& lo, __m256i& hi)
+{
+    __m128i b8, g8, r8;
+    deinterleave_ssse3(src, b8, g8, r8);
+    channelSums_avx2(b8, g8, r8, lo, hi);
+}
+
+QR_TARGET("avx2")
+static void bgr2grayRow_avx2(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m256i lo, hi;
+        bgrSums_avx2(src + x * 3, lo, hi);
+        const __m256i v = _mm256_packs_epi32(_mm256_srli_epi32(lo, kShift), _mm256_srli_epi32(hi, kShift));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(_mm256_castsi256_si128(v),
+                                                               _mm256_extracti128_si256(v, 1)));
+    }
+    bgr2grayRow_scalar(src + x * 3, dst + x, width - x);
+}
+
+QR_TARGET("avx2")
+static void bgra2grayRow_avx2(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m128i b8, g8, r8;
+        __m256i lo, hi;
+        deinterleaveBgra_ssse3(src + x * 4, b8, g8, r8);
+        channelSums_avx2(b8, g8, r8, lo, hi);
+        const __m256i v = _mm256_packs_epi32(_mm256_srli_epi32(lo, kShift), _mm256_srli_epi32(hi, kShift));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(_mm256_castsi256_si128(v),
+                                                               _mm256_extracti128_si256(v, 1)));
+    }
+    bgra2grayRow_scalar(src + x * 4, dst + x, width - x);
+}
+
+QR_TARGET("avx2")
+static inline __m256i grayMask_avx2(const uint8_t* src, __m256i t)
+{
+    const __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)src), _mm256_set1_epi8((char)0x80));
+    return _mm256_cmpgt_epi8(v, t);
+}
+
+QR_TARGET("avx2")
+static inline __m128i sumsMask_avx2(__m256i lo, __m256i hi, __m256i limit)
+{
+    const __m256i v = _mm256_packs_epi32(_mm256_cmpgt_epi32(lo, limit), _mm256_cmpgt_epi32(hi, limit));
+    return _mm_packs_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+QR_TARGET("avx2")
+static inline __m128i bgrMask_avx2(const uint8_t* src, __m256i limit)
+{
+    __m256i lo, hi;
+    bgrSums_avx2(src, lo, hi);
+    return sumsMask_avx2(lo, hi, limit);
+}
+
+QR_TARGET("avx2")
+static inline __m128i bgraMask_avx2(const uint8_t* src, __m256i limit)
+{
+    __m128i b8, g8, r8;
+    __m256i lo, hi;
+    deinterleaveBgra_ssse3(src, b8, g8, r8);
+    channelSums_avx2(b8, g8, r8, lo, hi);
+    return sumsMask_avx2(lo, hi, limit);
+}
+
+QR_TARGET("avx2")
+static void gray2binRow_avx2(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const __m256i t = _mm256_set1_epi8((char)(thresh ^ 0x80));
+    int x = 0;
+    for (; x <= width - 32; x += 32)
+        _mm256_storeu_si256((__m256i*)(dst + x), grayMask_avx2(src + x, t));
+    gray2binRow_scalar(src + x, dst + x, width - x, thresh);
+}
+
+QR_TARGET("avx2")
+static void bgr2binRow_avx2(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const __m256i limit = _mm256_set1_epi32(binLimit(thresh) + kHalf - 1);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+        _mm_storeu_si128((__m128i*)(dst + x), bgrMask_avx2(src + x * 3, limit));
+    bgr2binRow_scalar(src + x * 3, dst + x, width - x, thresh);
+}
+
+QR_TARGET("avx2")
+static void gray2bitsRow_avx2(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const __m256i t = _mm256_set1_epi8((char)(thresh ^ 0x80));
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        const uint64_t lo = (uint32_t)_mm256_movemask_epi8(grayMask_avx2(src + x, t));
+        const uint64_t hi = (uint32_t)_mm256_movemask_epi8(grayMask_avx2(src + x + 32, t));
+        dst[x >> 6] = lo | (hi << 32);
+    }
+    gray2bitsRow_scalar(src + x, dst + (x >> 6), width - x, thresh);
+}
+
+QR_TARGET("avx2")
+static void bgr2bitsRow_avx2(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const __m256i limit = _mm256_set1_epi32(binLimit(thresh) + kHalf - 1);
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= (uint64_t)(uint16_t)_mm_movemask_epi8(bgrMask_avx2(src + (x + i * 16) * 3, limit)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    bgr2bitsRow_scalar(src + x * 3, dst + (x >> 6), width - x, thresh);
+}
+
+QR_TARGET("avx2")
+static void bgra2bitsRow_avx2(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const __m256i limit = _mm256_set1_epi32(binLimit(thresh) + kHalf - 1);
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= (uint64_t)(uint16_t)_mm_movemask_epi8(bgraMask_avx2(src + (x + i * 16) * 4, limit)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    bgra2bitsRow_scalar(src + x * 4, dst + (x >> 6), width - x, thresh);
+}
+
+QR_TARGET("avx2")
+static void adaptiveBinRow_avx2(const uint8_t* src, const int32_t* sums, uint8_t* dst, int width,
+                                int area, int delta)
+{
+    const __m256i a = _mm256_set1_epi32(area), d = _mm256_set1_epi32(delta);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        __m256i m[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x + i * 8)));
+            const __m256i s = _mm256_loadu_si256((const __m256i*)(sums + x + i * 8));
+            m[i] = _mm256_cmpgt_epi32(_mm256_mullo_epi32(_mm256_add_epi32(v, d), a), s);
+        }
+        // Packing works within 128-bit lanes so quarters are put back in order.
+        const __m256i m16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(m[0], m[1]), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packs_epi16(_mm256_castsi256_si128(m16),
+                                                              _mm256_extracti128_si256(m16, 1)));
+    }
+    adaptiveBinRow_scalar(src + x, sums + x, dst + x, width - x, area, delta);
+}
+#endif  // QR_X86
+
+#ifdef QR_NEON
+//
+// NEON code path: vld3q_u8 and vld4q_u8 deinterleave 16 pixels for free.
+//
+static inline void channelSums_neon(uint8x16_t b8, uint8x16_t g8, uint8x16_t r8, uint32x4_t s[4])
+{
+    const uint16x8_t b[] = {vmovl_u8(vget_low_u8(b8)), vmovl_u8(vget_high_u8(b8))};
+    const uint16x8_t g[] = {vmovl_u8(vget_low_u8(g8)), vmovl_u8(vget_high_u8(g8))};
+    const uint16x8_t r[] = {vmovl_u8(vget_low_u8(r8)), vmovl_u8(vget_high_u8(r8))};
+    for (int i = 0; i < 2; ++i)
+    {
+        uint32x4_t lo = vmull_n_u16(vget_low_u16(b[i]), kB);
+        uint32x4_t hi = vmull_n_u16(vget_high_u16(b[i]), kB);
+        lo = vmlal_n_u16(lo, vget_low_u16(g[i]), kG);
+        hi = vmlal_n_u16(hi, vget_high_u16(g[i]), kG);
+        s[i * 2] = vmlal_n_u16(lo, vget_low_u16(r[i]), kR);
+        s[i * 2 + 1] = vmlal_n_u16(hi, vget_high_u16(r[i]), kR);
+    }
+}
+
+static inline void bgrSums_neon(const uint8_t* src, uint32x4_t s[4])
+{
+    const uint8x16x3_t v = vld3q_u8(src);
+    channelSums_neon(v.val[0], v.val[1], v.val[2], s);
+}
+
+static void bgr2grayRow_neon(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        uint32x4_t s[4];
+        bgrSums_neon(src + x * 3, s);
+        // Rounding narrowing shift adds kHalf by itself.
+        const uint16x8_t lo = vcombine_u16(vrshrn_n_u32(s[0], kShift), vrshrn_n_u32(s[1], kShift));
+        const uint16x8_t hi = vcombine_u16(vrshrn_n_u32(s[2], kShift), vrshrn_n_u32(s[3], kShift));
+        vst1q_u8(dst + x, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+    bgr2grayRow_scalar(src + x * 3, dst + x, width - x);
+}
+
+static void bgra2grayRow_neon(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        const uint8x16x4_t v = vld4q_u8(src + x * 4);
+        uint32x4_t s[4];
+        channelSums_neon(v.val[0], v.val[1], v.val[2], s);
+        const uint16x8_t lo = vcombine_u16(vrshrn_n_u32(s[0], kShift), vrshrn_n_u32(s[1], kShift));
+        const uint16x8_t hi = vcombine_u16(vrshrn_n_u32(s[2], kShift), vrshrn_n_u32(s[3], kShift));
+        vst1q_u8(dst + x, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+    bgra2grayRow_scalar(src + x * 4, dst + x, width - x);
+}
+
+static inline uint8x16_t sumsMask_neon(const uint32x4_t s[4], uint32x4_t limit)
+{
+    const uint16x8_t lo = vcombine_u16(vmovn_u32(vcgeq_u32(s[0], limit)), vmovn_u32(vcgeq_u32(s[1], limit)));
+    const uint16x8_t hi = vcombine_u16(vmovn_u32(vcgeq_u32(s[2], limit)), vmovn_u32(vcgeq_u32(s[3], limit)));
+    return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+static inline uint8x16_t bgrMask_neon(const uint8_t* src, uint32x4_t limit)
+{
+    uint32x4_t s[4];
+    bgrSums_neon(src, s);
+    return sumsMask_neon(s, limit);
+}
+
+static inline uint8x16_t bgraMask_neon(const uint8_t* src, uint32x4_t limit)
+{
+    const uint8x16x4_t v = vld4q_u8(src);
+    uint32x4_t s[4];
+    channelSums_neon(v.val[0], v.val[1], v.val[2], s);
+    return sumsMask_neon(s, limit);
+}
+
+// There is no movemask in NEON: keep a single bit of every byte and sum them up.
+static inline uint64_t movemask_neon(uint8x16_t mask)
+{
+    static const uint8_t weights[] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(mask, vld1q_u8(weights)))));
+    return vgetq_lane_u64(sums, 0) | (vgetq_lane_u64(sums, 1) << 8);
+}
+
+static void gray2binRow_neon(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const uint8x16_t t = vdupq_n_u8(thresh);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+        vst1q_u8(dst + x, vcgtq_u8(vld1q_u8(src + x), t));
+    gray2binRow_scalar(src + x, dst + x, width - x, thresh);
+}
+
+static void bgr2binRow_neon(const uint8_t* src, uint8_t* dst, int width, uint8_t thresh)
+{
+    const uint32x4_t limit = vdupq_n_u32(binLimit(thresh));
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+        vst1q_u8(dst + x, bgrMask_neon(src + x * 3, limit));
+    bgr2binRow_scalar(src + x * 3, dst + x, width - x, thresh);
+}
+
+static void gray2bitsRow_neon(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const uint8x16_t t = vdupq_n_u8(thresh);
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= movemask_neon(vcgtq_u8(vld1q_u8(src + x + i * 16), t)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    gray2bitsRow_scalar(src + x, dst + (x >> 6), width - x, thresh);
+}
+
+static void bgr2bitsRow_neon(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const uint32x4_t limit = vdupq_n_u32(binLimit(thresh));
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= movemask_neon(bgrMask_neon(src + (x + i * 16) * 3, limit)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    bgr2bitsRow_scalar(src + x * 3, dst + (x >> 6), width - x, thresh);
+}
+
+static void bgra2bitsRow_neon(const uint8_t* src, uint64_t* dst, int width, uint8_t thresh)
+{
+    const uint32x4_t limit = vdupq_n_u32(binLimit(thresh));
+    int x = 0;
+    for (; x <= width - 64; x += 64)
+    {
+        uint64_t word = 0;
+        for (int i = 0; i < 4; ++i)
+            word |= movemask_neon(bgraMask_neon(src + (x + i * 16) * 4, limit)) << (i * 16);
+        dst[x >> 6] = word;
+    }
+    bgra2bitsRow_scalar(src + x * 4, dst + (x >> 6), width - x, thresh);
+}
+
+static void adaptiveBinRow_neon(const uint8_t* src, const int32_t* sums, uint8_t* dst, int width,
+                                int area, int delta)
+{
+    const int32x4_t d = vdupq_n_s32(delta);
+    int x = 0;
+    for (; x <= width - 16; x += 16)
+    {
+        const uint8x16_t v = vld1q_u8(src + x);
+        const uint16x8_t v16[] = {vmovl_u8(vget_low_u8(v)), vmovl_u8(vget_high_u8(v))};
+        uint16x4_t m[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const uint16x4_t half = (i & 1) ? vget_high_u16(v16[i >> 1]) : vget_low_u16(v16[i >> 1]);
+            const int32x4_t v32 = vreinterpretq_s32_u32(vmovl_u16(half));
+            m[i] = vmovn_u32(vcgtq_s32(vmulq_n_s32(vaddq_s32(v32, d), area), vld1q_s32(sums + x + i * 4)));
+        }
+        vst1q_u8(dst + x, vcombine_u8(vmovn_u16(vcombine_u16(m[0], m[1])),
+                                      vmovn_u16(vcombine_u16(m[2], m[3]))));
+    }
+    adaptiveBinRow_scalar(src + x, sums + x, dst + x, width - x, area, delta);
+}
+#endif  // QR_NEON
+
+bool hasSimdPath(SimdPath path)
+{
+    switch (path)
+    {
+    case SIMD_AUTO:
+    case SIMD_SCALAR:
+        return true;
+#ifdef QR_X86
+    case SIMD_SSSE3:
+        return cv::checkHardwareSupport(CV_CPU_SSSE3);
+    case SIMD_AVX2:
+        return cv::checkHardwareSupport(CV_CPU_AVX2);
+#endif
+#ifdef QR_NEON
+    case SIMD_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static SimdPath bestSimdPath()
+{
+    const SimdPath paths[] = {SIMD_AVX2, SIMD_SSSE3, SIMD_NEON};
+    for (int i = 0; i < 3; ++i)
+    {
+        if (hasSimdPath(paths[i]))
+            return paths[i];
+    }
+    return SIMD_SCALAR;
+}
+
+static const RowKernels& getKernels(SimdPath path)
+{
+    static const RowKernels scalar = {bgr2grayRow_scalar, bgra2grayRow_scalar, gray2binRow_scalar,
+                                      bgr2binRow_scalar, gray2bitsRow_scalar, bgr2bitsRow_scalar,
+                                      bgra2bitsRow_scalar, adaptiveBinRow_scalar};
+#ifdef QR_X86
+    static const RowKernels ssse3 = {bgr2grayRow_ssse3, bgra2grayRow_ssse3, gray2binRow_ssse3,
+                                     bgr2binRow_ssse3, gray2bitsRow_ssse3, bgr2bitsRow_ssse3,
+                                     bgra2bitsRow_ssse3, adaptiveBinRow_ssse3};
+    static const RowKernels avx2 = {bgr2grayRow_avx2, bgra2grayRow_avx2, gray2binRow_avx2,
+                                    bgr2binRow_avx2, gray2bitsRow_avx2, bgr2bitsRow_avx2,
+                                    bgra2bitsRow_avx2, adaptiveBinRow_avx2};
+#endif
+#ifdef QR_NEON
+    static const RowKernels neon = {bgr2grayRow_neon, bgra2grayRow_neon, gray2binRow_neon,
+                                    bgr2binRow_neon, gray2bitsRow_neon, bgr2bitsRow_neon,
+                                    bgra2bitsRow_neon, adaptiveBinRow_neon};
+#endif
+    static const SimdPath best = bestSimdPath();
+
+    if (path == SIMD_AUTO)
+        path = best;
+    else if (!hasSimdPath(path))
+        CV_Error(cv::Error::StsNotImplemented, "Requested SIMD code path is not available");
+
+    switch (path)
+    {
+#ifdef QR_X86
+    case SIMD_SSSE3: return ssse3;
+    case SIMD_AVX2: return avx2;
+#endif
+#ifdef QR_NEON
+    case SIMD_NEON: return neon;
+#endif
+    default: return scalar;
+    }
+}
+
+void bgr2gray(const cv::Mat& src, cv::Mat& dst, SimdPath path)
+{
+    CV_Assert(src.type() == CV_8UC3 || src.type() == CV_8UC4);
+    const RowKernels& kernels = getKernels(path);
+    const Bgr2GrayRow row = src.channels() == 3 ? kernels.bgr2gray : kernels.bgra2gray;
+    dst.create(src.size(), CV_8UC1);
+    for (int y = 0; y < src.rows; ++y)
+        row(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), src.cols);
+}
+
+void gray2bin(const cv::Mat& src, cv::Mat& dst, uint8_t thresh, SimdPath path)
+{
+    CV_Assert(src.type() == CV_8UC1);
+    const RowKernels& kernels = getKernels(path);
+    dst.create(src.size(), CV_8UC1);
+    for (int y = 0; y < src.rows; ++y)
+        kernels.gray2bin(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), src.cols, thresh);
+}
+
+void bgr2bin(const cv::Mat& src, cv::Mat& dst, uint8_t thresh, SimdPath path)
+{
+    CV_Assert(src.type() == CV_8UC3);
+    const RowKernels& kernels = getKernels(path);
+    dst.create(src.size(), CV_8UC1);
+    for (int y = 0; y < src.rows; ++y)
+        kernels.bgr2bin(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), src.cols, thresh);
+}
+
+void BitImage::create(int newRows, int newCols)
+{
+    rows = newRows;
+    cols = newCols;
+    wordsPerRow = (newCols + 63) / 64;
+    data.resize((size_t)rows * wordsPerRow);
+}
+
+void gray2bin(const cv::Mat& src, BitImage& dst, uint8_t thresh, SimdPath path)
+{
+    CV_Assert(src.type() == CV_8UC1);
+    const RowKernels& kernels = getKernels(path);
+    dst.create(src.rows, src.cols);
+    for (int y = 0; y < src.rows; ++y)
+        kernels.gray2bits(src.ptr<uint8_t>(y), dst.ptr(y), src.cols, thresh);
+}
+
+void bgr2bin(const cv::Mat& src, BitImage& dst, uint8_t thresh, SimdPath path)
+{
+    CV_Assert(src.type() == CV_8UC3);
+    const RowKernels& kernels = getKernels(path);
+    dst.create(src.rows, src.cols);
+    for (int y = 0; y < src.rows; ++y)
+        kernels.bgr2bits(src.ptr<uint8_t>(y), dst.ptr(y), src.cols, thresh);
+}
+
+void bgra2bin(const cv::Mat& src, BitImage& dst, uint8_t thresh, SimdPath path)
+{
+    CV_Assert(src.type() == CV_8UC4);
+    const RowKernels& kernels = getKernels(path);
+    dst.create(src.rows, src.cols);
+    for (int y = 0; y < src.rows; ++y)
+        kernels.bgra2bits(src.ptr<uint8_t>(y), dst.ptr(y), src.cols, thresh);
+}
+
+ImageView::ImageView(const void* data, int width, int height, size_t stride, PixelFormat format)
+    : data((const uint8_t*)data), width(width), height(height), stride(stride), format(format)
+{
+    const int channels = format == PIXEL_BGR ? 3 : format == PIXEL_BGRA ? 4 : 1;
+    if (this->stride == 0)
+        this->stride = (size_t)width * channels;
+    CV_Assert(data && width > 0 && height > 0);
+    CV_Assert(this->stride >= (size_t)width * channels);
+}
+
+cv::Mat ImageView::plane() const
+{
+    const int type = format == PIXEL_BGR ? CV_8UC3 : format == PIXEL_BGRA ? CV_8UC4 : CV_8UC1;
+    return cv::Mat(height, width, type, (void*)data, stride);
+}
+
+void view2bin(const ImageView& view, BitImage& dst, uint8_t thresh, SimdPath path)
+{
+    const cv::Mat src = view.plane();
+    switch (view.format)
+    {
+    case PIXEL_BGR: bgr2bin(src, dst, thresh, path); break;
+    case PIXEL_BGRA: bgra2bin(src, dst, thresh, path); break;
+    // Luma of YUV formats is a grayscale image itself.
+    default: gray2bin(src, dst, thresh, path); break;
+    }
+}
+
+AdaptiveThreshold::AdaptiveThreshold(int windowSize, int delta, int numTiles)
+    : windowSize(windowSize), delta(delta), numTiles(numTiles) {}
+
+// Every stripe of rows keeps sums of columns of windows and slides them down
+// by a row. Sums of windows are running sums of column ones along a row.
+// Results are written either to bytes or to packed bits.
+class AdaptiveBinarizer : public cv::ParallelLoopBody
+{
+public:
+    AdaptiveBinarizer(const cv::Mat& src, int radius, int delta, int numTiles,
+                      const RowKernels& kernels, AdaptiveBuffers& buffers, cv::Mat* bytes,
+                      BitImage* bits)
+        : src(src), radius(radius), delta(delta), numTiles(numTiles), kernels(kernels),
+          buffers(buffers), bytes(bytes), bits(bits) {}
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int i = range.start; i < range.end; ++i)
+            binarize(i, src.rows * i / numTiles, src.rows * (i + 1) / numTiles);
+    }
+
+private:
+    const uint8_t* row(int y) const
+    {
+        return src.ptr<uint8_t>(std::max(0, std::min(y, src.rows - 1)));
+    }
+
+    // Sums of windows of a row of column sums. Clamping of indices is needed
+    // only near borders.
+    void slideRow(const int32_t* columns, int32_t* sums, int width) const
+    {
+        int32_t sum = 0;
+        for (int x = -radius; x <= radius; ++x)
+            sum += columns[std::max(0, std::min(x, width - 1))];
+        sums[0] = sum;
+        const int begin = std::min(radius + 1, width), end = std::max(begin, width - radius);
+        int x = 1;
+        for (; x < begin; ++x)
+        {
+            sum += columns[std::min(x + radius, width - 1)] - columns[0];
+            sums[x] = sum;
+        }
+        for (; x < end; ++x)
+        {
+            sum += columns[x + radius] - columns[x - radius - 1];
+            sums[x] = sum;
+        }
+        for (; x < width; ++x)
+        {
+            sum += columns[width - 1] - columns[std::max(x - radius - 1, 0)];
+            sums[x] = sum;
+        }
+    }
+
+    void binarize(int tile, int begin, int end) const
+    {
+        const int width = src.cols, side = 2 * radius + 1;
+        // Every stripe has its own part of the buffers.
+        int32_t* columns = &buffers.sums[2 * width * tile];
+        int32_t* sums = columns + width;
+        uint8_t* out = bits ? &buffers.bytes[width * tile] : 0;
+        std::fill(columns, columns + width, 0);
+        for (int y = begin - radius; y <= begin + radius; ++y)
+        {
+            const uint8_t* in = row(y);
+            for (int x = 0; x < width; ++x)
+                columns[x] += in[x];
+        }
+
+        for (int y = begin; y < end; ++y)
+        {
+            if (y > begin)
+            {
+                const uint8_t* in = row(y + radius);
+                const uint8_t* gone = row(y - radius - 1);
+                for (int x = 0; x < width; ++x)
+                    columns[x] += in[x] - gone[x];
+            }
+
+            slideRow(columns, sums, width);
+
+            uint8_t* dst = bits ? out : bytes->ptr<uint8_t>(y);
+            kernels.adaptiveBin(src.ptr<uint8_t>(y), sums, dst, width, side * side, delta);
+            if (bits)
+                kernels.gray2bits(dst, bits->ptr(y), width, 127);
+        }
+    }
+
+    const cv::Mat& src;
+    int radius, delta, numTiles;
+    const RowKernels& kernels;
+    AdaptiveBuffers& buffers;
+    cv::Mat* bytes;
+    BitImage* bits;
+};
+
+static void adaptiveBinarize(const cv::Mat& src, const AdaptiveThreshold& thresh, SimdPath path,
+                             AdaptiveBuffers& buffers, cv::Mat* bytes, BitImage* bits)
+{
+    CV_Assert(src.type() == CV_8UC1);
+    CV_Assert(0 <= thresh.windowSize && thresh.windowSize <= 2047);
+    const RowKernels& kernels = getKernels(path);
+    const int windowSize = thresh.windowSize ? thresh.windowSize
+                                             : std::max(3, std::min(src.rows, src.cols) / 8);
+    int numTiles = thresh.numTiles > 0 ? thresh.numTiles : cv::getNumThreads();
+    // A stripe initializes sums by a whole window so it should be several times taller.
+    numTiles = std::max(1, std::min(numTiles, src.rows / (2 * windowSize)));
+
+    // Buffers only grow so frames of the same size reuse them.
+    const size_t numSums = 2 * (size_t)src.cols * numTiles;
+    if (buffers.sums.size() < numSums)
+        buffers.sums.resize(numSums);
+    if (bits && buffers.bytes.size() < (size_t)src.cols * numTiles)
+        buffers.bytes.resize((size_t)src.cols * numTiles);
+
+    AdaptiveBinarizer binarizer(src, windowSize / 2, thresh.delta, numTiles, kernels, buffers,
+                                bytes, bits);
+    if (numTiles == 1)
+        binarizer(cv::Range(0, 1));
+    else
+        cv::parallel_for_(cv::Range(0, numTiles), binarizer, numTiles);
+}
+
+void gray2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh, SimdPath path)
+{
+    AdaptiveBuffers buffers;
+    gray2bin(src, dst, thresh, buffers, path);
+}
+
+void gray2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh, SimdPath path)
+{
+    AdaptiveBuffers buffers;
+    gray2bin(src, dst, thresh, buffers, path);
+}
+
+void bgr2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh, SimdPath path)
+{
+    AdaptiveBuffers buffers;
+    bgr2bin(src, dst, thresh, buffers, path);
+}
+
+void bgr2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh, SimdPath path)
+{
+    AdaptiveBuffers buffers;
+    bgr2bin(src, dst, thresh, buffers, path);
+}
+
+void view2bin(const ImageView& view, BitImage& dst, const AdaptiveThreshold& thresh, SimdPath path)
+{
+    AdaptiveBuffers buffers;
+    view2bin(view, dst, thresh, buffers, path);
+}
+
+void gray2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh,
+              AdaptiveBuffers& buffers, SimdPath path)
+{
+    dst.create(src.size(), CV_8UC1);
+    adaptiveBinarize(src, thresh, path, buffers, &dst, 0);
+}
+
+void gray2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh,
+              AdaptiveBuffers& buffers, SimdPath path)
+{
+    dst.create(src.rows, src.cols);
+    adaptiveBinarize(src, thresh, path, buffers, 0, &dst);
+}
+
+void bgr2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh,
+             AdaptiveBuffers& buffers, SimdPath path)
+{
+    bgr2gray(src, buffers.gray, path);
+    gray2bin(buffers.gray, dst, thresh, buffers, path);
+}
+
+void bgr2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh,
+             AdaptiveBuffers& buffers, SimdPath path)
+{
+    bgr2gray(src, buffers.gray, path);
+    gray2bin(buffers.gray, dst, thresh, buffers, path);
+}
+
+void view2bin(const ImageView& view, BitImage& dst, const AdaptiveThreshold& thresh,
+              AdaptiveBuffers& buffers, SimdPath path)
+{
+    const cv::Mat src = view.plane();
+    switch (view.format)
+    {
+    // bgr2gray() skips alpha of BGRA pixels.
+    case PIXEL_BGR:
+    case PIXEL_BGRA: bgr2bin(src, dst, thresh, buffers, path); break;
+    // Luma of YUV formats is a grayscale image itself.
+    default: gray2bin(src, dst, thresh, buffers, path); break;
+    }
+}
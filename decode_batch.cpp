@@ -0,0 +1,154 @@
+#include "qrcode.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+// Range of image indices owned by a worker. The owner takes images from the
+// beginning, thieves cut the second half off the end.
+struct WorkRange
+{
+    WorkRange() : begin(0), end(0) {}
+
+    std::mutex mutex;
+    size_t begin, end;
+};
+
+class BatchDecoder
+{
+public:
+    BatchDecoder(const std::vector<cv::Mat>& images, const BatchCallback& callback,
+                 const QrDetector::Params& params, int numThreads)
+        : images(images), callback(callback), params(params), ranges(numThreads)
+    {
+        for (int i = 0; i < numThreads; ++i)
+        {
+            ranges[i].begin = images.size() * i / numThreads;
+            ranges[i].end = images.size() * (i + 1) / numThreads;
+        }
+    }
+
+    void run()
+    {
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < ranges.size(); ++i)
+            workers.push_back(std::thread(&BatchDecoder::work, this, (int)i));
+        work(0);
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    void work(int worker)
+    {
+        try
+        {
+            QrDetector detector(params);
+            BitImage bin;
+            AdaptiveBuffers buffers;
+            size_t index;
+            while (take(worker, index) || steal(worker, index))
+            {
+                const cv::Mat& img = images[index];
+                if (params.adaptive && img.channels() == 3)
+                    bgr2bin(img, bin, params.adaptiveThreshold, buffers);
+                else if (params.adaptive)
+                    gray2bin(img, bin, params.adaptiveThreshold, buffers);
+                else if (img.channels() == 3)
+                    bgr2bin(img, bin);
+                else
+                    gray2bin(img, bin);
+                callback(index, detector.detectMulti(bin));
+            }
+        }
+        catch (...)
+        {
+            // Other workers finish their images. The first error is rethrown.
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    bool take(int worker, size_t& index)
+    {
+        WorkRange& range = ranges[worker];
+        std::lock_guard<std::mutex> lock(range.mutex);
+        if (range.begin == range.end)
+            return false;
+        index = range.begin++;
+        return true;
+    }
+
+    // Take a half of remaining images of the first non-empty victim. The
+    // first stolen image is returned, the rest become the worker's range.
+    bool steal(int worker, size_t& index)
+    {
+        const int numWorkers = (int)ranges.size();
+        for (int i = 1; i < numWorkers; ++i)
+        {
+            WorkRange& victim = ranges[(worker + i) % numWorkers];
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.begin == victim.end)
+                    continue;
+                begin = victim.begin + (victim.end - victim.begin) / 2;
+                end = victim.end;
+                victim.end = begin;
+            }
+            WorkRange& range = ranges[worker];
+            std::lock_guard<std::mutex> lock(range.mutex);
+            index = begin;
+            range.begin = begin + 1;
+            range.end = end;
+            return true;
+        }
+        return false;
+    }
+
+    const std::vector<cv::Mat>& images;
+    const BatchCallback& callback;
+    QrDetector::Params params;
+    std::vector<WorkRange> ranges;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+void decodeBatch(const std::vector<cv::Mat>& images, const BatchCallback& callback,
+                 const QrDetector::Params& params, int numThreads)
+{
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        CV_Assert(images[i].depth() == CV_8U);
+        CV_Assert(images[i].channels() == 1 || images[i].channels() == 3);
+    }
+    if (images.empty())
+        return;
+
+    if (numThreads < 1)
+        numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, (int)images.size());
+
+    // Images are already processed in parallel so a frame is binarized
+    // and scanned by a single thread.
+    QrDetector::Params workerParams = params;
+    workerParams.numStripes = 1;
+    workerParams.adaptiveThreshold.numTiles = 1;
+    workerParams.tracking = false;
+    BatchDecoder(images, callback, workerParams, numThreads).run();
+}
+
+void decodeBatch(const std::vector<cv::Mat>& images, std::vector<std::vector<QrCode> >& results,
+                 const QrDetector::Params& params, int numThreads)
+{
+    results.resize(images.size());
+    // Every image is written by a single worker so there is no need in locks.
+    decodeBatch(images, [&results](size_t index, const std::vector<QrCode>& codes)
+                {
+                    results[index] = codes;
+                }, params, numThreads);
+}
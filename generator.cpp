@@ -0,0 +1,216 @@
+#include "generator.hpp"
+
+// Multiplication in GF(256) with reducing polynomial x^8 + x^4 + x^3 + x^2 + 1.
+static uint8_t gfMul(uint8_t a, uint8_t b)
+{
+    int res = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        res = (res << 1) ^ ((res >> 7) * 0x11D);
+        res ^= ((b >> i) & 1) * a;
+    }
+    return (uint8_t)res;
+}
+
+void qrErrorCorrection(const std::vector<uint8_t>& data, int numEc, std::vector<uint8_t>& ec)
+{
+    // Generator polynomial (x - 1)(x - 2)...(x - 2^(numEc - 1)) without the leading term.
+    std::vector<uint8_t> divisor(numEc, 0);
+    divisor[numEc - 1] = 1;
+    uint8_t root = 1;
+    for (int i = 0; i < numEc; ++i)
+    {
+        for (int j = 0; j < numEc; ++j)
+        {
+            divisor[j] = gfMul(divisor[j], root);
+            if (j + 1 < numEc)
+                divisor[j] ^= divisor[j + 1];
+        }
+        root = gfMul(root, 2);
+    }
+
+    // Remainder of polynomial division.
+    ec.assign(numEc, 0);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        const uint8_t factor = data[i] ^ ec[0];
+        ec.erase(ec.begin());
+        ec.push_back(0);
+        for (int j = 0; j < numEc; ++j)
+            ec[j] ^= gfMul(divisor[j], factor);
+    }
+}
+
+int qrFormatBits(int eccLevel, int mask)
+{
+    const int data = (eccLevel << 3) | mask;
+    int rem = data;
+    for (int i = 0; i < 10; ++i)
+        rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+    return ((data << 10) | rem) ^ 0x5412;
+}
+
+// Modules with a flag of function patterns.
+struct ModulesGrid
+{
+    explicit ModulesGrid(int size) : size(size), dark(size * size, false), function(size * size, false) {}
+
+    void setFunction(int x, int y, bool isDark)
+    {
+        dark[y * size + x] = isDark;
+        function[y * size + x] = true;
+    }
+
+    int size;
+    std::vector<bool> dark, function;
+};
+
+// Finder pattern with a separator around it. (x, y) is a center.
+static void drawFinder(ModulesGrid& grid, int x, int y)
+{
+    for (int dy = -4; dy <= 4; ++dy)
+    {
+        for (int dx = -4; dx <= 4; ++dx)
+        {
+            const int dist = std::max(std::abs(dx), std::abs(dy));
+            if (0 <= x + dx && x + dx < grid.size && 0 <= y + dy && y + dy < grid.size)
+                grid.setFunction(x + dx, y + dy, dist != 2 && dist != 4);
+        }
+    }
+}
+
+void encodeQr(const std::string& msg, cv::Mat& modules)
+{
+    // Version 1, error correction level L.
+    const int size = 21, numData = 19, numEc = 7, eccLevel = 1;
+    CV_Assert(msg.size() <= 17);
+
+    // Byte mode indicator, length, message, terminator and padding.
+    std::vector<bool> bits;
+    const int header[] = {0, 1, 0, 0};
+    bits.insert(bits.end(), header, header + 4);
+    for (int i = 7; i >= 0; --i)
+        bits.push_back((msg.size() >> i) & 1);
+    for (size_t i = 0; i < msg.size(); ++i)
+    {
+        for (int j = 7; j >= 0; --j)
+            bits.push_back(((uint8_t)msg[i] >> j) & 1);
+    }
+    for (int i = 0; i < 4 && bits.size() < numData * 8; ++i)
+        bits.push_back(false);
+    while (bits.size() % 8)
+        bits.push_back(false);
+
+    std::vector<uint8_t> codewords(bits.size() / 8, 0);
+    for (size_t i = 0; i < bits.size(); ++i)
+        codewords[i >> 3] |= bits[i] << (7 - (i & 7));
+    for (int pad = 0xEC; codewords.size() < numData; pad ^= 0xEC ^ 0x11)
+        codewords.push_back(pad);
+
+    std::vector<uint8_t> ec;
+    qrErrorCorrection(codewords, numEc, ec);
+    codewords.insert(codewords.end(), ec.begin(), ec.end());
+
+    // Function patterns.
+    ModulesGrid grid(size);
+    for (int i = 0; i < size; ++i)
+    {
+        grid.setFunction(6, i, i % 2 == 0);
+        grid.setFunction(i, 6, i % 2 == 0);
+    }
+    drawFinder(grid, 3, 3);
+    drawFinder(grid, size - 4, 3);
+    drawFinder(grid, 3, size - 4);
+
+    const int format = qrFormatBits(eccLevel, 0);
+    for (int i = 0; i <= 5; ++i)
+        grid.setFunction(8, i, (format >> i) & 1);
+    grid.setFunction(8, 7, (format >> 6) & 1);
+    grid.setFunction(8, 8, (format >> 7) & 1);
+    grid.setFunction(7, 8, (format >> 8) & 1);
+    for (int i = 9; i < 15; ++i)
+        grid.setFunction(14 - i, 8, (format >> i) & 1);
+    for (int i = 0; i < 8; ++i)
+        grid.setFunction(size - 1 - i, 8, (format >> i) & 1);
+    for (int i = 8; i < 15; ++i)
+        grid.setFunction(8, size - 15 + i, (format >> i) & 1);
+    grid.setFunction(8, size - 8, true);
+
+    // Data in zigzag pairs of columns from the bottom-right corner. Mask
+    // pattern 0 inverts modules with even x + y.
+    size_t i = 0;
+    for (int right = size - 1; right >= 1; right -= 2)
+    {
+        if (right == 6)
+            right = 5;
+        const bool upward = ((right + 1) & 2) == 0;
+        for (int vert = 0; vert < size; ++vert)
+        {
+            const int y = upward ? size - 1 - vert : vert;
+            for (int j = 0; j < 2; ++j)
+            {
+                const int x = right - j;
+                if (grid.function[y * size + x] || i >= codewords.size() * 8)
+                    continue;
+                const bool bit = (codewords[i >> 3] >> (7 - (i & 7))) & 1;
+                grid.dark[y * size + x] = bit != ((x + y) % 2 == 0);
+                ++i;
+            }
+        }
+    }
+
+    modules.create(size, size, CV_8UC1);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+            modules.at<uint8_t>(y, x) = grid.dark[y * size + x] ? 0 : 255;
+    }
+}
+
+SyntheticParams::SyntheticParams()
+    : moduleSize(4), angle(0), perspective(0), noise(0), blur(0), seed(0x12345678) {}
+
+void renderQr(const cv::Mat& modules, const SyntheticParams& params, cv::Mat& frame,
+              cv::Point2f corners[4])
+{
+    CV_Assert(!frame.empty() && frame.type() == CV_8UC3);
+    cv::RNG rng(params.seed);
+
+    // Code with a quiet zone of 4 modules.
+    const int quietZone = 4, side = modules.cols * params.moduleSize;
+    cv::Mat code(modules.rows + 2 * quietZone, modules.cols + 2 * quietZone, CV_8UC1, cv::Scalar(255));
+    modules.copyTo(code(cv::Rect(quietZone, quietZone, modules.cols, modules.rows)));
+    cv::resize(code, code, cv::Size(), params.moduleSize, params.moduleSize, cv::INTER_NEAREST);
+    cv::cvtColor(code, code, cv::COLOR_GRAY2BGR);
+
+    // Corners of the code rotated around the frame center and randomly shifted.
+    const cv::Point2f center(0.5f * frame.cols, 0.5f * frame.rows);
+    const float angle = params.angle * (float)CV_PI / 180;
+    const cv::Point2f axisX(std::cos(angle), std::sin(angle)), axisY(-axisX.y, axisX.x);
+    const float offsets[][2] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+    cv::Point2f src[4], dst[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        const float jitterX = (float)rng.uniform(-1.0, 1.0) * params.perspective;
+        const float jitterY = (float)rng.uniform(-1.0, 1.0) * params.perspective;
+        dst[i] = center + (axisX * (offsets[i][0] + jitterX) + axisY * (offsets[i][1] + jitterY)) * (float)side;
+        src[i] = cv::Point2f((offsets[i][0] + 0.5f) * side, (offsets[i][1] + 0.5f) * side) +
+                 cv::Point2f(quietZone * params.moduleSize, quietZone * params.moduleSize);
+        if (corners)
+            corners[i] = dst[i];
+    }
+
+    // Transform of the code with a quiet zone.
+    frame.setTo(cv::Scalar(255, 255, 255));
+    cv::Mat transform = cv::getPerspectiveTransform(src, dst);
+    cv::warpPerspective(code, frame, transform, frame.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+
+    if (params.blur > 1)
+        cv::GaussianBlur(frame, frame, cv::Size(params.blur | 1, params.blur | 1), 0, 0);
+    if (params.noise > 0)
+    {
+        cv::Mat noise(frame.size(), CV_16SC3);
+        cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(params.noise));
+        cv::add(frame, noise, frame, cv::noArray(), CV_8UC3);
+    }
+}
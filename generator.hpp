@@ -0,0 +1,48 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Error correction codewords of Reed-Solomon code over GF(256) used by QR codes.
+// @param[in]  data   Data codewords.
+// @param[in]  numEc  Number of error correction codewords.
+// @param[out] ec     Error correction codewords.
+void qrErrorCorrection(const std::vector<uint8_t>& data, int numEc, std::vector<uint8_t>& ec);
+
+// 15 bits of format information: error correction level bits (L is 1,
+// M is 0, Q is 3, H is 2) and mask pattern protected by BCH code.
+int qrFormatBits(int eccLevel, int mask);
+
+// Encode a message into a version 1 QR code with error correction level L,
+// byte mode and mask pattern 0.
+// @param[in]  msg      Message up to 17 bytes.
+// @param[out] modules  21x21 modules. 0 is black, 255 is white.
+void encodeQr(const std::string& msg, cv::Mat& modules);
+
+// Parameters of a synthetic frame.
+struct SyntheticParams
+{
+    SyntheticParams();
+
+    int moduleSize;     // Size of a module in pixels before perspective.
+    float angle;        // Rotation in degrees.
+    float perspective;  // Random shifts of corners relatively to code size.
+    double noise;       // Standard deviation of gaussian noise.
+    int blur;           // Size of gaussian blur kernel. 0 or 1 disables it.
+    uint64_t seed;      // Seed of random shifts and noise.
+};
+
+// Render modules of a code at the center of a BGR frame over a white
+// background with a quiet zone.
+// @param[in]  modules  Modules of a code. 0 is black, 255 is white.
+// @param[in]  params   Geometry and distortions.
+// @param[out] frame    BGR frame. Must be allocated.
+// @param[out] corners  Corners of the code: top-left, top-right, bottom-right, bottom-left.
+void renderQr(const cv::Mat& modules, const SyntheticParams& params, cv::Mat& frame,
+              cv::Point2f corners[4] = 0);
+
+#endif  // GENERATOR_HPP
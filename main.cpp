@@ -1,21 +1,50 @@
+#include <algorithm>
 #include <iostream>
 
+#include "app.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
 #include "qrcode.hpp"
 
 #include <opencv2/opencv.hpp>
-#include <quirc.h>
 
 const char* keys =
     "{ help  h | | Print help message. }"
     "{ test  t | | Run tests. }"
-    "{ input i | | Path to input image or video. Skip to grab frames from a camera. }";
-
-bool verifyVertical(int center_x, int center_y, const cv::Mat& img, int* top, int* bottom);
-
-bool verifyDiagonal(int center_x, int center_y, const cv::Mat& img);
-
-cv::Mat extract(const cv::Mat& img, const cv::Point& topLeft,
-                const cv::Point& topRight, const cv::Point& bottomLeft);
+    "{ bench b | | Run benchmarks. }"
+    "{ input i | | Path to input image or video. Skip to grab frames from a camera. "
+                  "Repeat to process several videos or cameras (by index) at once. }"
+    "{ batch   | | Process an input directory, list of files or video without windows. "
+                  "Prints JSON lines with codes and latency. }"
+    "{ jobs  j | 0 | Number of workers in batch, multi-stream and server modes. 0 uses all cores. }"
+    "{ queue   | 2 | Capacity of queues between pipeline stages. }"
+    "{ policy  | | What to do with frames when a queue is full: drop (the oldest) or block. "
+                 "Default is drop for a camera and block for a file. }"
+    "{ profile | | Print histograms of detection counters and stage timings on exit. }"
+    "{ adaptive | | Binarize frames by a local mean instead of a global threshold. }"
+    "{ budget  | 0 | Detection time budget per frame or request in milliseconds in all the modes. "
+                  "0 means no limit. }"
+    "{ serve   | | Decode images sent to a UNIX socket at this path until SIGINT or SIGTERM. }"
+    "{ max_batch   | 16 | Maximal number of requests the server decodes together. }"
+    "{ max_latency | 2  | Milliseconds the first request of a batch waits for others. }"
+    "{ client  | | Send --input images to a server at this socket and print responses. }"
+    "{ load    | | Load a server at this socket by --input or synthetic images. }"
+    "{ clients | 8    | Number of connections of the load generator. }"
+    "{ requests | 1000 | Number of requests of the load generator. }";
+
+// Values of all the --input options. CommandLineParser keeps only one.
+static void getInputs(int argc, char** argv, std::vector<std::string>& inputs)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        arg.erase(0, std::min(arg.find_first_not_of('-'), arg.size()));
+        if (arg.compare(0, 6, "input=") == 0)
+            inputs.push_back(arg.substr(6));
+        else if (arg.compare(0, 2, "i=") == 0)
+            inputs.push_back(arg.substr(2));
+    }
+}
 
 int main(int argc, char** argv)
 {   //                                                      _
@@ -33,224 +62,133 @@ int main(int argc, char** argv)
     {
         return runTests() ? 0 : 1;
     }
+    if (parser.has("bench"))
+    {
+        runBenchmarks();
+        return 0;
+    }
+    std::vector<std::string> inputs;
+    getInputs(argc, argv, inputs);
 
-    //
-    // Open an input file or a camera stream.
-    //
-    cv::VideoCapture cap;
-    if (parser.has("input"))
-        cap.open(parser.get<std::string>("input"));
-    else
-        cap.open(0);
+    // Detection options shared by all the modes.
+    QrDetector::Params detectorParams;
+    detectorParams.adaptive = parser.has("adaptive");
+    detectorParams.budgetMs = parser.get<double>("budget");
 
-    cv::namedWindow("Markers", cv::WINDOW_NORMAL);
-    cv::namedWindow("QR code", cv::WINDOW_NORMAL);
-    cv::Mat img, gray, bin, mask;
-    while (cv::waitKey(1) < 0)
+    if (parser.has("serve"))
+    {
+        return runServer(parser.get<std::string>("serve"), parser.get<int>("jobs"),
+                         parser.get<int>("max_batch"), parser.get<double>("max_latency"),
+                         detectorParams);
+    }
+    if (parser.has("client"))
+    {
+        return runClient(parser.get<std::string>("client"), inputs);
+    }
+    if (parser.has("load"))
+    {
+        return runLoad(parser.get<std::string>("load"), inputs.empty() ? "" : inputs[0],
+                       parser.get<int>("clients"), parser.get<int>("requests"));
+    }
+    if (inputs.size() > 1)
     {
-        // Read an image.
-        cap >> img;
-        if (img.empty())
+        return runStreams(inputs, parser.get<int>("jobs"), parser.get<int>("queue"),
+                          parser.get<std::string>("policy"), parser.has("profile"),
+                          detectorParams);
+    }
+    if (parser.has("batch"))
+    {
+        if (!parser.has("input"))
         {
-            img = cv::imread(parser.get<std::string>("input"));
-            if (img.empty())
-            {
-                cv::waitKey();
-                break;
-            }
+            std::cerr << "Batch mode requires --input" << std::endl;
+            return 1;
         }
+        return runBatch(parser.get<std::string>("input"), parser.get<int>("jobs"),
+                        parser.has("profile"), detectorParams);
+    }
+
+    // Codes barely move between frames so search near the previous markers.
+    detectorParams.tracking = true;
+    detectorParams.debugMask = true;
+
+    cv::namedWindow("Markers", cv::WINDOW_NORMAL);
+    cv::namedWindow("QR code", cv::WINDOW_NORMAL);
 
-        // TODO: Convert BGR image to grayscale.
+    //
+    // A single image is processed in place.
+    //
+    cv::Mat img = parser.has("input") ? cv::imread(parser.get<std::string>("input")) : cv::Mat();
+    if (!img.empty())
+    {
+        // Convert BGR image to black-and-white in a single pass.
         //          __
         //     __  (  )_
         //    (  )(     )
         //   (___(_______)
         //     /  /  /  /
         //   /  /  /  /
-        bgr2gray(img, gray);
-
-        // TODO: Convert grayscale image to black-and-white.
-        gray2bin(gray, bin);
-
-        std::string msg = decode(bin, img, mask);
+        cv::Mat bin;
+        if (detectorParams.adaptive)
+            bgr2bin(img, bin, detectorParams.adaptiveThreshold);
+        else
+            bgr2bin(img, bin);
+
+        QrDetector detector(detectorParams);
+        std::string msg = detector.decode(bin, img);
         cv::imshow("Markers", img);
         cv::imshow("Black-and-white image", bin);
-        if (!mask.empty())
-            cv::imshow("QR code", mask);
+        if (!detector.mask().empty())
+            cv::imshow("QR code", detector.mask());
         if (!msg.empty())
             std::cout << "Message: " << msg << std::endl;
-    }
-    return 0;
-}
-
-void bgr2gray(const cv::Mat& src, cv::Mat& dst)
-{
-    CV_Error(cv::Error::StsNotImplemented, "BGR to grayscale conversion. See cv::cvtColor");
-}
-
-void gray2bin(const cv::Mat& src, cv::Mat& dst, uint8_t thresh)
-{
-    CV_Error(cv::Error::StsNotImplemented, "Grayscale to black-and-white conversion. See cv::threshold");
-}
-
-void countPixels(const uint8_t* row, int length, std::vector<int>& counts,
-                 std::vector<int>& xs)
-{
-    CV_Error(cv::Error::StsNotImplemented, "Black-and-white pixels counting");
-}
-
-bool checkRatios(const int* counts)
-{
-    CV_Error(cv::Error::StsNotImplemented, "Black-and-white pixels ratios check");
-    return false;
-}
-
-void computeCenters(const std::vector<cv::Rect>& rects, std::vector<cv::Point>& centers)
-{
-    CV_Error(cv::Error::StsNotImplemented, "Markers centers estimation");
-}
-
-void sortMarkers(const std::vector<cv::Point>& centers, cv::Point& topLeft,
-                 cv::Point& topRight, cv::Point& bottomLeft)
-{
-    CV_Error(cv::Error::StsNotImplemented, "Markers positioning");
-}
-
-std::string decode(const cv::Mat& bin, cv::Mat& img, cv::Mat& mask)
-{
-    // Parse an every row to find desired ratios.
-    std::vector<cv::Rect> markersCandidates;
-    for (int y = 0; y < bin.rows; ++y)
-    {
-        std::vector<int> counts;  // Numbers of sequent black & white pixels.
-        std::vector<int> xs;      // Indices of first pixels of an every group.
-        countPixels(bin.ptr<uint8_t>(y), bin.cols, counts, xs);
-
-        if (counts.size() < 5)
-            continue;
-
-        CV_Assert(xs.size() == counts.size());
-        xs.push_back(bin.cols);  // For simplification.
-        for (int i = 0; i < counts.size() - 5; i += 2)
+        if (parser.has("profile"))
         {
-            // Compare ratios. Try to find 1:1:3:1:1
-            int top, bottom, center_x = (xs[i] + xs[i + 5]) / 2;
-            if (checkRatios(&counts[i]) &&
-                verifyVertical(center_x, y, bin, &top, &bottom) &&
-                verifyDiagonal(center_x, y, bin))
-            {
-                cv::line(img, cv::Point(xs[i], y), cv::Point(xs[i + 5], y), cv::Scalar(0, 255, 0));
-                cv::line(img, cv::Point(center_x, top), cv::Point(center_x, bottom), cv::Scalar(0, 255, 0));
-
-                cv::Rect candidate;
-                candidate.x = xs[i];
-                candidate.y = top;
-                candidate.width = xs[i + 5] - xs[i];
-                candidate.height = bottom - top + 1;
-
-                markersCandidates.push_back(candidate);
-
-                CV_Assert(bin.at<uint8_t>(y, xs[i]) == 0);
-                CV_Assert(bin.at<uint8_t>(y, xs[i + 5] - 1) == 0);
-                CV_Assert(bin.at<uint8_t>(top, center_x) == 0);
-                CV_Assert(bin.at<uint8_t>(bottom, center_x) == 0);
-            }
+            QrProfile profile;
+            profile.add(detector.stats());
+            profile.print(std::cout);
         }
+        cv::waitKey();
+        return 0;
     }
 
-    // Estimates centers of each marker.
-    std::vector<cv::Point> centers;
-    computeCenters(markersCandidates, centers);
-    if (centers.size() != 3)
-        return "";
-
-    if (!centers.empty())
-    {
-        // Identify each marker location.
-        cv::Point topLeft, topRight, bottomLeft;
-        sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-        // Draw markers.
-        cv::circle(img, topRight, 5, cv::Vec3b(255, 0, 0), CV_FILLED);
-        cv::circle(img, topLeft, 5, cv::Vec3b(255, 0, 255), CV_FILLED);
-        cv::circle(img, bottomLeft, 5, cv::Vec3b(0, 0, 255), CV_FILLED);
-
-        // Extract a qr code.
-        mask = extract(bin, topLeft, topRight, bottomLeft);
-    }
-
-    // 001000000101101100001011011110001101000101110010110111000100110101000
-    // Decoding
-    // 011010000001110110000010001111011000010000001011011000010110111100011
-    quirc_code qCode;
-    memset(&qCode, 0, sizeof(qCode));
+    //
+    // Open an input file or a camera stream. Frames are captured, binarized
+    // and decoded by a pipeline while this thread displays them.
+    //
+    cv::VideoCapture cap;
+    if (parser.has("input"))
+        cap.open(parser.get<std::string>("input"));
+    else
+        cap.open(0);
 
-    qCode.size = 21;
-    for (int y = 0; y < 21; ++y)
-    {
-        for (int x = 0; x < 21; ++x)
-        {
-            int p = y * 21 + x;
-            qCode.cell_bitmap[p >> 3] |= mask.at<uint8_t>(y, x) ? 0 : (1 << (p & 7));
-        }
-    }
+    Pipeline::Params params;
+    params.detector = detectorParams;
+    params.queueSize = parser.get<int>("queue");
+    // Camera shouldn't build latency but every frame of a file is processed.
+    const std::string policy = parser.get<std::string>("policy");
+    if (policy == "block" || (policy.empty() && parser.has("input")))
+        params.policy = Pipeline::BLOCK;
+    else
+        params.policy = Pipeline::DROP_OLDEST;
 
-    quirc_data qData;
-    quirc_decode_error_t errorCode = quirc_decode(&qCode, &qData);
-    std::string msg = "";
-    if (errorCode == 0)
+    Pipeline pipeline(cap, params);
+    while (cv::waitKey(1) < 0)
     {
-        for (int i = 0; i < qData.payload_len; ++i)
-        {
-            msg += qData.payload[i];
-        }
+        Frame* frame = pipeline.next();
+        if (!frame)
+            break;
+
+        cv::imshow("Markers", frame->img);
+        cv::imshow("Black-and-white image", frame->bin);
+        if (!frame->mask.empty())
+            cv::imshow("QR code", frame->mask);
+        if (!frame->msg.empty())
+            std::cout << "Message: " << frame->msg << std::endl;
+        pipeline.release(frame);
     }
-    return msg;
-}
-
-bool verifyVertical(int center_x, int center_y, const cv::Mat& img, int* top, int* bottom)
-{
-    std::vector<int> counts(5, 0);
-    int y, x = center_x, numPixels = 0;
-    for (y = center_y; y >= 0 && img.at<uint8_t>(y, x) == 0; --y, counts[2] += 1, ++numPixels) {}
-    for (; y >= 0 && img.at<uint8_t>(y, x) == 255; --y, counts[1] += 1, ++numPixels) {}
-    for (; y >= 0 && img.at<uint8_t>(y, x) == 0; --y, counts[0] += 1, ++numPixels) {}
-    *top = y + 1;
-    for (y = center_y + 1; y < img.rows && img.at<uint8_t>(y, x) == 0; ++y, counts[2] += 1, ++numPixels) {}
-    for (; y < img.rows && img.at<uint8_t>(y, x) == 255; ++y, counts[3] += 1, ++numPixels) {}
-    for (; y < img.rows && img.at<uint8_t>(y, x) == 0; ++y, counts[4] += 1, ++numPixels) {}
-    *bottom = y - 1;
-
-    return checkRatios(&counts[0]);
-}
-
-bool verifyDiagonal(int center_x, int center_y, const cv::Mat& img)
-{
-    std::vector<int> counts(5, 0);
-    int y, x = center_x, numPixels = 0;
-    for (y = center_y; y >= 0 && x >= 0 && img.at<uint8_t>(y, x) == 0; --y, --x, counts[2] += 1, ++numPixels) {}
-    for (; y >= 0 && x >= 0 && img.at<uint8_t>(y, x) == 255; --y, --x, counts[1] += 1, ++numPixels) {}
-    for (; y >= 0 && x >= 0 && img.at<uint8_t>(y, x) == 0; --y, --x, counts[0] += 1, ++numPixels) {}
-    for (y = center_y + 1, x = center_x + 1; y < img.rows && x < img.cols && img.at<uint8_t>(y, x) == 0; ++y, ++x, counts[2] += 1, ++numPixels) {}
-    for (; y < img.rows && x < img.cols && img.at<uint8_t>(y, x) == 255; ++y, ++x, counts[3] += 1, ++numPixels) {}
-    for (; y < img.rows && x < img.cols && img.at<uint8_t>(y, x) == 0; ++y, ++x, counts[4] += 1, ++numPixels) {}
-
-    return checkRatios(&counts[0]);
-}
-
-cv::Mat extract(const cv::Mat& img, const cv::Point& topLeft,
-                const cv::Point& topRight, const cv::Point& bottomLeft)
-{
-    cv::Point2f bottomRight = bottomLeft + topRight - topLeft;
-
-    std::vector<cv::Point2f> srcPoints(4), dstPoints(4);
-    srcPoints[0] = topRight;     dstPoints[0] = cv::Point2f(17, 3);
-    srcPoints[1] = topLeft;      dstPoints[1] = cv::Point2f(3, 3);
-    srcPoints[2] = bottomLeft;   dstPoints[2] = cv::Point2f(3, 17);
-    srcPoints[3] = bottomRight;  dstPoints[3] = cv::Point2f(17, 17);
-    cv::Mat m = cv::findHomography(srcPoints, dstPoints);
-
-    cv::Mat res(21, 21, CV_8UC1);
-    cv::warpPerspective(img, res, m, res.size(), cv::INTER_NEAREST);
-    return res;
+    pipeline.stop();
+    pipeline.printStats(std::cout);
+    if (parser.has("profile"))
+        pipeline.profile().print(std::cout);
+    return 0;
 }
@@ -0,0 +1,38 @@
+#include "qrcode.hpp"
+
+#include <opencv2/opencv.hpp>
+
+void drawCandidates(cv::Mat& img, const std::vector<cv::Rect>& candidates,
+                    const std::vector<int>& rows)
+{
+    CV_Assert(candidates.size() == rows.size());
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const cv::Rect& r = candidates[i];
+        int center_x = r.x + r.width / 2;
+        cv::line(img, cv::Point(r.x, rows[i]), cv::Point(r.x + r.width, rows[i]), cv::Scalar(0, 255, 0));
+        cv::line(img, cv::Point(center_x, r.y), cv::Point(center_x, r.y + r.height - 1), cv::Scalar(0, 255, 0));
+    }
+}
+
+void drawCodeMarkers(cv::Mat& img, const QrCode& code)
+{
+    cv::circle(img, code.markers[1], 5, cv::Vec3b(255, 0, 0), CV_FILLED);
+    cv::circle(img, code.markers[0], 5, cv::Vec3b(255, 0, 255), CV_FILLED);
+    cv::circle(img, code.markers[2], 5, cv::Vec3b(0, 0, 255), CV_FILLED);
+}
+
+void drawCode(cv::Mat& img, const QrCode& code)
+{
+    std::vector<cv::Point> border(4);
+    for (int i = 0; i < 4; ++i)
+        border[i] = cv::Point(cvRound(code.corners[i].x), cvRound(code.corners[i].y));
+    cv::polylines(img, border, true, cv::Scalar(0, 255, 255), 2);
+    drawCodeMarkers(img, code);
+
+    if (!code.payload.empty())
+    {
+        cv::putText(img, code.payload, border[0] - cv::Point(0, 8), cv::FONT_HERSHEY_SIMPLEX,
+                    0.6, cv::Scalar(0, 255, 255), 2);
+    }
+}
@@ -0,0 +1,458 @@
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+FrameRing::FrameRing(int capacity) : slots(capacity), head(0), tail(0), finished(false)
+{
+    CV_Assert(capacity > 0);
+}
+
+bool FrameRing::push(Frame* frame)
+{
+    const uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) >= slots.size())
+        return false;
+    slots[t % slots.size()].store(frame, std::memory_order_relaxed);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+Frame* FrameRing::pop()
+{
+    uint64_t h = head.load(std::memory_order_acquire);
+    for (;;)
+    {
+        if (h == tail.load(std::memory_order_acquire))
+            return 0;
+        // Slot is not overwritten until head passes it. If another thread
+        // pops it first, CAS fails and the next slot is tried.
+        Frame* frame = slots[h % slots.size()].load(std::memory_order_relaxed);
+        if (head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel))
+            return frame;
+    }
+}
+
+// Short sleeps instead of busy waits on empty or full rings.
+static void backoff(int& attempt)
+{
+    if (attempt++ < 16)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+Pipeline::Pipeline(cv::VideoCapture& cap, const Params& params)
+    : cap(cap), params(params), stopped(false), startTicks(cv::getTickCount()),
+      captured(params.queueSize), binarized(params.queueSize), decoded(params.queueSize)
+{
+    std::fill(budgetStages, budgetStages + QrDetector::BUDGET_EXCEEDED + 1, 0);
+    // Every ring may be full while every stage and a caller hold a frame.
+    frames.resize(3 * params.queueSize + 4);
+    for (size_t i = 0; i < frames.size(); ++i)
+        freeFrames.push_back(&frames[i]);
+
+    threads.push_back(std::thread(&Pipeline::capture, this));
+    threads.push_back(std::thread(&Pipeline::binarize, this));
+    threads.push_back(std::thread(&Pipeline::decode, this));
+}
+
+Pipeline::~Pipeline()
+{
+    stop();
+}
+
+void Pipeline::stop()
+{
+    {
+        // acquire() checks the flag under the pool mutex, so set it there.
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopped = true;
+    }
+    poolCondition.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    threads.clear();
+}
+
+Frame* Pipeline::acquire()
+{
+    std::unique_lock<std::mutex> lock(poolMutex);
+    poolCondition.wait(lock, [this] { return !freeFrames.empty() || stopped; });
+    if (freeFrames.empty())
+        return 0;
+    Frame* frame = freeFrames.back();
+    freeFrames.pop_back();
+    return frame;
+}
+
+void Pipeline::release(Frame* frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        freeFrames.push_back(frame);
+    }
+    poolCondition.notify_one();
+}
+
+bool Pipeline::send(FrameRing& ring, RingStats& stats, Frame* frame)
+{
+    for (int attempt = 0; !ring.push(frame); )
+    {
+        if (stopped)
+        {
+            release(frame);
+            return false;
+        }
+        if (params.policy == DROP_OLDEST)
+        {
+            Frame* oldest = ring.pop();
+            if (oldest)
+            {
+                release(oldest);
+                stats.drops += 1;
+            }
+        }
+        else
+        {
+            backoff(attempt);
+        }
+    }
+    const int64_t size = ring.size();
+    stats.pushes += 1;
+    stats.sumSizes += size;
+    stats.maxSize = std::max(stats.maxSize, size);
+    return true;
+}
+
+Frame* Pipeline::receive(FrameRing& ring)
+{
+    for (int attempt = 0; !stopped; backoff(attempt))
+    {
+        // Check finish flag before pop so the last frames are not missed.
+        const bool finished = ring.isFinished();
+        Frame* frame = ring.pop();
+        if (frame)
+            return frame;
+        if (finished)
+            break;
+    }
+    return 0;
+}
+
+Frame* Pipeline::next()
+{
+    return receive(decoded);
+}
+
+void Pipeline::capture()
+{
+    for (int64_t index = 0; !stopped; ++index)
+    {
+        Frame* frame = acquire();
+        if (!frame)
+            break;
+
+        const int64_t start = cv::getTickCount();
+        const bool grabbed = cap.read(frame->img);
+        stageStats[0].busyTicks += cv::getTickCount() - start;
+        if (!grabbed || frame->img.empty())
+        {
+            release(frame);
+            break;
+        }
+        stageStats[0].frames += 1;
+        frame->index = index;
+        frame->ticks = start;
+        if (!send(captured, ringStats[0], frame))
+            break;
+    }
+    captured.finish();
+}
+
+void Pipeline::binarize()
+{
+    while (Frame* frame = receive(captured))
+    {
+        const int64_t start = cv::getTickCount();
+        if (params.detector.adaptive)
+            bgr2bin(frame->img, frame->bin, params.detector.adaptiveThreshold, adaptiveBuffers);
+        else
+            bgr2bin(frame->img, frame->bin);
+        stageStats[1].busyTicks += cv::getTickCount() - start;
+        stageStats[1].frames += 1;
+        if (!send(binarized, ringStats[1], frame))
+            break;
+    }
+    binarized.finish();
+}
+
+void Pipeline::decode()
+{
+    QrDetector detector(params.detector);
+    while (Frame* frame = receive(binarized))
+    {
+        const int64_t start = cv::getTickCount();
+        frame->msg = detector.decode(frame->bin, frame->img);
+        detectionProfile.add(detector.stats());
+        budgetStages[detector.budgetStage()] += 1;
+        if (!detector.mask().empty())
+            detector.mask().copyTo(frame->mask);
+        else
+            frame->mask.release();
+        stageStats[2].busyTicks += cv::getTickCount() - start;
+        stageStats[2].frames += 1;
+        if (!send(decoded, ringStats[2], frame))
+            break;
+    }
+    decoded.finish();
+}
+
+void Pipeline::printStats(std::ostream& out) const
+{
+    static const char* names[] = {"capture", "binarize", "decode"};
+    const double seconds = (cv::getTickCount() - startTicks) / cv::getTickFrequency();
+
+    out << std::setw(10) << "stage" << std::setw(10) << "frames" << std::setw(8) << "busy"
+        << std::setw(12) << "out queue" << std::setw(8) << "max" << std::setw(8) << "drops" << std::endl;
+    for (int i = 0; i < 3; ++i)
+    {
+        const RingStats& ring = ringStats[i];
+        const StageStats& stage = stageStats[i];
+        // Busy is a part of time spent on processing. Out queue is an average
+        // number of frames in the output ring after a push.
+        out << std::setw(10) << names[i] << std::setw(10) << stage.frames
+            << std::fixed << std::setprecision(2)
+            << std::setw(8) << stage.busyTicks / cv::getTickFrequency() / std::max(seconds, 1e-9)
+            << std::setw(12) << (ring.pushes ? (double)ring.sumSizes / ring.pushes : 0.0)
+            << std::setw(8) << ring.maxSize << std::setw(8) << ring.drops << std::endl;
+    }
+    if (params.detector.budgetMs > 0 || params.detector.budgetHits > 0)
+    {
+        out << "budget: ok " << budgetStages[QrDetector::BUDGET_OK]
+            << ", skip diagonal " << budgetStages[QrDetector::BUDGET_SKIP_DIAGONAL]
+            << ", cap candidates " << budgetStages[QrDetector::BUDGET_CAP_CANDIDATES]
+            << ", exceeded " << budgetStages[QrDetector::BUDGET_EXCEEDED] << std::endl;
+    }
+}
+
+MultiStream::Stream::Stream(int index, const Input& input, int queueSize,
+                            const QrDetector::Params& params)
+    : index(index), input(input), frames(queueSize + 2), ring(queueSize), busy(false), detector(params)
+{
+    // Ring may be full while capture and a worker hold a frame.
+    for (size_t i = 0; i < frames.size(); ++i)
+        freeFrames.push_back(&frames[i]);
+}
+
+MultiStream::MultiStream(const std::vector<Input>& inputs, const Callback& callback,
+                         const Params& params)
+    : callback(callback), params(params), stopped(false), nextStream(0)
+{
+    CV_Assert(!inputs.empty());
+    int numWorkers = params.numWorkers;
+    if (numWorkers < 1)
+        numWorkers = std::max(1, (int)std::thread::hardware_concurrency());
+
+    // Streams are already processed in parallel so a frame is binarized
+    // and scanned by a single thread.
+    QrDetector::Params detectorParams = params.detector;
+    if (numWorkers > 1)
+    {
+        detectorParams.numStripes = 1;
+        detectorParams.adaptiveThreshold.numTiles = 1;
+    }
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        CV_Assert(inputs[i].cap);
+        streams.push_back(std::unique_ptr<Stream>(
+            new Stream((int)i, inputs[i], params.queueSize, detectorParams)));
+    }
+
+    for (size_t i = 0; i < streams.size(); ++i)
+        threads.push_back(std::thread(&MultiStream::capture, this, (int)i));
+    for (int i = 0; i < numWorkers; ++i)
+        threads.push_back(std::thread(&MultiStream::work, this));
+}
+
+MultiStream::~MultiStream()
+{
+    stop();
+}
+
+void MultiStream::wait()
+{
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    threads.clear();
+}
+
+void MultiStream::stop()
+{
+    stopped = true;
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        {
+            // acquire() checks the flag under the pool mutex of the stream.
+            std::lock_guard<std::mutex> lock(streams[i]->poolMutex);
+        }
+        streams[i]->poolCondition.notify_all();
+    }
+    notifyWorkers(true);
+    wait();
+}
+
+Frame* MultiStream::acquire(Stream& stream)
+{
+    std::unique_lock<std::mutex> lock(stream.poolMutex);
+    stream.poolCondition.wait(lock, [&] { return !stream.freeFrames.empty() || stopped; });
+    if (stream.freeFrames.empty())
+        return 0;
+    Frame* frame = stream.freeFrames.back();
+    stream.freeFrames.pop_back();
+    return frame;
+}
+
+void MultiStream::release(Stream& stream, Frame* frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(stream.poolMutex);
+        stream.freeFrames.push_back(frame);
+    }
+    stream.poolCondition.notify_one();
+}
+
+void MultiStream::capture(int idx)
+{
+    Stream& stream = *streams[idx];
+    for (int64_t index = 0; !stopped; ++index)
+    {
+        Frame* frame = acquire(stream);
+        if (!frame)
+            break;
+
+        if (!stream.input.cap->read(frame->img) || frame->img.empty())
+        {
+            release(stream, frame);
+            break;
+        }
+        frame->index = index;
+        frame->ticks = cv::getTickCount();
+        stream.stats.captured += 1;
+
+        bool pushed = true;
+        for (int attempt = 0; !stream.ring.push(frame); )
+        {
+            if (stopped)
+            {
+                release(stream, frame);
+                pushed = false;
+                break;
+            }
+            if (stream.input.policy == Pipeline::DROP_OLDEST)
+            {
+                Frame* oldest = stream.ring.pop();
+                if (oldest)
+                {
+                    release(stream, oldest);
+                    stream.stats.drops += 1;
+                }
+            }
+            else
+            {
+                backoff(attempt);
+            }
+        }
+        if (!pushed)
+            break;
+        notifyWorkers(false);
+    }
+    stream.ring.finish();
+    notifyWorkers(true);
+}
+
+MultiStream::Stream* MultiStream::claim(Frame*& frame)
+{
+    const int numStreams = (int)streams.size();
+    const int first = (int)(nextStream++ % numStreams);
+    for (int i = 0; i < numStreams; ++i)
+    {
+        Stream& stream = *streams[(first + i) % numStreams];
+        if (stream.ring.size() == 0 || stream.busy.exchange(true, std::memory_order_acquire))
+            continue;
+        frame = stream.ring.pop();
+        if (frame)
+            return &stream;
+        stream.busy.store(false, std::memory_order_release);
+    }
+    return 0;
+}
+
+bool MultiStream::hasWork() const
+{
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        if (streams[i]->ring.size() != 0 && !streams[i]->busy.load(std::memory_order_acquire))
+            return true;
+    }
+    return false;
+}
+
+bool MultiStream::isOver() const
+{
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        // Check finish flag before size so the last frames are not missed.
+        const bool finished = streams[i]->ring.isFinished();
+        if (!finished || streams[i]->ring.size() != 0)
+            return false;
+    }
+    return true;
+}
+
+void MultiStream::work()
+{
+    while (!stopped)
+    {
+        Frame* frame = 0;
+        Stream* stream = claim(frame);
+        if (!stream)
+        {
+            if (isOver())
+                break;
+            std::unique_lock<std::mutex> lock(workMutex);
+            workCondition.wait(lock, [this] { return stopped || hasWork() || isOver(); });
+            continue;
+        }
+
+        const QrDetector::Params& detectorParams = stream->detector.params;
+        if (detectorParams.adaptive)
+            bgr2bin(frame->img, frame->bin, detectorParams.adaptiveThreshold, stream->adaptiveBuffers);
+        else
+            bgr2bin(frame->img, frame->bin);
+        const std::vector<QrCode>& codes = stream->detector.detectMulti(frame->bin);
+        const double latency = (cv::getTickCount() - frame->ticks) * 1e3 / cv::getTickFrequency();
+        // Stats of a stream are only updated by a worker which claimed it.
+        stream->stats.latencies.push_back(latency);
+        stream->stats.profile.add(stream->detector.stats());
+        callback(stream->index, *frame, codes, latency);
+        release(*stream, frame);
+        stream->busy.store(false, std::memory_order_release);
+        // Frames which came meanwhile may wait for this stream only.
+        if (stream->ring.size() != 0)
+            notifyWorkers(false);
+    }
+}
+
+void MultiStream::notifyWorkers(bool all)
+{
+    // Workers check the state under the mutex. Taking it here makes sure that
+    // a worker either sees the change or already waits for the notification.
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+    }
+    if (all)
+        workCondition.notify_all();
+    else
+        workCondition.notify_one();
+}
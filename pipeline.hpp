@@ -0,0 +1,245 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "profile.hpp"
+#include "qrcode.hpp"
+
+// Buffers of a single frame which travel through the pipeline.
+struct Frame
+{
+    int64_t index;
+    int64_t ticks;     // Capture time.
+    cv::Mat img;       // Captured image with drawn markers.
+    cv::Mat bin;       // Black-and-white image.
+    std::string msg;   // Decoded message.
+    cv::Mat mask;      // Modules of a code.
+};
+
+// Bounded lock-free ring of frames between two stages. Items are pushed only
+// by a producer thread. They are popped by a consumer thread and, to drop the
+// oldest ones, by the producer too so the head is advanced by CAS.
+class FrameRing
+{
+public:
+    explicit FrameRing(int capacity);
+
+    // @returns false if ring is full.
+    bool push(Frame* frame);
+
+    // @returns nullptr if ring is empty.
+    Frame* pop();
+
+    int size() const { return (int)(tail.load() - head.load()); }
+    int capacity() const { return (int)slots.size(); }
+
+    // Producer is done. Consumer reads the rest of frames.
+    void finish() { finished = true; }
+    bool isFinished() const { return finished; }
+
+private:
+    std::vector<std::atomic<Frame*> > slots;
+    std::atomic<uint64_t> head;  // Index of the next frame to pop.
+    std::atomic<uint64_t> tail;  // Index of the next frame to push.
+    std::atomic<bool> finished;
+};
+
+// Capture -> binarization -> detection and decoding stages on their own
+// threads connected by bounded rings. Frames are taken from a fixed pool so
+// buffers are reused. Decoded frames are read by a caller thread.
+class Pipeline
+{
+public:
+    // What to do when the next stage is busy and its ring is full.
+    enum Policy
+    {
+        // Drop the oldest frame in the ring so a live feed never builds latency.
+        DROP_OLDEST,
+        // Wait for the next stage (for files where every frame matters).
+        BLOCK
+    };
+
+    struct Params
+    {
+        Params() : queueSize(2), policy(DROP_OLDEST) {}
+
+        int queueSize;  // Capacity of every ring.
+        Policy policy;
+        QrDetector::Params detector;
+    };
+
+    Pipeline(cv::VideoCapture& cap, const Params& params = Params());
+    ~Pipeline();
+
+    // Wait for the next decoded frame.
+    // @returns nullptr at the end of the stream.
+    Frame* next();
+
+    // Return a frame from next() to the pool.
+    void release(Frame* frame);
+
+    // Stop all the stages.
+    void stop();
+
+    // Rings occupancy, drops and busy time of stages. With a detection budget,
+    // numbers of frames which reached every stage of degradation.
+    void printStats(std::ostream& out) const;
+
+    // Detection stats of all the decoded frames. Read it after stop().
+    const QrProfile& profile() const { return detectionProfile; }
+
+private:
+    struct RingStats
+    {
+        RingStats() : pushes(0), drops(0), sumSizes(0), maxSize(0) {}
+        int64_t pushes, drops, sumSizes, maxSize;
+    };
+
+    struct StageStats
+    {
+        StageStats() : frames(0), busyTicks(0) {}
+        int64_t frames, busyTicks;
+    };
+
+    Frame* acquire();
+    // Push a frame according to the policy.
+    // @returns false if pipeline is stopped and frame is released.
+    bool send(FrameRing& ring, RingStats& stats, Frame* frame);
+    // Wait for a frame.
+    // @returns nullptr at the end of the stream or if pipeline is stopped.
+    Frame* receive(FrameRing& ring);
+
+    void capture();
+    void binarize();
+    void decode();
+
+    AdaptiveBuffers adaptiveBuffers;  // Of the binarization thread.
+    cv::VideoCapture& cap;
+    Params params;
+    std::atomic<bool> stopped;
+    int64_t startTicks;
+
+    std::vector<Frame> frames;
+    std::vector<Frame*> freeFrames;
+    std::mutex poolMutex;
+    std::condition_variable poolCondition;
+
+    FrameRing captured, binarized, decoded;
+    RingStats ringStats[3];
+    StageStats stageStats[3];
+    QrProfile detectionProfile;  // Updated by the decoding thread.
+    int64_t budgetStages[QrDetector::BUDGET_EXCEEDED + 1];
+    std::vector<std::thread> threads;
+};
+
+// Several inputs decoded by a fixed pool of workers in a single process.
+// Every stream has its own capture thread, pool of frames and ring. Workers
+// take streams in a round-robin order so a busy stream can't starve the
+// others. A stream is processed by one worker at a time so its frames are
+// decoded in order, and its detector (with tracking and the payload cache)
+// belongs to the stream.
+class MultiStream
+{
+public:
+    struct Input
+    {
+        Input(cv::VideoCapture* cap = 0, Pipeline::Policy policy = Pipeline::BLOCK)
+            : cap(cap), policy(policy) {}
+
+        cv::VideoCapture* cap;
+        Pipeline::Policy policy;  // What to do with captured frames when the ring is full.
+    };
+
+    struct Params
+    {
+        Params() : numWorkers(0), queueSize(2) {}
+
+        int numWorkers;  // Number of worker threads. 0 uses all the cores.
+        int queueSize;   // Capacity of a ring of every stream.
+        QrDetector::Params detector;
+    };
+
+    // Called by workers for every decoded frame. Calls for different streams
+    // may be concurrent. Latency is measured from capture of a frame.
+    typedef std::function<void(int stream, const Frame& frame, const std::vector<QrCode>& codes,
+                               double latencyMs)> Callback;
+
+    struct StreamStats
+    {
+        StreamStats() : captured(0), drops(0) {}
+
+        int64_t captured, drops;
+        std::vector<double> latencies;  // Milliseconds, per decoded frame.
+        QrProfile profile;
+    };
+
+    MultiStream(const std::vector<Input>& inputs, const Callback& callback,
+                const Params& params = Params());
+    ~MultiStream();
+
+    // Wait until all the streams are over.
+    void wait();
+
+    // Stop capture and workers.
+    void stop();
+
+    int numStreams() const { return (int)streams.size(); }
+
+    // Read it after wait() or stop().
+    const StreamStats& stats(int stream) const { return streams[stream]->stats; }
+
+private:
+    struct Stream
+    {
+        Stream(int index, const Input& input, int queueSize, const QrDetector::Params& params);
+
+        int index;
+        Input input;
+        std::vector<Frame> frames;
+        std::vector<Frame*> freeFrames;
+        std::mutex poolMutex;
+        std::condition_variable poolCondition;
+        FrameRing ring;
+        std::atomic<bool> busy;  // Claimed by a worker.
+        QrDetector detector;
+        AdaptiveBuffers adaptiveBuffers;
+        StreamStats stats;
+    };
+
+    Frame* acquire(Stream& stream);
+    void release(Stream& stream, Frame* frame);
+
+    void capture(int stream);
+    void work();
+    // Claim the next stream with a frame in round-robin order.
+    // @returns nullptr if no stream has frames.
+    Stream* claim(Frame*& frame);
+    // Some stream has frames and isn't claimed.
+    bool hasWork() const;
+    bool isOver() const;
+    // Wake workers after a change of state which they wait for.
+    void notifyWorkers(bool all);
+
+    Callback callback;
+    Params params;
+    std::atomic<bool> stopped;
+    std::atomic<unsigned> nextStream;
+    std::vector<std::unique_ptr<Stream> > streams;
+
+    std::mutex workMutex;
+    std::condition_variable workCondition;
+    std::vector<std::thread> threads;
+};
+
+#endif  // PIPELINE_HPP
@@ -0,0 +1,71 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+QrProfile::QrProfile() : numCalls(0)
+{
+    std::fill(sums, sums + NUM_METRICS, 0);
+    std::fill(maxs, maxs + NUM_METRICS, 0);
+    std::fill(&buckets[0][0], &buckets[0][0] + NUM_METRICS * NUM_BUCKETS, 0);
+}
+
+void QrProfile::add(int metric, int64_t value)
+{
+    // Bucket k > 0 keeps values in [2^(k - 1), 2^k).
+    int bucket = 0;
+    for (uint64_t v = std::max(value, (int64_t)0); v; v >>= 1)
+        bucket += 1;
+    sums[metric] += value;
+    maxs[metric] = std::max(maxs[metric], value);
+    buckets[metric][std::min(bucket, NUM_BUCKETS - 1)] += 1;
+}
+
+void QrProfile::add(const QrStats& stats)
+{
+    numCalls += 1;
+    for (int i = 0; i < QrStats::NUM_COUNTERS; ++i)
+        add(i, stats.counters[i]);
+    for (int i = 0; i < QrStats::NUM_STAGES; ++i)
+        add(QrStats::NUM_COUNTERS + i, stats.nanoseconds[i]);
+}
+
+void QrProfile::merge(const QrProfile& other)
+{
+    numCalls += other.numCalls;
+    for (int i = 0; i < NUM_METRICS; ++i)
+    {
+        sums[i] += other.sums[i];
+        maxs[i] = std::max(maxs[i], other.maxs[i]);
+        for (int j = 0; j < NUM_BUCKETS; ++j)
+            buckets[i][j] += other.buckets[i][j];
+    }
+}
+
+void QrProfile::print(std::ostream& out) const
+{
+#ifndef QRCODE_PROFILING
+    out << "Profiling is disabled, rebuild with -DQRCODE_PROFILING=ON" << std::endl;
+#endif
+    out << "profile of " << numCalls << " calls" << std::endl;
+    out << std::setw(20) << std::left << "metric" << std::right << std::setw(14) << "mean"
+        << std::setw(14) << "max" << "  histogram (<upper bound: calls)" << std::endl;
+    for (int i = 0; i < NUM_METRICS; ++i)
+    {
+        std::string name = i < QrStats::NUM_COUNTERS ? QrStats::counterName(i) :
+                           std::string(QrStats::stageName(i - QrStats::NUM_COUNTERS)) + "_ns";
+        out << std::setw(20) << std::left << name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(14) << (numCalls ? (double)sums[i] / numCalls : 0.0)
+            << std::setw(14) << maxs[i] << " ";
+        for (int j = 0; j < NUM_BUCKETS; ++j)
+        {
+            if (!buckets[i][j])
+                continue;
+            if (j == 0)
+                out << " 0:" << buckets[i][j];
+            else
+                out << " <" << (1ULL << j) << ":" << buckets[i][j];
+        }
+        out << std::endl;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <ostream>
+
+#include "qrcode.hpp"
+
+// Histograms of detection stats over many calls. Buckets are powers of two:
+// a value v > 0 goes to the bucket with an upper bound 2^k > v. Zeros have
+// their own bucket.
+class QrProfile
+{
+public:
+    QrProfile();
+
+    void add(const QrStats& stats);
+
+    // Add histograms of another profile (e.g. of another thread).
+    void merge(const QrProfile& other);
+
+    int64_t calls() const { return numCalls; }
+
+    // Table with a row per counter and stage: mean, maximum and non-empty buckets.
+    void print(std::ostream& out) const;
+
+private:
+    enum { NUM_BUCKETS = 64, NUM_METRICS = QrStats::NUM_COUNTERS + QrStats::NUM_STAGES };
+
+    void add(int metric, int64_t value);
+
+    int64_t numCalls;
+    int64_t sums[NUM_METRICS];
+    int64_t maxs[NUM_METRICS];
+    int64_t buckets[NUM_METRICS][NUM_BUCKETS];
+};
+
+#endif  // PROFILE_HPP
@@ -0,0 +1,2073 @@
+#include "qrcode.hpp"
+
+#include <opencv2/opencv.hpp>
+#include <quirc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// SSE2 is a part of x86-64 and NEON of AArch64 so these paths don't need
+// runtime dispatch (see binarize.cpp for ones which do).
+#if defined(__SSE2__) || defined(_M_X64)
+#define QR_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define QR_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Access to pixels of black-and-white images. Scanning code is shared between
+// images with a byte per pixel and packed ones through these wrappers.
+struct ByteImage
+{
+    explicit ByteImage(const cv::Mat& m) : m(m), rows(m.rows), cols(m.cols) {}
+
+    bool black(int y, int x) const { return m.at<uint8_t>(y, x) == 0; }
+    bool white(int y, int x) const { return m.at<uint8_t>(y, x) == 255; }
+    // Count groups of pixels at columns [x0, x1) of row y. xs are absolute.
+    // @returns The first column which is counted.
+    int countRow(int y, int x0, int x1, std::vector<int>& counts, std::vector<int>& xs) const
+    {
+        countPixels(m.ptr<uint8_t>(y) + x0, x1 - x0, counts, xs);
+        return x0;
+    }
+    // Bit x of dst is set if pixel (y, x) differs from (y - 1, x - shift).
+    void changes(int y, int shift, uint64_t* dst) const
+    {
+        const uint8_t* row = m.ptr<uint8_t>(y);
+        const uint8_t* prev = m.ptr<uint8_t>(y - 1);
+        for (int x = 0; x < cols; x += 64)
+        {
+            const int n = std::min(64, cols - x);
+            uint64_t word = 0;
+            // There is no pixel before the first one so its bit stays clear.
+            for (int i = x ? 0 : shift; i < n; ++i)
+                word |= (uint64_t)(row[x + i] != prev[x + i - shift]) << i;
+            dst[x >> 6] = word;
+        }
+    }
+
+    const cv::Mat& m;
+    int rows, cols;
+};
+
+struct PackedImage
+{
+    explicit PackedImage(const BitImage& m) : m(m), rows(m.rows), cols(m.cols) {}
+
+    bool black(int y, int x) const { return !m.get(y, x); }
+    bool white(int y, int x) const { return m.get(y, x); }
+    // Packed rows are counted from a word boundary so x0 is aligned down.
+    int countRow(int y, int x0, int x1, std::vector<int>& counts, std::vector<int>& xs) const
+    {
+        x0 &= ~63;
+        countPixels(m.ptr(y) + (x0 >> 6), x1 - x0, counts, xs);
+        return x0;
+    }
+    void changes(int y, int shift, uint64_t* dst) const
+    {
+        const uint64_t* row = m.ptr(y);
+        const uint64_t* prev = m.ptr(y - 1);
+        uint64_t carry = 0;
+        for (int i = 0; i < m.wordsPerRow; ++i)
+        {
+            dst[i] = row[i] ^ (shift ? (prev[i] << 1) | carry : prev[i]);
+            carry = prev[i] >> 63;
+        }
+        if (shift)
+        {
+            dst[0] &= ~1ULL;  // There is no pixel before the first one.
+            if (cols & 63)
+                dst[m.wordsPerRow - 1] &= (1ULL << (cols & 63)) - 1;  // The last pixel is shifted to padding.
+        }
+    }
+
+    const BitImage& m;
+    int rows, cols;
+};
+
+template <typename Image>
+static bool verifyVertical(int center_x, int center_y, const Image& img, int* top, int* bottom);
+
+template <typename Image>
+static bool verifyDiagonal(int center_x, int center_y, const Image& img);
+
+// How a payload of a sampled grid is obtained.
+enum GridDecoding
+{
+    GRID_REJECTED,  // Format information is broken so quirc is not called.
+    GRID_CACHED,    // Payload is taken from the cache.
+    GRID_DECODED,   // quirc_decode is called (it may fail anyway).
+    GRID_SKIPPED    // Budget of a frame is exceeded before sampling.
+};
+
+template <typename Image>
+static bool decodeCode(const Image& img, const cv::Point& topLeft, const cv::Point& topRight,
+                       const cv::Point& bottomLeft, PayloadCache& cache, quirc_code& qCode,
+                       quirc_data& qData, std::string& payload, GridDecoding& decoding);
+
+// Count decoding attempts of a grid in stats.
+static void countDecoding(GridDecoding decoding, bool decoded, bool cacheEnabled, QrStats& stats);
+
+// Stripes of parallel scan are not made shorter than that.
+static const int kMinStripeRows = 16;
+
+// Instrumentation of hot paths. Without QRCODE_PROFILING it compiles to nothing.
+#ifdef QRCODE_PROFILING
+#define QR_COUNT(stats, counter, n) ((stats).counters[QrStats::counter] += (n))
+#define QR_SCOPED_TIMER(stats, stage) StageTimer stageTimer##stage((stats).nanoseconds[QrStats::stage])
+#else
+#define QR_COUNT(stats, counter, n) ((void)0)
+#define QR_SCOPED_TIMER(stats, stage) ((void)0)
+#endif
+
+// Adds time spent in a scope to a stage. Stages may be entered several times per call.
+class StageTimer
+{
+public:
+    explicit StageTimer(int64_t& nanoseconds) : nanoseconds(nanoseconds), start(cv::getTickCount()) {}
+    ~StageTimer()
+    {
+        nanoseconds += (int64_t)((cv::getTickCount() - start) * (1e9 / cv::getTickFrequency()));
+    }
+
+private:
+    int64_t& nanoseconds;
+    int64_t start;
+};
+
+void QrStats::reset()
+{
+    std::fill(counters, counters + NUM_COUNTERS, 0);
+    std::fill(nanoseconds, nanoseconds + NUM_STAGES, 0);
+}
+
+const char* QrStats::counterName(int counter)
+{
+    static const char* names[] = {"rows_scanned", "horizontal_hits", "vertical_rejects",
+                                  "diagonal_rejects", "candidates", "clusters",
+                                  "decode_calls", "decode_failures", "cache_hits", "cache_misses",
+                                  "format_rejects"};
+    CV_Assert(0 <= counter && counter < NUM_COUNTERS);
+    return names[counter];
+}
+
+const char* QrStats::stageName(int stage)
+{
+    static const char* names[] = {"scan", "group", "decode", "total"};
+    CV_Assert(0 <= stage && stage < NUM_STAGES);
+    return names[stage];
+}
+
+// 64-bit FNV-1a hash of a grid.
+static uint64_t gridHash(const uint8_t* cells, int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ (uint64_t)size;
+    const int numBytes = (size * size + 7) / 8;
+    for (int i = 0; i < numBytes; ++i)
+        hash = (hash ^ cells[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+PayloadCache::PayloadCache(int capacity) : numEntries(0), clock(0), numHits(0), numMisses(0)
+{
+    setCapacity(capacity);
+}
+
+void PayloadCache::setCapacity(int capacity)
+{
+    CV_Assert(capacity >= 0);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (capacity != (int)entries.size())
+    {
+        entries.resize(capacity);
+        numEntries = 0;
+    }
+}
+
+int PayloadCache::capacity() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)entries.size();
+}
+
+int PayloadCache::lookup(uint64_t hash, const uint8_t* cells, int size) const
+{
+    const int numBytes = (size * size + 7) / 8;
+    for (int i = 0; i < numEntries; ++i)
+    {
+        const Entry& entry = entries[i];
+        if (entry.hash == hash && entry.size == size && !memcmp(&entry.cells[0], cells, numBytes))
+            return i;
+    }
+    return -1;
+}
+
+bool PayloadCache::find(const uint8_t* cells, int size, std::string& payload)
+{
+    const uint64_t hash = gridHash(cells, size);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.empty())
+        return false;
+    const int i = lookup(hash, cells, size);
+    if (i < 0)
+    {
+        numMisses += 1;
+        return false;
+    }
+    numHits += 1;
+    entries[i].lastUse = ++clock;
+    payload = entries[i].payload;
+    return true;
+}
+
+void PayloadCache::insert(const uint8_t* cells, int size, const std::string& payload)
+{
+    const uint64_t hash = gridHash(cells, size);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.empty() || lookup(hash, cells, size) >= 0)
+        return;
+
+    // Free slot or the least recently used one.
+    int i = numEntries;
+    if (numEntries < (int)entries.size())
+    {
+        numEntries += 1;
+    }
+    else
+    {
+        i = 0;
+        for (int j = 1; j < numEntries; ++j)
+        {
+            if (entries[j].lastUse < entries[i].lastUse)
+                i = j;
+        }
+    }
+    Entry& entry = entries[i];
+    entry.hash = hash;
+    entry.lastUse = ++clock;
+    entry.size = size;
+    entry.cells.assign(cells, cells + (size * size + 7) / 8);
+    entry.payload = payload;
+}
+
+int64_t PayloadCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numHits;
+}
+
+int64_t PayloadCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numMisses;
+}
+
+void countPixels(const uint8_t* row, int length, std::vector<int>& counts,
+                 std::vector<int>& xs)
+{
+    counts.clear();
+    xs.clear();
+
+    // Skip white pixels before the first black one.
+    int x = 0;
+    while (x < length && row[x] != 0)
+        ++x;
+
+    while (x < length)
+    {
+        const int start = x;
+        const uint8_t value = row[x];
+        for (++x; x < length && row[x] == value; ++x) {}
+        xs.push_back(start);
+        counts.push_back(x - start);
+    }
+}
+
+static inline int ctz64(uint64_t v)
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return (int)idx;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+void countPixels(const uint64_t* row, int length, std::vector<int>& counts,
+                 std::vector<int>& xs)
+{
+    counts.clear();
+    xs.clear();
+
+    // Set bits of (word ^ (word << 1)) are pixels which differ from the previous
+    // ones so every one of them starts a new group. A pixel before the row is
+    // considered white to start from the first black one.
+    uint64_t prev = 1;
+    const int numWords = (length + 63) / 64;
+    for (int i = 0; i < numWords; ++i)
+    {
+        const uint64_t word = row[i];
+        uint64_t changes = word ^ ((word << 1) | prev);
+        prev = word >> 63;
+        if (i == numWords - 1 && (length & 63))
+            changes &= (1ULL << (length & 63)) - 1;  // Skip padding.
+
+        for (; changes; changes &= changes - 1)
+        {
+            const int x = i * 64 + ctz64(changes);
+            if (!xs.empty())
+                counts.back() = x - xs.back();
+            xs.push_back(x);
+            counts.push_back(0);
+        }
+    }
+    if (!xs.empty())
+        counts.back() = length - xs.back();
+}
+
+// Every group may differ from an expected size for a half of module. With
+// module = total / 7 everything is multiplied by 14 to stay in integers:
+// |module - count| < module / 2  <=>  |2 * total - 14 * count| < total
+// and |6 * total - 14 * count| < 3 * total for the central group.
+bool checkRatios(const int* counts)
+{
+    const int total = counts[0] + counts[1] + counts[2] + counts[3] + counts[4];
+    const int expected = 2 * total;
+    return (total >= 7) &
+           (std::abs(expected - 14 * counts[0]) < total) &
+           (std::abs(expected - 14 * counts[1]) < total) &
+           (std::abs(3 * expected - 14 * counts[2]) < 3 * total) &
+           (std::abs(expected - 14 * counts[3]) < total) &
+           (std::abs(expected - 14 * counts[4]) < total);
+}
+
+#ifdef QR_SSE2
+// Elements p[0], p[2], p[4] and p[6].
+static inline __m128i evens_sse2(const int* p)
+{
+    const __m128 lo = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)p));
+    const __m128 hi = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(p + 4)));
+    return _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+// |expected - 14 * count| < limit. There is no pabsd in SSE2 so the
+// difference is compared with both limit and -limit.
+static inline __m128i within_sse2(__m128i expected, __m128i count, __m128i limit)
+{
+    const __m128i count14 = _mm_sub_epi32(_mm_slli_epi32(count, 4), _mm_slli_epi32(count, 1));
+    const __m128i diff = _mm_sub_epi32(expected, count14);
+    return _mm_and_si128(_mm_cmplt_epi32(diff, limit),
+                         _mm_cmpgt_epi32(diff, _mm_sub_epi32(_mm_setzero_si128(), limit)));
+}
+
+// Windows k, k + 1, k + 2 and k + 3 starting from counts[2 * k]. Reads up to counts[2 * k + 11].
+static inline int checkRatios4_sse2(const int* counts)
+{
+    __m128i c[5];
+    for (int j = 0; j < 5; ++j)
+        c[j] = evens_sse2(counts + j);
+    const __m128i total = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(c[0], c[1]), _mm_add_epi32(c[2], c[3])), c[4]);
+    const __m128i expected = _mm_add_epi32(total, total);
+    const __m128i total3 = _mm_add_epi32(total, expected);
+    __m128i ok = _mm_cmpgt_epi32(total, _mm_set1_epi32(6));
+    ok = _mm_and_si128(ok, within_sse2(expected, c[0], total));
+    ok = _mm_and_si128(ok, within_sse2(expected, c[1], total));
+    ok = _mm_and_si128(ok, within_sse2(_mm_add_epi32(total3, total3), c[2], total3));
+    ok = _mm_and_si128(ok, within_sse2(expected, c[3], total));
+    ok = _mm_and_si128(ok, within_sse2(expected, c[4], total));
+    return _mm_movemask_ps(_mm_castsi128_ps(ok));
+}
+#endif  // QR_SSE2
+
+#ifdef QR_NEON
+// vld2q_s32 splits elements to even and odd ones for free.
+static inline int checkRatios4_neon(const int* counts)
+{
+    int32x4_t c[5];
+    for (int j = 0; j < 5; ++j)
+        c[j] = vld2q_s32(counts + j).val[0];
+    const int32x4_t total = vaddq_s32(vaddq_s32(vaddq_s32(c[0], c[1]), vaddq_s32(c[2], c[3])), c[4]);
+    const int32x4_t expected = vaddq_s32(total, total);
+    const int32x4_t total3 = vaddq_s32(total, expected);
+    uint32x4_t ok = vcgtq_s32(total, vdupq_n_s32(6));
+    for (int j = 0; j < 5; ++j)
+    {
+        const int32x4_t e = j == 2 ? vaddq_s32(total3, total3) : expected;
+        const int32x4_t limit = j == 2 ? total3 : total;
+        ok = vandq_u32(ok, vcltq_s32(vabsq_s32(vsubq_s32(e, vmulq_n_s32(c[j], 14))), limit));
+    }
+    const uint32_t bits[] = {1, 2, 4, 8};
+    return (int)vaddvq_u32(vandq_u32(ok, vld1q_u32(bits)));
+}
+#endif  // QR_NEON
+
+void checkRatios(const int* counts, int numCounts, std::vector<uint64_t>& mask)
+{
+    const int numWindows = numCounts >= 5 ? (numCounts - 3) / 2 : 0;
+    mask.assign((numWindows + 63) / 64, 0);
+    int k = 0;
+#if defined(QR_SSE2) || defined(QR_NEON)
+    // Groups of 4 windows never cross words of the mask.
+    for (; 2 * k + 11 < numCounts; k += 4)
+    {
+#ifdef QR_SSE2
+        const uint64_t bits = checkRatios4_sse2(counts + 2 * k);
+#else
+        const uint64_t bits = checkRatios4_neon(counts + 2 * k);
+#endif
+        mask[k >> 6] |= bits << (k & 63);
+    }
+#endif
+    for (; k < numWindows; ++k)
+        mask[k >> 6] |= (uint64_t)checkRatios(counts + 2 * k) << (k & 63);
+}
+
+// Uniform grid over groups of candidates. A group is registered at cells
+// covered by its first rectangle. Then it only shrinks so a rectangle which
+// intersects the group always shares a cell with it.
+class GroupsGrid
+{
+public:
+    // Choose cells for rectangles to be grouped.
+    void reset(const std::vector<cv::Rect>& rects)
+    {
+        heads.clear();
+        groupOf.clear();
+        next.clear();
+        if (rects.empty())
+            return;
+
+        int64_t sumSizes = 0;
+        cv::Point tl(INT_MAX, INT_MAX), br(INT_MIN, INT_MIN);
+        for (size_t i = 0; i < rects.size(); ++i)
+        {
+            const cv::Rect& r = rects[i];
+            sumSizes += std::max(r.width, 0) + std::max(r.height, 0);
+            tl.x = std::min(tl.x, r.x);
+            tl.y = std::min(tl.y, r.y);
+            br.x = std::max(br.x, r.x + r.width);
+            br.y = std::max(br.y, r.y + r.height);
+        }
+        // Cells of a size of an average rectangle but not more than a few per rectangle.
+        origin = tl;
+        cellSize = std::max(1, (int)(sumSizes / (2 * (int64_t)rects.size())));
+        const int64_t maxCells = 4 * (int64_t)rects.size() + 64;
+        for (;;)
+        {
+            cols = (br.x - tl.x) / cellSize + 1;
+            rows = (br.y - tl.y) / cellSize + 1;
+            if ((int64_t)cols * rows <= maxCells)
+                break;
+            cellSize *= 2;
+        }
+        heads.assign(cols * rows, -1);
+    }
+
+    void add(int group, const cv::Rect& r)
+    {
+        int x0, y0, x1, y1;
+        if (!cellsOf(r, x0, y0, x1, y1))
+            return;
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                int& head = heads[y * cols + x];
+                groupOf.push_back(group);
+                next.push_back(head);
+                head = (int)groupOf.size() - 1;
+            }
+        }
+    }
+
+    // @returns The first group which intersects a rectangle or -1.
+    int find(const std::vector<cv::Rect>& groups, const cv::Rect& r) const
+    {
+        int x0, y0, x1, y1, first = INT_MAX;
+        if (!cellsOf(r, x0, y0, x1, y1))
+            return -1;
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                for (int i = heads[y * cols + x]; i >= 0; i = next[i])
+                {
+                    const int group = groupOf[i];
+                    if (group < first && (groups[group] & r).area() > 0)
+                        first = group;
+                }
+            }
+        }
+        return first == INT_MAX ? -1 : first;
+    }
+
+private:
+    // Range of cells covered by a rectangle. False for empty rectangles.
+    bool cellsOf(const cv::Rect& r, int& x0, int& y0, int& x1, int& y1) const
+    {
+        if (r.width <= 0 || r.height <= 0 || heads.empty())
+            return false;
+        x0 = (r.x - origin.x) / cellSize;
+        y0 = (r.y - origin.y) / cellSize;
+        x1 = (r.x + r.width - 1 - origin.x) / cellSize;
+        y1 = (r.y + r.height - 1 - origin.y) / cellSize;
+        return true;
+    }
+
+    cv::Point origin;
+    int cellSize, cols, rows;
+    std::vector<int> heads;    // The last entry of every cell.
+    std::vector<int> groupOf;  // Group of an entry.
+    std::vector<int> next;     // Previous entry of the same cell.
+};
+
+// Every rectangle joins the first group it intersects and the group shrinks
+// to the intersection. Otherwise it starts a new group. Lookups by a grid
+// keep it about linear in number of rectangles.
+static void groupCandidates(const std::vector<cv::Rect>& rects, std::vector<cv::Rect>& groups,
+                            GroupsGrid& grid)
+{
+    groups.clear();
+    grid.reset(rects);
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        const int j = grid.find(groups, rects[i]);
+        if (j >= 0)
+        {
+            groups[j] &= rects[i];
+        }
+        else
+        {
+            grid.add((int)groups.size(), rects[i]);
+            groups.push_back(rects[i]);
+        }
+    }
+}
+
+static void groupsCenters(const std::vector<cv::Rect>& groups, std::vector<cv::Point>& centers)
+{
+    centers.resize(groups.size());
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        centers[i].x = groups[i].x + groups[i].width / 2;
+        centers[i].y = groups[i].y + groups[i].height / 2;
+    }
+}
+
+void computeCenters(const std::vector<cv::Rect>& rects, std::vector<cv::Point>& centers)
+{
+    std::vector<cv::Rect> groups;
+    GroupsGrid grid;
+    groupCandidates(rects, groups, grid);
+    groupsCenters(groups, centers);
+}
+
+void sortMarkers(const std::vector<cv::Point>& centers, cv::Point& topLeft,
+                 cv::Point& topRight, cv::Point& bottomLeft)
+{
+    CV_Assert(centers.size() == 3);
+
+    // Top-left marker is opposite to the longest side.
+    int topLeftIdx = 0;
+    int64_t maxDist = -1;
+    for (int i = 0; i < 3; ++i)
+    {
+        cv::Point side = centers[(i + 1) % 3] - centers[(i + 2) % 3];
+        int64_t dist = (int64_t)side.x * side.x + (int64_t)side.y * side.y;
+        if (dist > maxDist)
+        {
+            maxDist = dist;
+            topLeftIdx = i;
+        }
+    }
+    topLeft = centers[topLeftIdx];
+    topRight = centers[(topLeftIdx + 1) % 3];
+    bottomLeft = centers[(topLeftIdx + 2) % 3];
+
+    // Y axis is directed down so top-right -> top-left -> bottom-left turn is
+    // clockwise for a code which is not mirrored.
+    cv::Point right = topRight - topLeft, down = bottomLeft - topLeft;
+    if ((int64_t)right.x * down.y - (int64_t)right.y * down.x < 0)
+        std::swap(topRight, bottomLeft);
+}
+
+// Run-length index of image lines: columns or diagonals from top-left to bottom-right.
+// For every line it keeps positions (rows) where groups of the same pixels start
+// so vertical and diagonal checks are binary searches instead of strided walks
+// over the image. The index is built by a single row-major pass which compares
+// neighbour rows. Byte images are expected to contain only 0 and 255.
+class RunIndex
+{
+public:
+    // @param[in] diagonal Index diagonals instead of columns.
+    // @param[in] step     Index only every step-th line.
+    template <typename Image>
+    void build(const Image& img, bool diagonal, int step);
+
+    // Line which is the nearest indexed one to a pixel.
+    // @returns -1 if there is no indexed line close enough.
+    int nearestLine(int x, int y) const
+    {
+        const int line = lineOf(x, y);
+        int snapped = (line + step / 2) / step * step;
+        if (snapped >= numLines)
+            snapped -= step;
+        const int shifted = x + snapped - line;
+        return 0 <= snapped && 0 <= shifted && shifted < cols ? snapped : -1;
+    }
+
+    // Emulate a pixel walk from position pos towards the beginning of the line:
+    // groups of black, white and black pixels are added to counts[2], counts[1]
+    // and counts[0]. A group is skipped if the next pixel has another color.
+    // @returns The first position of the last passed group.
+    int walkBackward(int line, int pos, int* counts) const
+    {
+        const int* first = &starts[offsets[line]];
+        int run = (int)(std::upper_bound(first, first + numRuns(line), pos) - first) - 1;
+        bool black = true;
+        for (int i = 2; i >= 0; --i, black = !black)
+        {
+            if (run < 0 || runBlack(line, run) != black)
+                continue;
+            counts[i] += pos - first[run] + 1;
+            pos = first[run] - 1;
+            --run;
+        }
+        return pos + 1;
+    }
+
+    // The same towards the end of the line: groups are added to counts[2],
+    // counts[3] and counts[4].
+    // @returns The last position of the last passed group.
+    int walkForward(int line, int pos, int* counts) const
+    {
+        const int* first = &starts[offsets[line]];
+        const int num = numRuns(line), end = lineEnd(line);
+        int run = (int)(std::upper_bound(first, first + num, pos) - first) - 1;
+        bool black = true;
+        for (int i = 2; i <= 4; ++i, black = !black)
+        {
+            if (pos >= end || runBlack(line, run) != black)
+                continue;
+            const int runEnd = run + 1 < num ? first[run + 1] : end;
+            counts[i] += runEnd - pos;
+            pos = runEnd;
+            ++run;
+        }
+        return pos - 1;
+    }
+
+private:
+    int lineOf(int x, int y) const { return diagonal ? x - y + rows - 1 : x; }
+    int lineEnd(int line) const { return diagonal ? std::min(rows, cols + rows - 1 - line) : rows; }
+    int numRuns(int line) const { return offsets[line + 1] - offsets[line]; }
+    bool runBlack(int line, int run) const { return firstBlack[line] != (run & 1); }
+
+    // Visit starts of groups in row-major order so positions come sorted for every line.
+    template <typename Image, typename Visitor>
+    void visitStarts(const Image& img, Visitor& visitor) const;
+
+    struct Counter;
+    struct Writer;
+
+    bool diagonal;
+    int step, rows, cols, numLines, wordsPerRow;
+    std::vector<int> offsets;         // Range of line i is [offsets[i], offsets[i + 1]).
+    std::vector<int> starts;          // First positions of groups, sorted within lines.
+    std::vector<uint8_t> firstBlack;  // Color of the first group of every line.
+    std::vector<uint64_t> changes;    // Bit masks of pixels which differ from the previous ones.
+    std::vector<int> positions;       // Write positions during building.
+};
+
+struct RunIndex::Counter
+{
+    RunIndex& index;
+    void operator()(int line, int, bool) const { index.offsets[line + 1] += 1; }
+};
+
+struct RunIndex::Writer
+{
+    RunIndex& index;
+    // @param[in] black Line starts from a black pixel. Only set for the first group.
+    void operator()(int line, int y, bool black) const
+    {
+        if (black)
+            index.firstBlack[line] = true;
+        index.starts[index.positions[line]++] = y;
+    }
+};
+
+template <typename Image, typename Visitor>
+void RunIndex::visitStarts(const Image& img, Visitor& visitor) const
+{
+    for (int y = 0; y < rows; ++y)
+    {
+        // Lines start at the top row or, for diagonals, at the left column.
+        if (y == 0)
+        {
+            for (int x = 0; x < cols; ++x)
+            {
+                if (lineOf(x, 0) % step == 0)
+                    visitor(lineOf(x, 0), 0, img.black(0, x));
+            }
+            continue;
+        }
+        if (diagonal && lineOf(0, y) % step == 0)
+            visitor(lineOf(0, y), y, img.black(y, 0));
+
+        const uint64_t* words = &changes[(size_t)y * wordsPerRow];
+        for (int i = 0; i < wordsPerRow; ++i)
+        {
+            for (uint64_t bits = words[i]; bits; bits &= bits - 1)
+            {
+                const int x = i * 64 + ctz64(bits);
+                const int line = lineOf(x, y);
+                if (line % step == 0)
+                    visitor(line, y, false);
+            }
+        }
+    }
+}
+
+template <typename Image>
+void RunIndex::build(const Image& img, bool diagonalLines, int lineStep)
+{
+    diagonal = diagonalLines;
+    step = std::max(1, lineStep);
+    rows = img.rows;
+    cols = img.cols;
+    numLines = diagonal ? rows + cols - 1 : cols;
+    wordsPerRow = (cols + 63) / 64;
+
+    changes.resize((size_t)rows * wordsPerRow);
+    for (int y = 1; y < rows; ++y)
+        img.changes(y, diagonal ? 1 : 0, &changes[(size_t)y * wordsPerRow]);
+
+    offsets.assign(numLines + 1, 0);
+    Counter counter = {*this};
+    visitStarts(img, counter);
+    for (int i = 0; i < numLines; ++i)
+        offsets[i + 1] += offsets[i];
+
+    starts.resize(offsets[numLines]);
+    positions.assign(offsets.begin(), offsets.end() - 1);
+    firstBlack.assign(numLines, false);
+    Writer writer = {*this};
+    visitStarts(img, writer);
+}
+
+// Vertical and diagonal checks by walking over pixels.
+template <typename Image>
+struct WalkVerifier
+{
+    explicit WalkVerifier(const Image& img) : img(img) {}
+
+    int column(int x) const { return x; }
+    bool vertical(int x, int y, int* top, int* bottom) const
+    {
+        return verifyVertical(x, y, img, top, bottom);
+    }
+    bool diagonal(int x, int y) const { return verifyDiagonal(x, y, img); }
+
+    const Image& img;
+};
+
+// The same checks by run-length indices. If not every line is indexed, the
+// nearest indexed one is used instead.
+struct IndexVerifier
+{
+    IndexVerifier(const RunIndex& columns, const RunIndex& diagonals)
+        : columns(columns), diagonals(diagonals) {}
+
+    int column(int x) const { return columns.nearestLine(x, 0); }
+    bool vertical(int x, int y, int* top, int* bottom) const
+    {
+        if (x < 0)
+            return false;
+        int counts[5] = {0, 0, 0, 0, 0};
+        *top = columns.walkBackward(x, y, counts);
+        *bottom = columns.walkForward(x, y + 1, counts);
+        return checkRatios(&counts[0]);
+    }
+    bool diagonal(int x, int y) const
+    {
+        const int line = diagonals.nearestLine(x, y);
+        if (line < 0)
+            return false;
+        int counts[5] = {0, 0, 0, 0, 0};
+        diagonals.walkBackward(line, y, counts);
+        diagonals.walkForward(line, y + 1, counts);
+        return checkRatios(&counts[0]);
+    }
+
+    const RunIndex& columns;
+    const RunIndex& diagonals;
+};
+
+// Time and work spent on a frame against budgets of QrDetector::Params.
+// Stripes scanned in parallel share it, the stage only goes up.
+class FrameBudget
+{
+public:
+    FrameBudget() : hits(0), stage(QrDetector::BUDGET_OK), maxHits(0), startTicks(0), maxTicks(0) {}
+
+    void start(const QrDetector::Params& params)
+    {
+        hits = 0;
+        stage = QrDetector::BUDGET_OK;
+        maxHits = params.budgetHits;
+        maxTicks = (int64_t)(params.budgetMs * 1e-3 * cv::getTickFrequency());
+        startTicks = maxTicks > 0 ? cv::getTickCount() : 0;
+    }
+
+    // Account elapsed time.
+    // @returns false if the budget is exceeded.
+    bool check()
+    {
+        if (maxTicks > 0)
+            raise((double)(cv::getTickCount() - startTicks) / maxTicks);
+        return !exceeded();
+    }
+
+    // Account a 1:1:3:1:1 hit before it's processed. Exactly maxHits hits
+    // are allowed, the stage of a hit is by the hits before it.
+    // @returns false if the budget is exceeded.
+    bool spendHit()
+    {
+        if (maxHits > 0)
+        {
+            const int64_t spent = hits.fetch_add(1, std::memory_order_relaxed);
+            raise(spent < maxHits ? (double)spent / maxHits : 1.0);
+        }
+        return !exceeded();
+    }
+
+    QrDetector::BudgetStage current() const
+    {
+        return (QrDetector::BudgetStage)stage.load(std::memory_order_relaxed);
+    }
+
+    bool exceeded() const { return current() == QrDetector::BUDGET_EXCEEDED; }
+
+private:
+    // Enter a stage by a spent part of the budget.
+    void raise(double spent)
+    {
+        const int next = spent >= 1 ? QrDetector::BUDGET_EXCEEDED :
+                         spent >= 0.75 ? QrDetector::BUDGET_CAP_CANDIDATES :
+                         spent >= 0.5 ? QrDetector::BUDGET_SKIP_DIAGONAL : QrDetector::BUDGET_OK;
+        int prev = stage.load(std::memory_order_relaxed);
+        while (prev < next && !stage.compare_exchange_weak(prev, next, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    std::atomic<int64_t> hits;
+    std::atomic<int> stage;
+    int maxHits;
+    int64_t startTicks, maxTicks;
+};
+
+// Scratch buffers and results of a single stripe of rows.
+struct ScanStripe
+{
+    ScanStripe() : budget(0) {}
+
+    std::vector<int> counts;  // Numbers of sequent black & white pixels.
+    std::vector<int> xs;      // Indices of first pixels of an every group.
+    std::vector<uint64_t> matches;  // Windows of groups with ratios 1:1:3:1:1.
+    std::vector<cv::Rect> candidates;
+    std::vector<int> rows;
+    QrStats stats;            // Counters of the stripe from the last scan.
+    FrameBudget* budget;      // Budget of the frame shared by all the stripes.
+};
+
+// Find candidates at row y and columns [x0, x1). Nothing is done once the
+// budget is exceeded, and diagonal checks are skipped after a half of it.
+// @returns Number of 1:1:3:1:1 sequences in the row, including rejected ones.
+template <typename Image, typename Verifier>
+static int scanRow(const Image& bin, const Verifier& verifier, int y, int x0, int x1,
+                   ScanStripe& stripe)
+{
+    std::vector<int>& counts = stripe.counts;
+    std::vector<int>& xs = stripe.xs;
+    FrameBudget& budget = *stripe.budget;
+    if (!budget.check())
+        return 0;
+    QR_COUNT(stripe.stats, ROWS_SCANNED, 1);
+    const int offset = bin.countRow(y, x0, x1, counts, xs);
+
+    if (counts.size() < 5)
+        return 0;
+
+    CV_Assert(xs.size() == counts.size());
+    if (offset)
+    {
+        for (size_t i = 0; i < xs.size(); ++i)
+            xs[i] += offset;
+    }
+    xs.push_back(x1);  // For simplification.
+
+    // Compare ratios of all the windows at once. Try to find 1:1:3:1:1.
+    // The last group is not a start of a window.
+    checkRatios(&counts[0], (int)counts.size() - 1, stripe.matches);
+    int numHits = 0;
+    for (size_t w = 0; w < stripe.matches.size(); ++w)
+    {
+        for (uint64_t bits = stripe.matches[w]; bits; bits &= bits - 1)
+        {
+            const int i = 2 * (int)(w * 64 + ctz64(bits));
+            int top, bottom, center_x = (xs[i] + xs[i + 5]) / 2;
+            if (!budget.spendHit())
+                return numHits;
+            QR_COUNT(stripe.stats, HORIZONTAL_HITS, 1);
+            numHits += 1;
+
+            center_x = verifier.column(center_x);
+            if (!verifier.vertical(center_x, y, &top, &bottom))
+            {
+                QR_COUNT(stripe.stats, VERTICAL_REJECTS, 1);
+            }
+            else if (budget.current() < QrDetector::BUDGET_SKIP_DIAGONAL &&
+                     !verifier.diagonal(center_x, y))
+            {
+                QR_COUNT(stripe.stats, DIAGONAL_REJECTS, 1);
+            }
+            else
+            {
+                cv::Rect candidate;
+                candidate.x = xs[i];
+                candidate.y = top;
+                candidate.width = xs[i + 5] - xs[i];
+                candidate.height = bottom - top + 1;
+
+                stripe.candidates.push_back(candidate);
+                stripe.rows.push_back(y);
+
+                CV_Assert(bin.black(y, xs[i]));
+                CV_Assert(bin.black(y, xs[i + 5] - 1));
+                CV_Assert(bin.black(top, center_x));
+                CV_Assert(bin.black(bottom, center_x));
+            }
+        }
+    }
+    return numHits;
+}
+
+// Find candidates at rows [begin, end) and columns [x0, x1). With step above
+// 1 only every step-th row is scanned first. Markers are taller than a step so
+// they are hit at least once, then rows around hits are scanned too to give
+// groups enough candidates. Candidates are in order of rows in both modes.
+template <typename Image, typename Verifier>
+static void scanRows(const Image& bin, const Verifier& verifier, int begin, int end,
+                     int x0, int x1, int step, ScanStripe& stripe)
+{
+    stripe.candidates.clear();
+    stripe.rows.clear();
+    stripe.stats.reset();
+    if (step <= 1)
+    {
+        for (int y = begin; y < end; ++y)
+            scanRow(bin, verifier, y, x0, x1, stripe);
+        return;
+    }
+
+    int scanned = begin;  // Rows before it are scanned or skipped.
+    for (int y = begin; y < end; y += step)
+    {
+        const size_t rowBegin = stripe.candidates.size();
+        if (!scanRow(bin, verifier, y, x0, x1, stripe))
+            continue;
+
+        // Skipped rows above the hit. Their candidates go before ones of the hit row.
+        const size_t rowEnd = stripe.candidates.size();
+        for (int r = std::max(scanned, y - step + 1); r < y; ++r)
+            scanRow(bin, verifier, r, x0, x1, stripe);
+        std::rotate(stripe.candidates.begin() + rowBegin, stripe.candidates.begin() + rowEnd,
+                    stripe.candidates.end());
+        std::rotate(stripe.rows.begin() + rowBegin, stripe.rows.begin() + rowEnd, stripe.rows.end());
+
+        // Rows below it up to the next sparse one.
+        scanned = std::min(y + step, end);
+        for (int r = y + 1; r < scanned; ++r)
+            scanRow(bin, verifier, r, x0, x1, stripe);
+    }
+}
+
+// Every stripe of rows is scanned independently into its own lists.
+template <typename Image, typename Verifier>
+class RowsScanner : public cv::ParallelLoopBody
+{
+public:
+    RowsScanner(const Image& bin, const Verifier& verifier, const cv::Rect& roi, int numStripes,
+                int step, std::vector<ScanStripe>& stripes)
+        : bin(bin), verifier(verifier), roi(roi), numStripes(numStripes), step(step),
+          stripes(stripes) {}
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            scanRows(bin, verifier, roi.y + roi.height * i / numStripes,
+                     roi.y + roi.height * (i + 1) / numStripes, roi.x, roi.x + roi.width,
+                     step, stripes[i]);
+        }
+    }
+
+private:
+    const Image& bin;
+    const Verifier& verifier;
+    cv::Rect roi;
+    int numStripes, step;
+    std::vector<ScanStripe>& stripes;
+};
+
+// Scan a region of interest. Candidates are appended to the lists.
+// Vertical and diagonal checks are not limited by the region. See scanRows
+// for a step between rows.
+template <typename Image, typename Verifier>
+static void findCandidates(const Image& bin, const Verifier& verifier, const cv::Rect& roi,
+                           int numStripes, int step, std::vector<ScanStripe>& stripes,
+                           std::vector<cv::Rect>& candidates, std::vector<int>& rows,
+                           QrStats& stats, FrameBudget& budget)
+{
+    if (roi.width <= 0 || roi.height <= 0)
+        return;
+
+    if (numStripes < 1)
+    {
+        // Several stripes per thread balance rows with lots of candidates.
+        numStripes = cv::getNumThreads() * 4;
+    }
+    numStripes = std::max(1, std::min(numStripes, roi.height / kMinStripeRows));
+    if (stripes.size() < numStripes)
+        stripes.resize(numStripes);
+    for (int i = 0; i < numStripes; ++i)
+        stripes[i].budget = &budget;
+
+    if (numStripes == 1)
+    {
+        scanRows(bin, verifier, roi.y, roi.y + roi.height, roi.x, roi.x + roi.width, step,
+                 stripes[0]);
+    }
+    else
+    {
+        cv::parallel_for_(cv::Range(0, numStripes),
+                          RowsScanner<Image, Verifier>(bin, verifier, roi, numStripes, step, stripes),
+                          numStripes);
+    }
+
+    // Stripes follow each other so concatenation gives the same order as a serial scan.
+    for (int i = 0; i < numStripes; ++i)
+    {
+        candidates.insert(candidates.end(), stripes[i].candidates.begin(), stripes[i].candidates.end());
+        rows.insert(rows.end(), stripes[i].rows.begin(), stripes[i].rows.end());
+#ifdef QRCODE_PROFILING
+        for (int j = 0; j < QrStats::NUM_COUNTERS; ++j)
+            stats.counters[j] += stripes[i].stats.counters[j];
+#endif
+    }
+}
+
+void findCandidates(const cv::Mat& bin, std::vector<cv::Rect>& candidates,
+                    std::vector<int>& rows, int numStripes)
+{
+    std::vector<ScanStripe> stripes;
+    ByteImage img(bin);
+    QrStats stats;
+    FrameBudget budget;
+    candidates.clear();
+    rows.clear();
+    findCandidates(img, WalkVerifier<ByteImage>(img), cv::Rect(0, 0, img.cols, img.rows),
+                   numStripes, 1, stripes, candidates, rows, stats, budget);
+}
+
+void findCandidates(const BitImage& bin, std::vector<cv::Rect>& candidates,
+                    std::vector<int>& rows, int numStripes)
+{
+    std::vector<ScanStripe> stripes;
+    PackedImage img(bin);
+    QrStats stats;
+    FrameBudget budget;
+    candidates.clear();
+    rows.clear();
+    findCandidates(img, WalkVerifier<PackedImage>(img), cv::Rect(0, 0, img.cols, img.rows),
+                   numStripes, 1, stripes, candidates, rows, stats, budget);
+}
+
+// Reduce image in scale times by taking central pixels of blocks. It reads
+// only a part of pixels and, unlike a majority vote, doesn't thicken black
+// groups when blocks are split between modules.
+template <typename Image>
+static void downsample(const Image& bin, int scale, cv::Mat& dst)
+{
+    dst.create(bin.rows / scale, bin.cols / scale, CV_8UC1);
+    for (int y = 0; y < dst.rows; ++y)
+    {
+        uint8_t* row = dst.ptr<uint8_t>(y);
+        for (int x = 0; x < dst.cols; ++x)
+            row[x] = bin.white(y * scale + scale / 2, x * scale + scale / 2) ? 255 : 0;
+    }
+}
+
+void mergeRois(std::vector<cv::Rect>& rois)
+{
+    // Every merge restarts the search since the grown region may overlap
+    // regions before it as well.
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (size_t i = 0; i < rois.size() && !merged; ++i)
+        {
+            for (size_t j = i + 1; j < rois.size() && !merged; ++j)
+            {
+                if ((rois[i] & rois[j]).area() > 0)
+                {
+                    rois[i] |= rois[j];
+                    rois.erase(rois.begin() + j);
+                    merged = true;
+                }
+            }
+        }
+    }
+}
+
+// Three markers of a single code.
+struct Triplet
+{
+    int markers[3];  // The first one is the vertex of the right angle.
+    float score;  // Deviation from an isosceles right triangle. Less is better.
+
+    bool operator<(const Triplet& other) const { return score < other.score; }
+};
+
+// Legs of a triplet may differ by this part of the longest one.
+static const float kMaxLegsDiff = 0.2f;
+// Maximal cosine of an angle between legs.
+static const float kMaxLegsCos = 0.2f;
+// Markers closer to a leg than this part of its length are on the leg.
+static const float kMaxLegDist = 0.1f;
+// Module sizes of markers of a code may differ in so many times.
+static const float kMaxModulesRatio = 1.5f;
+// Legs between centers of markers in modules: versions 1 and 40 are 21 and
+// 177 modules wide, centers are 3.5 modules inside.
+static const int kMinLegModules = 14;
+static const int kMaxLegModules = 170;
+// Maximal distance of an estimated version to the nearest valid one.
+static const float kMaxVersionDiff = 0.5f;
+
+// Module size of every marker. A group is about 7 modules across in both
+// directions, more for rotated markers since it's measured along axes.
+static void groupsModules(const std::vector<cv::Rect>& groups, std::vector<float>& modules)
+{
+    modules.resize(groups.size());
+    for (size_t i = 0; i < groups.size(); ++i)
+        modules[i] = (groups[i].width + groups[i].height) / 14.f;
+}
+
+static bool similarModules(float a, float b)
+{
+    return std::max(a, b) <= kMaxModulesRatio * std::min(a, b);
+}
+
+// Whether two markers are close enough to be a leg or a hypotenuse of a
+// code. Estimates of modules are up to sqrt(2) times more than real ones.
+static bool possiblePair(const cv::Point& a, const cv::Point& b, float moduleA, float moduleB)
+{
+    const float sqrt2 = 1.41421356f;
+    const cv::Point d = a - b;
+    const float dist2 = (float)d.x * d.x + (float)d.y * d.y;
+    const float minDist = kMinLegModules * (1 - kMaxLegsDiff) * std::min(moduleA, moduleB) / sqrt2;
+    const float maxDist = kMaxLegModules * (1 + kMaxLegsDiff) * std::max(moduleA, moduleB) * sqrt2;
+    return dist2 >= minDist * minDist && dist2 <= maxDist * maxDist;
+}
+
+// Whether a marker lies on a leg between the vertex and another marker of a
+// triplet. Legs of a code are timing patterns so it's a triplet of markers of
+// different codes which are aligned, e.g. top-left ones of a grid of codes.
+static bool markerOnLegs(const std::vector<cv::Point>& centers, const Triplet& triplet)
+{
+    const cv::Point2f corner = centers[triplet.markers[0]];
+    for (int leg = 1; leg < 3; ++leg)
+    {
+        const cv::Point2f dir = cv::Point2f(centers[triplet.markers[leg]]) - corner;
+        const float len2 = dir.dot(dir);
+        for (size_t i = 0; i < centers.size(); ++i)
+        {
+            const cv::Point2f p = cv::Point2f(centers[i]) - corner;
+            const float along = p.dot(dir), across = p.cross(dir);
+            if (along > 0 && along < len2 && across * across <= kMaxLegDist * kMaxLegDist * len2 * len2)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Group markers into triplets which form isosceles right triangles. Triplets
+// are chosen greedily from the best ones so every marker is used only once.
+// Markers of a triplet have similar sizes, legs match a version of a code and
+// there are no markers on them so neighbour codes on a regular grid don't
+// form triplets of each other.
+// @param[in]  groups    Groups of candidates of markers.
+// @param[in]  centers   Centers of markers.
+// @param[in]  budget    Budget of a frame, stops the search if it's exceeded.
+// @param[out] modules   Buffer for module sizes of markers.
+// @param[out] all       Buffer for all the consistent triplets.
+// @param[out] used      Buffer for flags of used markers.
+// @param[out] triplets  Chosen triplets.
+static void groupTriplets(const std::vector<cv::Rect>& groups, const std::vector<cv::Point>& centers,
+                          FrameBudget& budget, std::vector<float>& modules,
+                          std::vector<Triplet>& all, std::vector<uint8_t>& used,
+                          std::vector<Triplet>& triplets)
+{
+    all.clear();
+    groupsModules(groups, modules);
+    const int n = (int)centers.size();
+    for (int i = 0; i < n && budget.check(); ++i)
+    {
+        for (int j = i + 1; j < n; ++j)
+        {
+            // Pairs are pruned before the search of the third marker.
+            if (!similarModules(modules[i], modules[j]) ||
+                !possiblePair(centers[i], centers[j], modules[i], modules[j]))
+                continue;
+            for (int k = j + 1; k < n; ++k)
+            {
+                if (!similarModules(modules[i], modules[k]) || !similarModules(modules[j], modules[k]))
+                    continue;
+                const int ids[] = {i, j, k};
+                // Try every marker as a top-left one (vertex of the right angle).
+                for (int v = 0; v < 3; ++v)
+                {
+                    const cv::Point2f corner = centers[ids[v]];
+                    const cv::Point2f a = cv::Point2f(centers[ids[(v + 1) % 3]]) - corner;
+                    const cv::Point2f b = cv::Point2f(centers[ids[(v + 2) % 3]]) - corner;
+                    const float lenA = std::sqrt(a.dot(a)), lenB = std::sqrt(b.dot(b));
+                    if (lenA == 0 || lenB == 0)
+                        continue;
+                    const float legsDiff = std::abs(lenA - lenB) / std::max(lenA, lenB);
+                    const float cosine = std::abs(a.dot(b)) / (lenA * lenB);
+                    if (legsDiff > kMaxLegsDiff || cosine > kMaxLegsCos)
+                        continue;
+
+                    // Legs give axes of a code which correct module sizes of rotated markers.
+                    const float axis = std::max(std::abs(a.x), std::abs(a.y)) / lenA;
+                    const float module = (modules[i] + modules[j] + modules[k]) / 3 * axis;
+                    const float version = ((lenA + lenB) / 2 / module - kMinLegModules) / 4 + 1;
+                    if (version < 1 - kMaxVersionDiff || version > 40 + kMaxVersionDiff)
+                        break;
+                    const float versionDiff = std::abs(version - cvRound(version));
+
+                    Triplet triplet;
+                    triplet.markers[0] = ids[v];
+                    triplet.markers[1] = ids[(v + 1) % 3];
+                    triplet.markers[2] = ids[(v + 2) % 3];
+                    triplet.score = legsDiff / kMaxLegsDiff + cosine / kMaxLegsCos +
+                                    versionDiff / kMaxVersionDiff;
+                    all.push_back(triplet);
+                    break;
+                }
+            }
+        }
+    }
+    std::sort(all.begin(), all.end());
+
+    used.assign(n, false);
+    triplets.clear();
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        const int* m = all[i].markers;
+        if (used[m[0]] || used[m[1]] || used[m[2]] || markerOnLegs(centers, all[i]))
+            continue;
+        used[m[0]] = used[m[1]] = used[m[2]] = true;
+        triplets.push_back(all[i]);
+    }
+}
+
+// Corners of a code from centers of its markers. Centers are 3.5 modules
+// inside of a code with size x size modules.
+static void codeCorners(const cv::Point& topLeft, const cv::Point& topRight,
+                        const cv::Point& bottomLeft, int size, cv::Point2f corners[4])
+{
+    const float scale = 3.5f / (size - 7);
+    const cv::Point2f right = cv::Point2f(topRight - topLeft) * scale;
+    const cv::Point2f down = cv::Point2f(bottomLeft - topLeft) * scale;
+    corners[0] = cv::Point2f(topLeft) - right - down;
+    corners[1] = cv::Point2f(topRight) + right - down;
+    corners[2] = cv::Point2f(topRight + bottomLeft - topLeft) + right + down;
+    corners[3] = cv::Point2f(bottomLeft) - right + down;
+}
+
+// Confidence of a code in [0, 1]. Decoded codes have at least 0.5. The rest
+// depends on how close markers are to an isosceles right triangle.
+static float codeConfidence(const cv::Point& topLeft, const cv::Point& topRight,
+                            const cv::Point& bottomLeft, bool decoded)
+{
+    const cv::Point2f a = topRight - topLeft, b = bottomLeft - topLeft;
+    const float lenA = std::sqrt(a.dot(a)), lenB = std::sqrt(b.dot(b));
+    float shape = 0;
+    if (lenA > 0 && lenB > 0)
+    {
+        const float legsDiff = std::abs(lenA - lenB) / std::max(lenA, lenB);
+        const float cosine = std::abs(a.dot(b)) / (lenA * lenB);
+        shape = std::max(0.0f, 1 - 0.5f * (legsDiff / kMaxLegsDiff + cosine / kMaxLegsCos));
+    }
+    return 0.5f * shape + (decoded ? 0.5f : 0.0f);
+}
+
+// Geometry and confidence of a code with size x size modules. Payload is set by a caller.
+static void fillCode(const cv::Point& topLeft, const cv::Point& topRight,
+                     const cv::Point& bottomLeft, int size, bool decoded, QrCode& code)
+{
+    code.markers[0] = topLeft;
+    code.markers[1] = topRight;
+    code.markers[2] = bottomLeft;
+    code.version = (size - 17) / 4;
+    codeCorners(topLeft, topRight, bottomLeft, size, code.corners);
+    code.confidence = codeConfidence(topLeft, topRight, bottomLeft, decoded);
+}
+
+// Modules of a sampled code. 0 is black, 255 is white.
+static void cellsToMask(const quirc_code& qCode, cv::Mat& mask)
+{
+    mask.create(qCode.size, qCode.size, CV_8UC1);
+    for (int y = 0; y < qCode.size; ++y)
+    {
+        uint8_t* row = mask.ptr<uint8_t>(y);
+        for (int x = 0; x < qCode.size; ++x)
+        {
+            int p = y * qCode.size + x;
+            row[x] = (qCode.cell_bitmap[p >> 3] >> (p & 7)) & 1 ? 0 : 255;
+        }
+    }
+}
+
+// Per-code buffers for parallel decoding.
+struct CodeScratch
+{
+    std::vector<cv::Point> markers;
+    quirc_code qCode;
+    quirc_data qData;
+    GridDecoding decoding;
+};
+
+// Intermediate buffers of QrDetector. They only grow so after a few frames
+// detection doesn't allocate memory.
+struct QrDetector::Impl
+{
+    Impl() : tracked(false), framesTracked(0) {}
+
+    // Find regions around markers at a downsampled image. No regions means
+    // that the full image should be scanned.
+    template <typename Image>
+    void coarseSearch(const Params& params, const Image& bin);
+
+    // Region around markers from the previous frame.
+    cv::Rect trackingRoi(const Params& params, int rows, int cols) const;
+
+    // Find candidates in all the regions and group them.
+    template <typename Image>
+    void scan(const Params& params, const Image& bin);
+
+    std::vector<ScanStripe> stripes;
+    BitImage viewBin;             // Binarized raw frame.
+    AdaptiveBuffers adaptiveBuffers;
+    RunIndex columns, diagonals;
+    cv::Mat coarse;               // Downsampled image for coarse search.
+    std::vector<cv::Rect> rois;   // Regions to scan at full resolution.
+    std::vector<cv::Rect> candidates;
+    std::vector<int> rows;
+    std::vector<cv::Rect> groups;
+    GroupsGrid grid;
+    std::vector<cv::Point> centers;
+    cv::Mat mask;
+    quirc_code qCode;
+    quirc_data qData;
+    QrCode code;  // The last code of decode().
+    QrStats stats;
+    FrameBudget budget;
+    PayloadCache cache;
+
+    // Multiple codes detection.
+    std::vector<float> modules;
+    std::vector<Triplet> allTriplets, triplets;
+    std::vector<uint8_t> used;
+    std::vector<CodeScratch> scratch;
+    std::vector<QrCode> codes;
+
+    // Markers of the previous frame for tracking mode.
+    bool tracked;
+    int framesTracked;  // Frames since the last full scan.
+    cv::Point topLeft, topRight, bottomLeft;
+};
+
+// Keep maxCandidates evenly spaced candidates. They are in order of rows so
+// every marker keeps a part of its candidates.
+static void thinCandidates(int maxCandidates, std::vector<cv::Rect>& candidates,
+                           std::vector<int>& rows)
+{
+    const size_t num = candidates.size();
+    if (maxCandidates <= 0 || num <= (size_t)maxCandidates)
+        return;
+    for (size_t i = 0; i < (size_t)maxCandidates; ++i)
+    {
+        candidates[i] = candidates[i * num / maxCandidates];
+        rows[i] = rows[i * num / maxCandidates];
+    }
+    candidates.resize(maxCandidates);
+    rows.resize(maxCandidates);
+}
+
+// Step of the sparse scan. Central blocks of markers are 3 modules tall so
+// sparse rows hit every block at least twice.
+static int rowStep(const QrDetector::Params& params)
+{
+    return std::max(1, params.minModuleSize * 3 / 2);
+}
+
+template <typename Image>
+void QrDetector::Impl::coarseSearch(const Params& params, const Image& bin)
+{
+    rois.clear();
+    if (params.coarseScale <= 1)
+        return;
+
+    CV_Assert(params.coarseScale == 2 || params.coarseScale == 4);
+    const int scale = params.coarseScale;
+    candidates.clear();
+    rows.clear();
+    {
+        QR_SCOPED_TIMER(stats, STAGE_SCAN);
+        downsample(bin, scale, coarse);
+        ByteImage img(coarse);
+        findCandidates(img, WalkVerifier<ByteImage>(img), cv::Rect(0, 0, img.cols, img.rows),
+                       params.numStripes, rowStep(params) / scale, stripes, candidates, rows, stats,
+                       budget);
+    }
+    {
+        QR_SCOPED_TIMER(stats, STAGE_GROUP);
+        groupCandidates(candidates, groups, grid);
+    }
+
+    // With less than three markers code is missed or too small for a coarse
+    // search so the full image is scanned.
+    if (groups.size() < 3)
+        return;
+
+    const cv::Rect frame(0, 0, bin.cols, bin.rows);
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        // Group is an intersection of candidates so the whole marker
+        // may be about twice bigger.
+        const cv::Rect& g = groups[i];
+        const int pad = (std::max(g.width, g.height) + 2) * scale;
+        cv::Rect roi(g.x * scale - pad, g.y * scale - pad,
+                     g.width * scale + 2 * pad, g.height * scale + 2 * pad);
+        rois.push_back(roi & frame);
+    }
+    mergeRois(rois);
+}
+
+cv::Rect QrDetector::Impl::trackingRoi(const Params& params, int rows, int cols) const
+{
+    const cv::Point bottomRight = topRight + bottomLeft - topLeft;
+    const int left = std::min(std::min(topLeft.x, topRight.x), std::min(bottomLeft.x, bottomRight.x));
+    const int right = std::max(std::max(topLeft.x, topRight.x), std::max(bottomLeft.x, bottomRight.x));
+    const int top = std::min(std::min(topLeft.y, topRight.y), std::min(bottomLeft.y, bottomRight.y));
+    const int bottom = std::max(std::max(topLeft.y, topRight.y), std::max(bottomLeft.y, bottomRight.y));
+
+    // Padding is proportional to the code size so it covers markers
+    // themselves (centers are 3.5 modules inside) and a motion.
+    const int pad = cvCeil(params.trackingPadding * std::max(right - left, bottom - top));
+    cv::Rect roi(left - pad, top - pad, right - left + 2 * pad, bottom - top + 2 * pad);
+    return roi & cv::Rect(0, 0, cols, rows);
+}
+
+template <typename Image>
+void QrDetector::Impl::scan(const Params& params, const Image& bin)
+{
+    if (rois.empty())
+        rois.push_back(cv::Rect(0, 0, bin.cols, bin.rows));
+
+    // Parse rows to find desired ratios.
+    candidates.clear();
+    rows.clear();
+    {
+        QR_SCOPED_TIMER(stats, STAGE_SCAN);
+        if (params.verification == Params::VERIFY_RUN_INDEX)
+        {
+            columns.build(bin, false, params.indexStep);
+            diagonals.build(bin, true, params.indexStep);
+        }
+        for (size_t i = 0; i < rois.size(); ++i)
+        {
+            if (params.verification == Params::VERIFY_RUN_INDEX)
+            {
+                findCandidates(bin, IndexVerifier(columns, diagonals), rois[i],
+                               params.numStripes, rowStep(params), stripes, candidates, rows, stats,
+                               budget);
+            }
+            else
+            {
+                findCandidates(bin, WalkVerifier<Image>(bin), rois[i],
+                               params.numStripes, rowStep(params), stripes, candidates, rows, stats,
+                               budget);
+            }
+        }
+    }
+    QR_COUNT(stats, CANDIDATES, candidates.size());
+    if (budget.exceeded())
+    {
+        groups.clear();
+        return;
+    }
+
+    // Estimates centers of each marker.
+    QR_SCOPED_TIMER(stats, STAGE_GROUP);
+    if (budget.current() >= BUDGET_CAP_CANDIDATES)
+        thinCandidates(params.maxCandidates, candidates, rows);
+    groupCandidates(candidates, groups, grid);
+    QR_COUNT(stats, CLUSTERS, groups.size());
+}
+
+QrDetector::Params::Params()
+    : numStripes(0), verification(VERIFY_WALK), indexStep(1), coarseScale(1),
+      tracking(false), trackingPadding(0.5f), trackingRefresh(30), debugMask(false),
+      adaptive(false), cacheSize(16), minModuleSize(0), budgetMs(0), budgetHits(0),
+      maxCandidates(256) {}
+
+QrDetector::QrDetector(const Params& params) : params(params), impl(new Impl()) {}
+
+QrDetector::~QrDetector()
+{
+    delete impl;
+}
+
+const cv::Mat& QrDetector::mask() const
+{
+    return impl->mask;
+}
+
+const std::vector<cv::Rect>& QrDetector::candidates() const
+{
+    return impl->candidates;
+}
+
+const QrStats& QrDetector::stats() const
+{
+    return impl->stats;
+}
+
+const std::vector<int>& QrDetector::candidateRows() const
+{
+    return impl->rows;
+}
+
+const PayloadCache& QrDetector::cache() const
+{
+    return impl->cache;
+}
+
+QrDetector::BudgetStage QrDetector::budgetStage() const
+{
+    return impl->budget.current();
+}
+
+const std::string& QrDetector::decode(const cv::Mat& bin, cv::Mat& img)
+{
+    return decodeImpl(ByteImage(bin), img);
+}
+
+const std::string& QrDetector::decode(const BitImage& bin, cv::Mat& img)
+{
+    return decodeImpl(PackedImage(bin), img);
+}
+
+template <typename Image>
+bool QrDetector::detectImpl(const Image& bin, QrCode& code)
+{
+    Impl& s = *impl;
+    code.payload.clear();
+    code.confidence = 0;
+    s.stats.reset();
+    s.budget.start(params);
+    QR_SCOPED_TIMER(s.stats, STAGE_TOTAL);
+
+    // In tracking mode only a region around the previous markers is scanned.
+    bool found = false;
+    if (params.tracking && s.tracked && s.framesTracked < params.trackingRefresh)
+    {
+        s.rois.assign(1, s.trackingRoi(params, bin.rows, bin.cols));
+        s.scan(params, bin);
+        found = s.groups.size() == 3;
+        s.framesTracked += 1;
+    }
+    if (!found && !s.budget.exceeded())
+    {
+        // Look for markers at a downsampled image first. Then only regions
+        // around them are scanned at full resolution.
+        s.coarseSearch(params, bin);
+        s.scan(params, bin);
+        s.framesTracked = 0;
+    }
+    s.tracked = false;
+
+    if (s.groups.size() != 3 || !s.budget.check())
+        return false;
+    {
+        QR_SCOPED_TIMER(s.stats, STAGE_GROUP);
+        groupsCenters(s.groups, s.centers);
+    }
+
+    // Identify each marker location.
+    QR_SCOPED_TIMER(s.stats, STAGE_DECODE);
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(s.centers, topLeft, topRight, bottomLeft);
+    s.tracked = true;
+    s.topLeft = topLeft;
+    s.topRight = topRight;
+    s.bottomLeft = bottomLeft;
+
+    // Sample modules of a qr code and decode them.
+    GridDecoding decoding;
+    s.cache.setCapacity(params.cacheSize);
+    const bool decoded = decodeCode(bin, topLeft, topRight, bottomLeft, s.cache, s.qCode, s.qData,
+                                    code.payload, decoding);
+    countDecoding(decoding, decoded, params.cacheSize > 0, s.stats);
+    if (params.debugMask)
+        cellsToMask(s.qCode, s.mask);
+    fillCode(topLeft, topRight, bottomLeft, s.qCode.size, decoded, code);
+    return true;
+}
+
+bool QrDetector::detect(const cv::Mat& bin, QrCode& code)
+{
+    return detectImpl(ByteImage(bin), code);
+}
+
+bool QrDetector::detect(const BitImage& bin, QrCode& code)
+{
+    return detectImpl(PackedImage(bin), code);
+}
+
+bool QrDetector::detect(const ImageView& view, QrCode& code)
+{
+    if (params.adaptive)
+        view2bin(view, impl->viewBin, params.adaptiveThreshold, impl->adaptiveBuffers);
+    else
+        view2bin(view, impl->viewBin);
+    return detectImpl(PackedImage(impl->viewBin), code);
+}
+
+template <typename Image>
+const std::string& QrDetector::decodeImpl(const Image& bin, cv::Mat& img)
+{
+    Impl& s = *impl;
+    const bool found = detectImpl(bin, s.code);
+    if (!img.empty())
+    {
+        drawCandidates(img, s.candidates, s.rows);
+        if (found)
+            drawCodeMarkers(img, s.code);
+    }
+    return s.code.payload;
+}
+
+// Extracts and decodes every triplet of markers into its own scratch buffers.
+template <typename Image>
+class TripletsDecoder : public cv::ParallelLoopBody
+{
+public:
+    TripletsDecoder(const Image& bin, const std::vector<cv::Point>& centers,
+                    const std::vector<Triplet>& triplets, PayloadCache& cache, FrameBudget& budget,
+                    std::vector<CodeScratch>& scratch, std::vector<QrCode>& codes)
+        : bin(bin), centers(centers), triplets(triplets), cache(cache), budget(budget),
+          scratch(scratch), codes(codes) {}
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            if (!budget.check())
+            {
+                scratch[i].decoding = GRID_SKIPPED;
+                continue;
+            }
+            // Markers of a triplet are in arbitrary order.
+            std::vector<cv::Point>& markers = scratch[i].markers;
+            markers.resize(3);
+            markers[0] = centers[triplets[i].markers[0]];
+            markers[1] = centers[triplets[i].markers[1]];
+            markers[2] = centers[triplets[i].markers[2]];
+            cv::Point topLeft, topRight, bottomLeft;
+            sortMarkers(markers, topLeft, topRight, bottomLeft);
+
+            QrCode& code = codes[i];
+            quirc_code& qCode = scratch[i].qCode;
+            quirc_data& qData = scratch[i].qData;
+            const bool decoded = decodeCode(bin, topLeft, topRight, bottomLeft, cache, qCode, qData,
+                                            code.payload, scratch[i].decoding);
+            fillCode(topLeft, topRight, bottomLeft, qCode.size, decoded, code);
+        }
+    }
+
+private:
+    const Image& bin;
+    const std::vector<cv::Point>& centers;
+    const std::vector<Triplet>& triplets;
+    PayloadCache& cache;
+    FrameBudget& budget;
+    std::vector<CodeScratch>& scratch;
+    std::vector<QrCode>& codes;
+};
+
+template <typename Image>
+const std::vector<QrCode>& QrDetector::detectMultiImpl(const Image& bin)
+{
+    Impl& s = *impl;
+    s.stats.reset();
+    s.budget.start(params);
+    QR_SCOPED_TIMER(s.stats, STAGE_TOTAL);
+    s.coarseSearch(params, bin);
+    s.scan(params, bin);
+    {
+        QR_SCOPED_TIMER(s.stats, STAGE_GROUP);
+        groupsCenters(s.groups, s.centers);
+        groupTriplets(s.groups, s.centers, s.budget, s.modules, s.allTriplets, s.used, s.triplets);
+    }
+
+    QR_SCOPED_TIMER(s.stats, STAGE_DECODE);
+    const int numCodes = (int)s.triplets.size();
+    if (s.scratch.size() < s.triplets.size())
+        s.scratch.resize(s.triplets.size());
+    s.codes.resize(s.triplets.size());
+    s.cache.setCapacity(params.cacheSize);
+    TripletsDecoder<Image> decoder(bin, s.centers, s.triplets, s.cache, s.budget, s.scratch,
+                                   s.codes);
+    if (numCodes > 1)
+        cv::parallel_for_(cv::Range(0, numCodes), decoder);
+    else
+        decoder(cv::Range(0, numCodes));
+
+    // Codes are decoded in parallel so they are counted afterwards. Ones
+    // skipped after the budget is exceeded are dropped.
+    int numKept = 0;
+    for (int i = 0; i < numCodes; ++i)
+    {
+        countDecoding(s.scratch[i].decoding, !s.codes[i].payload.empty(), params.cacheSize > 0,
+                      s.stats);
+        if (s.scratch[i].decoding != GRID_SKIPPED)
+            std::swap(s.codes[numKept++], s.codes[i]);
+    }
+    s.codes.resize(numKept);
+    return s.codes;
+}
+
+const std::vector<QrCode>& QrDetector::detectMulti(const cv::Mat& bin)
+{
+    return detectMultiImpl(ByteImage(bin));
+}
+
+const std::vector<QrCode>& QrDetector::detectMulti(const BitImage& bin)
+{
+    return detectMultiImpl(PackedImage(bin));
+}
+
+const std::vector<QrCode>& QrDetector::detectMulti(const ImageView& view)
+{
+    if (params.adaptive)
+        view2bin(view, impl->viewBin, params.adaptiveThreshold, impl->adaptiveBuffers);
+    else
+        view2bin(view, impl->viewBin);
+    return detectMultiImpl(PackedImage(impl->viewBin));
+}
+
+std::string decode(const cv::Mat& bin, cv::Mat& img, cv::Mat& mask, QrStats* stats)
+{
+    QrDetector::Params params;
+    params.debugMask = true;
+    QrDetector detector(params);
+    std::string msg = detector.decode(bin, img);
+    if (!detector.mask().empty())
+        mask = detector.mask();
+    if (stats)
+        *stats = detector.stats();
+    return msg;
+}
+
+template <typename Image>
+static bool verifyVertical(int center_x, int center_y, const Image& img, int* top, int* bottom)
+{
+    int counts[5] = {0, 0, 0, 0, 0};
+    int y, x = center_x, numPixels = 0;
+    for (y = center_y; y >= 0 && img.black(y, x); --y, counts[2] += 1, ++numPixels) {}
+    for (; y >= 0 && img.white(y, x); --y, counts[1] += 1, ++numPixels) {}
+    for (; y >= 0 && img.black(y, x); --y, counts[0] += 1, ++numPixels) {}
+    *top = y + 1;
+    for (y = center_y + 1; y < img.rows && img.black(y, x); ++y, counts[2] += 1, ++numPixels) {}
+    for (; y < img.rows && img.white(y, x); ++y, counts[3] += 1, ++numPixels) {}
+    for (; y < img.rows && img.black(y, x); ++y, counts[4] += 1, ++numPixels) {}
+    *bottom = y - 1;
+
+    return checkRatios(&counts[0]);
+}
+
+bool verifyVertical(const cv::Mat& bin, int x, int y, int* top, int* bottom)
+{
+    return verifyVertical(x, y, ByteImage(bin), top, bottom);
+}
+
+template <typename Image>
+static bool verifyDiagonal(int center_x, int center_y, const Image& img)
+{
+    int counts[5] = {0, 0, 0, 0, 0};
+    int y, x = center_x, numPixels = 0;
+    for (y = center_y; y >= 0 && x >= 0 && img.black(y, x); --y, --x, counts[2] += 1, ++numPixels) {}
+    for (; y >= 0 && x >= 0 && img.white(y, x); --y, --x, counts[1] += 1, ++numPixels) {}
+    for (; y >= 0 && x >= 0 && img.black(y, x); --y, --x, counts[0] += 1, ++numPixels) {}
+    for (y = center_y + 1, x = center_x + 1; y < img.rows && x < img.cols && img.black(y, x); ++y, ++x, counts[2] += 1, ++numPixels) {}
+    for (; y < img.rows && x < img.cols && img.white(y, x); ++y, ++x, counts[3] += 1, ++numPixels) {}
+    for (; y < img.rows && x < img.cols && img.black(y, x); ++y, ++x, counts[4] += 1, ++numPixels) {}
+
+    return checkRatios(&counts[0]);
+}
+
+// Perspective transform which maps a unit square onto quadrangle
+// (0, 0) -> p[0], (1, 0) -> p[1], (1, 1) -> p[2], (0, 1) -> p[3].
+// It has a closed form so there is no need in a general solver like cv::findHomography.
+// @returns false for degenerate quadrangles.
+static bool squareToQuad(const cv::Point2f p[4], cv::Matx33d& m)
+{
+    const double dx1 = p[1].x - p[2].x, dx2 = p[3].x - p[2].x, dx3 = p[0].x - p[1].x + p[2].x - p[3].x;
+    const double dy1 = p[1].y - p[2].y, dy2 = p[3].y - p[2].y, dy3 = p[0].y - p[1].y + p[2].y - p[3].y;
+    const double den = dx1 * dy2 - dx2 * dy1;
+    if (std::abs(den) < 1e-9)
+        return false;
+
+    const double g = (dx3 * dy2 - dx2 * dy3) / den;
+    const double h = (dx1 * dy3 - dx3 * dy1) / den;
+    m(0, 0) = p[1].x - p[0].x + g * p[1].x;  m(0, 1) = p[3].x - p[0].x + h * p[3].x;  m(0, 2) = p[0].x;
+    m(1, 0) = p[1].y - p[0].y + g * p[1].y;  m(1, 1) = p[3].y - p[0].y + h * p[3].y;  m(1, 2) = p[0].y;
+    m(2, 0) = g;                             m(2, 1) = h;                             m(2, 2) = 1;
+    return true;
+}
+
+// Distance from a marker center to its outer border is 3.5 modules. It is
+// measured along the direction to another marker so doesn't depend on rotation.
+// @returns Module size in pixels or 0 if border is not found.
+template <typename Image>
+static float moduleSize(const Image& img, const cv::Point& from, const cv::Point& to)
+{
+    const cv::Point2f dir = to - from;
+    const float length = std::sqrt(dir.dot(dir));
+    if (length < 1)
+        return 0;
+
+    const cv::Point2f step = dir * (1.0f / length);
+    bool black = true;
+    int changes = 0;
+    for (int i = 1; i < length / 2; ++i)
+    {
+        const int x = cvRound(from.x + step.x * i), y = cvRound(from.y + step.y * i);
+        if (x < 0 || x >= img.cols || y < 0 || y >= img.rows)
+            break;
+        if (img.black(y, x) != black)
+        {
+            black = !black;
+            // Center -> white ring -> black ring -> out of marker.
+            if (++changes == 3)
+                return (i - 0.5f) / 3.5f;
+        }
+    }
+    return 0;
+}
+
+// Version of a code from distance between markers in modules. Centers of
+// markers are 7 modules closer than code size 17 + 4 * version.
+template <typename Image>
+static int estimateVersion(const Image& img, const cv::Point& topLeft, const cv::Point& topRight,
+                           const cv::Point& bottomLeft)
+{
+    const float sizes[] = {moduleSize(img, topLeft, topRight), moduleSize(img, topRight, topLeft),
+                           moduleSize(img, topLeft, bottomLeft), moduleSize(img, bottomLeft, topLeft)};
+    float module = 0;
+    int num = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (sizes[i] > 0)
+        {
+            module += sizes[i];
+            num += 1;
+        }
+    }
+    if (num == 0)
+        return 1;
+    module /= num;
+
+    const cv::Point2f right = topRight - topLeft, down = bottomLeft - topLeft;
+    const float spacing = 0.5f * (std::sqrt(right.dot(right)) + std::sqrt(down.dot(down)));
+    const int version = cvRound((spacing / module - 10) / 4);
+    return std::max(1, std::min(version, (QUIRC_MAX_GRID_SIZE - 17) / 4));
+}
+
+// Sample centers of modules by perspective transform from markers and the
+// fourth corner estimated as a parallelogram one. Markers centers are at the
+// middle of modules 3 and size - 4. Pixels out of image are black.
+// @param[out] cells Bit per module in row-major order, set for black ones.
+template <typename Image>
+static void sampleModules(const Image& img, const cv::Point& topLeft, const cv::Point& topRight,
+                          const cv::Point& bottomLeft, int size, uint8_t* cells)
+{
+    cv::Point2f quad[4];
+    quad[0] = topLeft;
+    quad[1] = topRight;
+    quad[2] = bottomLeft + topRight - topLeft;
+    quad[3] = bottomLeft;
+
+    memset(cells, 0, (size * size + 7) / 8);
+    cv::Matx33d m;
+    if (!squareToQuad(quad, m))
+        return;
+
+    // Transform is linear in u along a row so numerators and denominator are
+    // incremented by a constant step.
+    const double scale = 1.0 / (size - 7);
+    for (int y = 0, p = 0; y < size; ++y)
+    {
+        const double v = (y - 3) * scale, u = -3 * scale;
+        double srcX = m(0, 0) * u + m(0, 1) * v + m(0, 2);
+        double srcY = m(1, 0) * u + m(1, 1) * v + m(1, 2);
+        double w = m(2, 0) * u + m(2, 1) * v + m(2, 2);
+        const double stepX = m(0, 0) * scale, stepY = m(1, 0) * scale, stepW = m(2, 0) * scale;
+        for (int x = 0; x < size; ++x, ++p, srcX += stepX, srcY += stepY, w += stepW)
+        {
+            const int col = cvRound(srcX / w), row = cvRound(srcY / w);
+            const bool black = 0 <= col && col < img.cols && 0 <= row && row < img.rows ?
+                               img.black(row, col) : true;
+            cells[p >> 3] |= (uint8_t)black << (p & 7);
+        }
+    }
+}
+
+// Valid format information before masking: 5 data bits followed by 10 bits
+// of BCH(15, 5) code. Any two codewords differ by at least 7 bits.
+static const uint16_t kFormatCodewords[32] = {
+    0x0000, 0x0537, 0x0A6E, 0x0F59, 0x11EB, 0x14DC, 0x1B85, 0x1EB2,
+    0x23D6, 0x26E1, 0x29B8, 0x2C8F, 0x323D, 0x370A, 0x3853, 0x3D64,
+    0x429B, 0x47AC, 0x48F5, 0x4DC2, 0x5370, 0x5647, 0x591E, 0x5C29,
+    0x614D, 0x647A, 0x6B23, 0x6E14, 0x70A6, 0x7591, 0x7AC8, 0x7FFF
+};
+
+static inline int gridBit(const uint8_t* cells, int size, int x, int y)
+{
+    const int p = y * size + x;
+    return (cells[p >> 3] >> (p & 7)) & 1;
+}
+
+// Unmasked format information. Copy 0 is around the top-left marker, copy 1
+// is split between the other two. Bits are read in the same order as quirc does.
+static int formatBits(const uint8_t* cells, int size, int copy)
+{
+    int format = 0;
+    if (copy)
+    {
+        for (int i = 0; i < 7; ++i)
+            format = (format << 1) | gridBit(cells, size, 8, size - 1 - i);
+        for (int i = 0; i < 8; ++i)
+            format = (format << 1) | gridBit(cells, size, size - 8 + i, 8);
+    }
+    else
+    {
+        static const int xs[15] = {8, 8, 8, 8, 8, 8, 8, 8, 7, 5, 4, 3, 2, 1, 0};
+        static const int ys[15] = {0, 1, 2, 3, 4, 5, 7, 8, 8, 8, 8, 8, 8, 8, 8};
+        for (int i = 14; i >= 0; --i)
+            format = (format << 1) | gridBit(cells, size, xs[i], ys[i]);
+    }
+    return format ^ 0x5412;
+}
+
+bool checkFormat(const uint8_t* cells, int size)
+{
+    for (int copy = 0; copy < 2; ++copy)
+    {
+        const int format = formatBits(cells, size, copy);
+        for (int i = 0; i < 32; ++i)
+        {
+            // At most 3 errors out of 15 bits are corrected.
+            int diff = format ^ kFormatCodewords[i], numErrors = 0;
+            for (; diff && numErrors <= 3; diff &= diff - 1)
+                ++numErrors;
+            if (numErrors <= 3)
+                return true;
+        }
+    }
+    return false;
+}
+
+static void countDecoding(GridDecoding decoding, bool decoded, bool cacheEnabled, QrStats& stats)
+{
+    switch (decoding)
+    {
+    case GRID_REJECTED:
+        QR_COUNT(stats, FORMAT_REJECTS, 1);
+        break;
+    case GRID_CACHED:
+        QR_COUNT(stats, CACHE_HITS, 1);
+        break;
+    case GRID_DECODED:
+        QR_COUNT(stats, CACHE_MISSES, cacheEnabled);
+        QR_COUNT(stats, DECODE_CALLS, 1);
+        QR_COUNT(stats, DECODE_FAILURES, !decoded);
+        break;
+    case GRID_SKIPPED:
+        break;
+    }
+}
+
+// Sample modules of a code and decode them. qCode keeps the modules. Grids
+// with broken format information are rejected without decoding. Grids which
+// have been decoded before are not decoded again, their payloads are taken
+// from the cache.
+template <typename Image>
+static bool decodeCode(const Image& img, const cv::Point& topLeft, const cv::Point& topRight,
+                       const cv::Point& bottomLeft, PayloadCache& cache, quirc_code& qCode,
+                       quirc_data& qData, std::string& payload, GridDecoding& decoding)
+{
+    // 001000000101101100001011011110001101000101110010110111000100110101000
+    // Decoding
+    // 011010000001110110000010001111011000010000001011011000010110111100011
+    qCode.size = 17 + 4 * estimateVersion(img, topLeft, topRight, bottomLeft);
+    sampleModules(img, topLeft, topRight, bottomLeft, qCode.size, qCode.cell_bitmap);
+    payload.clear();
+    decoding = GRID_REJECTED;
+    if (!checkFormat(qCode.cell_bitmap, qCode.size))
+        return false;
+    decoding = GRID_CACHED;
+    if (cache.find(qCode.cell_bitmap, qCode.size, payload))
+        return true;
+    decoding = GRID_DECODED;
+    if (quirc_decode(&qCode, &qData) != 0)
+        return false;
+    payload.assign((const char*)qData.payload, qData.payload_len);
+    cache.insert(qCode.cell_bitmap, qCode.size, payload);
+    return true;
+}
+
+void extract(const cv::Mat& bin, const cv::Point& topLeft, const cv::Point& topRight,
+             const cv::Point& bottomLeft, cv::Mat& modules)
+{
+    const ByteImage img(bin);
+    quirc_code qCode;
+    qCode.size = 17 + 4 * estimateVersion(img, topLeft, topRight, bottomLeft);
+    sampleModules(img, topLeft, topRight, bottomLeft, qCode.size, qCode.cell_bitmap);
+    cellsToMask(qCode, modules);
+}
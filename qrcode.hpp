@@ -1,56 +1,581 @@
-#include <stdint.h>
-#include <vector>
-
-#include <opencv2/opencv.hpp>
-
-// Converts an image with 3 channels to a grayscale image with a single channel.
-// @param[in] src An input image.
-// @param[out] dst Output grayscale image.
-void bgr2gray(const cv::Mat& src, cv::Mat& dst);
-
-// Converts a grayscale image to black-and-white by the following formula:
-// dst(x, y) = src(x, y) > thresh ? 255 : 0
-// @param[in] src An input image.
-// @param[out] dst Output grayscale image.
-// @param[in] thresh An optional threshold value.
-void gray2bin(const cv::Mat& src, cv::Mat& dst, uint8_t thresh = 127);
-
-// Compute number of sequent black or white pixels.
-// @param[in]  row    Pointer to a row of pixels.
-// @param[in]  length Number of elements.
-// @param[out] counts Number of sequent pixels starts from the first black one.
-// @param[out] xs     Indices of the initial pixel in each group.
-void countPixels(const uint8_t* row, int length, std::vector<int>& counts,
-                 std::vector<int>& xs);
-
-// Check if blocks of pixels has ratios 1:1:3:1:1 (black-white-black-white-black)
-// |x|x|x|x|x|x|x|  <- 1          NO
-// |x| | | | | |x|  <- 1:5:1      NO
-// |x| |x|x|x| |x|  <- 1:1:3:1:1  YES
-// |x| |x|x|x| |x|  <- 1:1:3:1:1  YES
-// |x| |x|x|x| |x|  <- 1:1:3:1:1  YES
-// |x| | | | | |x|  <- 1:5:1      NO
-// |x|x|x|x|x|x|x|  <- 1          NO
-// @param[in] counts Pointer to data with at least 5 elements
-bool checkRatios(const int* counts);
-
-// Compute centers which are intersections of separate groups of rectangles.
-// @param[in]  rects   Rectangles
-// @param[out] centers Output intersections
-void computeCenters(const std::vector<cv::Rect>& rects, std::vector<cv::Point>& centers);
-
-// Considering that three points are QR code markers, determine their positions.
-// [topLeft] ...... [topRight]
-// ... . . ... . . .. . . .. .
-// . . . . . . .. . . .. . . .
-// [bottomLeft] .. .  . . ....
-// @param[in] centers Three detected markers
-// @param[out] topLeft    Top-Left marker location
-// @param[out] topRight   Top-Right marker location
-// @param[out] bottomLeft Bottom-Left marker location
-void sortMarkers(const std::vector<cv::Point>& centers, cv::Point& topLeft,
-                 cv::Point& topRight, cv::Point& bottomLeft);
-
-std::string decode(const cv::Mat& bin, cv::Mat& img, cv::Mat& mask);
-
-bool runTests();
+#ifndef QRCODE_HPP
+#define QRCODE_HPP
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Instruction sets of vectorized kernels.
+enum SimdPath
+{
+    SIMD_AUTO,    // The best one available on the current CPU.
+    SIMD_SCALAR,  // Plain C++, always available.
+    SIMD_SSSE3,
+    SIMD_AVX2,
+    SIMD_NEON
+};
+
+// Check if kernels have a code path for an instruction set and the CPU supports it.
+bool hasSimdPath(SimdPath path);
+
+// Black-and-white image packed to 1 bit per pixel, 64 pixels per word.
+// Bit (x % 64) of word (x / 64) in a row is set for a white pixel. Every row
+// starts from a new word, padding bits after the last pixel are zeros.
+struct BitImage
+{
+    BitImage() : rows(0), cols(0), wordsPerRow(0) {}
+
+    // Allocate data if the size is changed.
+    void create(int rows, int cols);
+
+    bool empty() const { return rows == 0 || cols == 0; }
+
+    uint64_t* ptr(int y) { return &data[(size_t)y * wordsPerRow]; }
+    const uint64_t* ptr(int y) const { return &data[(size_t)y * wordsPerRow]; }
+
+    // Returns true for a white pixel.
+    bool get(int y, int x) const { return (ptr(y)[x >> 6] >> (x & 63)) & 1; }
+
+    int rows, cols, wordsPerRow;
+    std::vector<uint64_t> data;
+};
+
+// Converts an image with 3 channels to a grayscale image with a single channel.
+// Alpha of images with 4 channels is skipped.
+// @param[in] src An input image.
+// @param[out] dst Output grayscale image.
+// @param[in] path An optional code path. Use the best one by default.
+void bgr2gray(const cv::Mat& src, cv::Mat& dst, SimdPath path = SIMD_AUTO);
+
+// Converts a grayscale image to black-and-white by the following formula:
+// dst(x, y) = src(x, y) > thresh ? 255 : 0
+// @param[in] src An input image.
+// @param[out] dst Output grayscale image.
+// @param[in] thresh An optional threshold value.
+// @param[in] path An optional code path. Use the best one by default.
+void gray2bin(const cv::Mat& src, cv::Mat& dst, uint8_t thresh = 127,
+              SimdPath path = SIMD_AUTO);
+
+// Converts a grayscale image to packed black-and-white one (see gray2bin).
+void gray2bin(const cv::Mat& src, BitImage& dst, uint8_t thresh = 127,
+              SimdPath path = SIMD_AUTO);
+
+// Converts an image with 3 channels to black-and-white in a single pass.
+// Result is the same as bgr2gray followed by gray2bin but without writing and
+// reading back an intermediate grayscale image.
+// @param[in] src An input image.
+// @param[out] dst Output black-and-white image.
+// @param[in] thresh An optional threshold value.
+// @param[in] path An optional code path. Use the best one by default.
+void bgr2bin(const cv::Mat& src, cv::Mat& dst, uint8_t thresh = 127,
+             SimdPath path = SIMD_AUTO);
+
+// Converts an image with 3 channels to packed black-and-white one in a single pass.
+void bgr2bin(const cv::Mat& src, BitImage& dst, uint8_t thresh = 127,
+             SimdPath path = SIMD_AUTO);
+
+// Converts an image with 4 channels (BGRA) to packed black-and-white one in
+// a single pass. Alpha is ignored.
+void bgra2bin(const cv::Mat& src, BitImage& dst, uint8_t thresh = 127,
+              SimdPath path = SIMD_AUTO);
+
+// Pixel formats of raw frames.
+enum PixelFormat
+{
+    PIXEL_GRAY,  // 8-bit luminance.
+    PIXEL_BGR,
+    PIXEL_BGRA,
+    PIXEL_NV12,  // Y plane followed by interleaved UV plane at half resolution.
+    PIXEL_I420   // Y plane followed by U and V planes at half resolution.
+};
+
+// Non-owning view of a frame in caller's memory. Only the Y plane of YUV
+// formats is read so chroma planes are not needed at all.
+struct ImageView
+{
+    // @param[in] data   The first pixel (of Y plane for YUV formats).
+    // @param[in] width  Width in pixels.
+    // @param[in] height Height in pixels.
+    // @param[in] stride Bytes between rows (of Y plane). 0 for rows without gaps.
+    // @param[in] format Pixel format.
+    ImageView(const void* data, int width, int height, size_t stride, PixelFormat format);
+
+    // Header over pixels which are read: the whole frame for gray, BGR and
+    // BGRA and the Y plane for YUV. Data isn't copied.
+    cv::Mat plane() const;
+
+    const uint8_t* data;
+    int width, height;
+    size_t stride;
+    PixelFormat format;
+};
+
+// Converts a frame of any supported format to packed black-and-white image.
+// Luma of YUV formats is thresholded directly.
+void view2bin(const ImageView& view, BitImage& dst, uint8_t thresh = 127,
+              SimdPath path = SIMD_AUTO);
+
+// Local threshold for uneven lighting: a pixel is white if it's brighter than
+// the mean of a square window around it minus delta. Borders are replicated.
+// Window sums are updated incrementally along rows and columns so the cost per
+// pixel doesn't depend on the window size. The image is split to stripes of
+// rows which are binarized in parallel.
+struct AdaptiveThreshold
+{
+    explicit AdaptiveThreshold(int windowSize = 0, int delta = 10, int numTiles = 0);
+
+    // Side of the window in pixels (odd, up to 2047). It must be wider than
+    // finder patterns, otherwise their centers become white. 0 takes 1/8 of
+    // the smaller side of an image.
+    int windowSize;
+    int delta;
+    // Number of stripes processed in parallel. 0 takes the number of threads.
+    int numTiles;
+};
+
+// Adaptive versions of binarization. Color images are converted to grayscale first.
+void gray2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh,
+              SimdPath path = SIMD_AUTO);
+void gray2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh,
+              SimdPath path = SIMD_AUTO);
+void bgr2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh,
+             SimdPath path = SIMD_AUTO);
+void bgr2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh,
+             SimdPath path = SIMD_AUTO);
+void view2bin(const ImageView& view, BitImage& dst, const AdaptiveThreshold& thresh,
+              SimdPath path = SIMD_AUTO);
+
+// Rows of sums of adaptive binarization and grayscale versions of color
+// frames. Versions above allocate them for every call, the ones below reuse
+// buffers of a caller so frames of the same size don't allocate anything.
+struct AdaptiveBuffers
+{
+    std::vector<int32_t> sums;   // Column and window sums of every stripe.
+    std::vector<uint8_t> bytes;  // Thresholded rows of every stripe before packing.
+    cv::Mat gray;
+};
+
+void gray2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh,
+              AdaptiveBuffers& buffers, SimdPath path = SIMD_AUTO);
+void gray2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh,
+              AdaptiveBuffers& buffers, SimdPath path = SIMD_AUTO);
+void bgr2bin(const cv::Mat& src, cv::Mat& dst, const AdaptiveThreshold& thresh,
+             AdaptiveBuffers& buffers, SimdPath path = SIMD_AUTO);
+void bgr2bin(const cv::Mat& src, BitImage& dst, const AdaptiveThreshold& thresh,
+             AdaptiveBuffers& buffers, SimdPath path = SIMD_AUTO);
+void view2bin(const ImageView& view, BitImage& dst, const AdaptiveThreshold& thresh,
+              AdaptiveBuffers& buffers, SimdPath path = SIMD_AUTO);
+
+// Compute number of sequent black or white pixels.
+// @param[in]  row    Pointer to a row of pixels.
+// @param[in]  length Number of elements.
+// @param[out] counts Number of sequent pixels starts from the first black one.
+// @param[out] xs     Indices of the initial pixel in each group.
+void countPixels(const uint8_t* row, int length, std::vector<int>& counts,
+                 std::vector<int>& xs);
+
+// The same for a row of packed image. Boundaries of groups are found by
+// XOR of neighbour bits and counting trailing zeros so there is no per-pixel loop.
+void countPixels(const uint64_t* row, int length, std::vector<int>& counts,
+                 std::vector<int>& xs);
+
+// Check if blocks of pixels has ratios 1:1:3:1:1 (black-white-black-white-black)
+// |x|x|x|x|x|x|x|  <- 1          NO
+// |x| | | | | |x|  <- 1:5:1      NO
+// |x| |x|x|x| |x|  <- 1:1:3:1:1  YES
+// |x| |x|x|x| |x|  <- 1:1:3:1:1  YES
+// |x| |x|x|x| |x|  <- 1:1:3:1:1  YES
+// |x| | | | | |x|  <- 1:5:1      NO
+// |x|x|x|x|x|x|x|  <- 1          NO
+// @param[in] counts Pointer to data with at least 5 elements
+bool checkRatios(const int* counts);
+
+// The same for all the windows of five groups of a row which start from black
+// groups: window k is counts[2k], ..., counts[2k + 4]. Branchless integer
+// comparisons check four windows at once.
+// @param[in]  counts    Numbers of sequent pixels (see countPixels).
+// @param[in]  numCounts Number of groups.
+// @param[out] mask      Bit (k % 64) of word (k / 64) is set if window k has ratios 1:1:3:1:1.
+void checkRatios(const int* counts, int numCounts, std::vector<uint64_t>& mask);
+
+// Fast check of format information of a sampled grid before Reed-Solomon
+// decoding. Both copies of 15 format bits are compared with all 32 valid BCH
+// codewords. If neither is within 3 errors of a codeword, quirc can't decode
+// the grid either.
+// @param[in] cells Modules packed row by row, bit is set for black (quirc's cell_bitmap).
+// @param[in] size  Side of a grid in modules.
+bool checkFormat(const uint8_t* cells, int size);
+
+// Check that a column of black-and-white image crosses a finder pattern.
+// @param[in]  bin    Black-and-white image.
+// @param[in]  x      Column.
+// @param[in]  y      Row of a pixel at the center of the pattern.
+// @param[out] top    The first row of the pattern.
+// @param[out] bottom The last row of the pattern.
+// @returns true if pixels of the column have ratios 1:1:3:1:1.
+bool verifyVertical(const cv::Mat& bin, int x, int y, int* top, int* bottom);
+
+// Find candidates to finder patterns by scanning rows of black-and-white image.
+// A row produces a candidate if it has 1:1:3:1:1 sequence confirmed by vertical
+// and diagonal checks. Image is split into horizontal stripes which are scanned
+// in parallel. Outputs are in the same order as for a serial top-down scan.
+// @param[in]  bin        Black-and-white image.
+// @param[out] candidates Bounding boxes of candidates.
+// @param[out] rows       Row index at which every candidate has been found.
+// @param[in]  numStripes Number of stripes. 1 means a serial scan. By default
+//                        there are several stripes per thread.
+void findCandidates(const cv::Mat& bin, std::vector<cv::Rect>& candidates,
+                    std::vector<int>& rows, int numStripes = 0);
+
+void findCandidates(const BitImage& bin, std::vector<cv::Rect>& candidates,
+                    std::vector<int>& rows, int numStripes = 0);
+
+// Compute centers which are intersections of separate groups of rectangles.
+// @param[in]  rects   Rectangles
+// @param[out] centers Output intersections
+void computeCenters(const std::vector<cv::Rect>& rects, std::vector<cv::Point>& centers);
+
+// Considering that three points are QR code markers, determine their positions.
+// [topLeft] ...... [topRight]
+// ... . . ... . . .. . . .. .
+// . . . . . . .. . . .. . . .
+// [bottomLeft] .. .  . . ....
+// @param[in] centers Three detected markers
+// @param[out] topLeft    Top-Left marker location
+// @param[out] topRight   Top-Right marker location
+// @param[out] bottomLeft Bottom-Left marker location
+void sortMarkers(const std::vector<cv::Point>& centers, cv::Point& topLeft,
+                 cv::Point& topRight, cv::Point& bottomLeft);
+
+// Merge overlapping regions of coarse search until all of them are disjoint.
+// A merged region may overlap ones which were checked before it.
+// @param[in,out] rois Regions to scan at full resolution.
+void mergeRois(std::vector<cv::Rect>& rois);
+
+// Sample modules of a code by its markers. Version is estimated from
+// distance between markers.
+// @param[in]  bin        Black-and-white image.
+// @param[in]  topLeft    Top-Left marker location
+// @param[in]  topRight   Top-Right marker location
+// @param[in]  bottomLeft Bottom-Left marker location
+// @param[out] modules    Modules of the code. 0 is black, 255 is white.
+void extract(const cv::Mat& bin, const cv::Point& topLeft, const cv::Point& topRight,
+             const cv::Point& bottomLeft, cv::Mat& modules);
+
+// Detected QR code.
+struct QrCode
+{
+    // Decoded message. Empty if decoding failed.
+    std::string payload;
+    // Corners in order: top-left, top-right, bottom-right, bottom-left.
+    cv::Point2f corners[4];
+    // Centers of markers: top-left, top-right, bottom-left.
+    cv::Point2f markers[3];
+    // Version estimated from distance between markers. Code has
+    // 17 + 4 * version modules per side.
+    int version;
+    // Confidence in [0, 1]. Decoded codes have at least 0.5, the rest
+    // depends on how close markers are to an isosceles right triangle.
+    float confidence;
+};
+
+// Counters and timings of a single detection call. They are collected only
+// if the project is built with QRCODE_PROFILING (see CMake option), otherwise
+// all the values stay zeros.
+struct QrStats
+{
+    enum Counter
+    {
+        ROWS_SCANNED,      // Rows scanned, including a coarse search.
+        HORIZONTAL_HITS,   // 1:1:3:1:1 sequences in rows.
+        VERTICAL_REJECTS,  // Hits rejected by a vertical check.
+        DIAGONAL_REJECTS,  // Hits rejected by a diagonal check.
+        CANDIDATES,        // Candidates passed all the checks.
+        CLUSTERS,          // Groups of candidates, i.e. markers.
+        DECODE_CALLS,      // quirc_decode calls.
+        DECODE_FAILURES,   // quirc_decode calls which returned an error.
+        CACHE_HITS,        // Payloads taken from PayloadCache without decoding.
+        CACHE_MISSES,      // Grids which were not in the cache (if it's enabled).
+        FORMAT_REJECTS,    // Grids with broken format information, not decoded.
+        NUM_COUNTERS
+    };
+
+    enum Stage
+    {
+        STAGE_SCAN,    // Rows scanning with vertical and diagonal checks.
+        STAGE_GROUP,   // Grouping of candidates into markers.
+        STAGE_DECODE,  // Markers sorting, modules sampling and decoding.
+        STAGE_TOTAL,   // The whole call.
+        NUM_STAGES
+    };
+
+    QrStats() { reset(); }
+
+    void reset();
+
+    static const char* counterName(int counter);
+    static const char* stageName(int stage);
+
+    int64_t counters[NUM_COUNTERS];
+    int64_t nanoseconds[NUM_STAGES];
+};
+
+// Bounded cache of payloads of decoded modules grids. Codes in video are
+// sampled into the same grids frame after frame so error correction is done
+// only once. Grids are looked up by a hash and compared exactly, the least
+// recently used one is replaced if the cache is full. Entries keep their
+// buffers so a warmed up cache doesn't allocate memory. Thread-safe.
+class PayloadCache
+{
+public:
+    // @param[in] capacity Maximum number of grids. 0 disables the cache.
+    explicit PayloadCache(int capacity = 0);
+
+    // Change the capacity. Cached grids are dropped if it's changed.
+    void setCapacity(int capacity);
+    int capacity() const;
+
+    // Find a payload of a grid.
+    // @param[in]  cells   Modules of a grid packed row by row, bit is set for black.
+    // @param[in]  size    Side of a grid in modules.
+    // @param[out] payload Cached payload. Not changed if the grid is not found.
+    // @returns true if the grid is cached.
+    bool find(const uint8_t* cells, int size, std::string& payload);
+
+    // Add a grid which has been decoded (see find).
+    void insert(const uint8_t* cells, int size, const std::string& payload);
+
+    // Lookups since creation.
+    int64_t hits() const;
+    int64_t misses() const;
+
+private:
+    PayloadCache(const PayloadCache&);
+    PayloadCache& operator=(const PayloadCache&);
+
+    struct Entry
+    {
+        uint64_t hash;
+        uint64_t lastUse;
+        int size;
+        std::vector<uint8_t> cells;
+        std::string payload;
+    };
+
+    // Index of a cached grid or -1.
+    int lookup(uint64_t hash, const uint8_t* cells, int size) const;
+
+    std::vector<Entry> entries;
+    int numEntries;
+    uint64_t clock;
+    int64_t numHits, numMisses;
+    mutable std::mutex mutex;
+};
+
+// Detector of QR codes which keeps intermediate buffers between calls.
+// Buffers only grow so once they fit frames of some size, the following
+// detections don't allocate memory (parallel scan may allocate inside of
+// threading backend, set numStripes to 1 to avoid that). The same instance
+// must not be used from different threads at the same time.
+class QrDetector
+{
+public:
+    // How far detection degraded to stay within Params::budgetMs and
+    // Params::budgetHits. Stages are entered when a part of the budget is spent.
+    enum BudgetStage
+    {
+        BUDGET_OK,              // Less than a half.
+        BUDGET_SKIP_DIAGONAL,   // A half: the rest of hits skip the diagonal check.
+        BUDGET_CAP_CANDIDATES,  // Three quarters: candidates are thinned to maxCandidates before grouping.
+        BUDGET_EXCEEDED         // The whole budget: detection is aborted. detectMulti keeps codes
+                                // decoded before that.
+    };
+
+    struct Params
+    {
+        Params();
+
+        // Number of stripes for parallel rows scan. See findCandidates.
+        int numStripes;
+
+        // How vertical and diagonal checks access pixels.
+        enum Verification
+        {
+            // Walk over pixels of the image (strided reads along columns).
+            VERIFY_WALK,
+            // Build run-length indices of columns and diagonals once per frame
+            // and binary search them. Pays off for frames with lots of candidates.
+            VERIFY_RUN_INDEX
+        };
+        Verification verification;
+
+        // Index only every indexStep-th column and diagonal. Checks snap to the
+        // nearest indexed line so values above 1 trade accuracy for speed.
+        int indexStep;
+
+        // Scale of coarse-to-fine search: 2 or 4 to look for markers at a
+        // downsampled image first and rescan only regions around them at full
+        // resolution. 1 scans the full image. Falls back to the full scan if
+        // the coarse one finds less than three markers.
+        int coarseScale;
+
+        // Tracking mode for video. Only a region around markers of the
+        // previous frame is scanned. The full image is scanned if markers are
+        // lost or after trackingRefresh frames.
+        bool tracking;
+        // Padding of the tracking region relatively to the code size.
+        float trackingPadding;
+        int trackingRefresh;
+
+        // Keep modules of the last code for mask(). Decoding itself reads
+        // packed modules so it's only for debugging.
+        bool debugMask;
+
+        // Binarize frames which the detector receives in color or grayscale
+        // (ImageView, decodeBatch) by adaptiveThreshold instead of a global
+        // threshold. It allocates buffers of the stripes on every frame.
+        bool adaptive;
+        AdaptiveThreshold adaptiveThreshold;
+
+        // Number of payloads kept by PayloadCache. 0 decodes every frame.
+        int cacheSize;
+
+        // Minimal size of modules in pixels for the sparse scan. Only every
+        // 1.5 * minModuleSize-th row is scanned until a row has 1:1:3:1:1
+        // sequence, then rows around it are scanned as well. Smaller codes
+        // may be missed. 0 scans every row (exact mode).
+        int minModuleSize;
+
+        // Budget of a single call for live feeds where a cluttered frame
+        // shouldn't hold the following ones (see BudgetStage). Time is in
+        // milliseconds, work is a number of 1:1:3:1:1 hits in rows (exactly
+        // budgetHits of them are processed). 0 means no limit. Binarization
+        // of ImageView frames isn't included.
+        double budgetMs;
+        int budgetHits;
+        // Number of candidates which are kept for grouping at BUDGET_CAP_CANDIDATES.
+        int maxCandidates;
+    };
+
+    explicit QrDetector(const Params& params = Params());
+    ~QrDetector();
+
+    // Detect and decode a QR code. Nothing is drawn so it's the one for production.
+    // @param[in]  bin  Black-and-white image.
+    // @param[out] code Detected code. Payload is empty if decoding failed.
+    // @returns true if three markers are found.
+    bool detect(const cv::Mat& bin, QrCode& code);
+
+    // The same for packed black-and-white image.
+    bool detect(const BitImage& bin, QrCode& code);
+
+    // The same for a raw frame. It's binarized into an internal buffer.
+    bool detect(const ImageView& view, QrCode& code);
+
+    // Detect and decode a QR code and draw candidates and centers of markers
+    // by drawCandidates and drawCodeMarkers.
+    // @param[in]  bin Black-and-white image.
+    // @param[out] img Image to draw detected markers on. Skipped if empty.
+    // @returns Decoded message or an empty string. Reference is valid until the next call.
+    const std::string& decode(const cv::Mat& bin, cv::Mat& img);
+
+    // The same for packed black-and-white image.
+    const std::string& decode(const BitImage& bin, cv::Mat& img);
+
+    // Detect and decode all the QR codes. Markers are grouped into triplets
+    // which form isosceles right triangles and triplets are decoded in parallel.
+    // Tracking mode is not used.
+    // @param[in] bin Black-and-white image.
+    // @returns Detected codes. Reference is valid until the next call.
+    const std::vector<QrCode>& detectMulti(const cv::Mat& bin);
+
+    // The same for packed black-and-white image.
+    const std::vector<QrCode>& detectMulti(const BitImage& bin);
+
+    // The same for a raw frame. It's binarized into an internal buffer.
+    const std::vector<QrCode>& detectMulti(const ImageView& view);
+
+    // Modules of the last extracted QR code if Params::debugMask is set.
+    // 0 is black, 255 is white.
+    const cv::Mat& mask() const;
+
+    // Finder patterns candidates from the last call.
+    const std::vector<cv::Rect>& candidates() const;
+
+    // Rows at which candidates have been found.
+    const std::vector<int>& candidateRows() const;
+
+    // Counters and timings of the last call.
+    const QrStats& stats() const;
+
+    // Payloads of decoded grids (see Params::cacheSize).
+    const PayloadCache& cache() const;
+
+    // Stage of degradation reached by the last call. detect() returns false
+    // and decode() an empty string if it's BUDGET_EXCEEDED.
+    BudgetStage budgetStage() const;
+
+    Params params;
+
+private:
+    QrDetector(const QrDetector&);
+    QrDetector& operator=(const QrDetector&);
+
+    template <typename Image>
+    bool detectImpl(const Image& bin, QrCode& code);
+
+    template <typename Image>
+    const std::string& decodeImpl(const Image& bin, cv::Mat& img);
+
+    template <typename Image>
+    const std::vector<QrCode>& detectMultiImpl(const Image& bin);
+
+    struct Impl;
+    Impl* impl;
+};
+
+// Called for every image of decodeBatch as soon as it's processed. Calls come
+// from worker threads concurrently and in arbitrary order.
+// @param[in] index Index of an image in the input vector.
+// @param[in] codes Detected codes. Reference is valid only during the call.
+typedef std::function<void(size_t index, const std::vector<QrCode>& codes)> BatchCallback;
+
+// Detect and decode all the codes at many images in parallel. Every worker
+// has its own QrDetector. Workers start with contiguous ranges of images and
+// steal halves of other ranges when they are done so images with lots of
+// candidates don't hold the rest.
+// @param[in]  images     BGR or grayscale images.
+// @param[out] results    Codes of every image in the input order.
+// @param[in]  params     Parameters of detectors. Every image is binarized and scanned by a single thread.
+// @param[in]  numThreads Number of workers. 0 uses all the cores.
+void decodeBatch(const std::vector<cv::Mat>& images, std::vector<std::vector<QrCode> >& results,
+                 const QrDetector::Params& params = QrDetector::Params(), int numThreads = 0);
+
+// The same but results are passed to a callback.
+void decodeBatch(const std::vector<cv::Mat>& images, const BatchCallback& callback,
+                 const QrDetector::Params& params = QrDetector::Params(), int numThreads = 0);
+
+// Debug overlay of detection results. Lines across candidates of finder
+// patterns where they have been found.
+// @param[out] img        BGR image to draw on.
+// @param[in]  candidates Candidates from QrDetector::candidates().
+// @param[in]  rows       Rows from QrDetector::candidateRows().
+void drawCandidates(cv::Mat& img, const std::vector<cv::Rect>& candidates,
+                    const std::vector<int>& rows);
+
+// Centers of markers of a detected code: top-left is magenta, top-right is
+// blue and bottom-left is red.
+void drawCodeMarkers(cv::Mat& img, const QrCode& code);
+
+// Markers, border and payload of a detected code.
+void drawCode(cv::Mat& img, const QrCode& code);
+
+// Detect and decode a QR code by a temporary QrDetector.
+// @param[out] stats Optional counters and timings of the call.
+std::string decode(const cv::Mat& bin, cv::Mat& img, cv::Mat& mask, QrStats* stats = 0);
+
+#endif  // QRCODE_HPP
@@ -0,0 +1,602 @@
+#include "server.hpp"
+
+#include "app.hpp"
+#include "generator.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#ifndef _WIN32
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Larger messages are rejected and their connections are closed.
+static const uint32_t kMaxMessageSize = 256 << 20;
+
+#ifdef MSG_NOSIGNAL
+static const int kSendFlags = MSG_NOSIGNAL;  // Closed peer is an error but not SIGPIPE.
+#else
+static const int kSendFlags = 0;
+#endif
+
+static bool readAll(int fd, void* data, size_t size)
+{
+    uint8_t* ptr = (uint8_t*)data;
+    while (size > 0)
+    {
+        const ssize_t n = recv(fd, ptr, size, 0);
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+    const uint8_t* ptr = (const uint8_t*)data;
+    while (size > 0)
+    {
+        const ssize_t n = send(fd, ptr, size, kSendFlags);
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool readMessage(int fd, std::vector<uint8_t>& body)
+{
+    uint32_t size;
+    if (!readAll(fd, &size, 4))
+        return false;
+    size = ntohl(size);
+    if (size > kMaxMessageSize)
+        return false;
+    body.resize(size);
+    return size == 0 || readAll(fd, &body[0], size);
+}
+
+static bool writeMessage(int fd, const std::string& body)
+{
+    const uint32_t size = htonl((uint32_t)body.size());
+    return writeAll(fd, &size, 4) && writeAll(fd, body.data(), body.size());
+}
+
+// Image of a request. Raw pixels are not copied so the body must outlive it.
+static bool parseRequest(std::vector<uint8_t>& body, cv::Mat& img, std::string& error)
+{
+    const char kind = body.empty() ? 0 : body[0];
+    if (kind == 'E')
+    {
+        // imdecode() asserts on an empty buffer.
+        if (body.size() < 2)
+        {
+            error = "Request is too short";
+            return false;
+        }
+        img = cv::imdecode(cv::Mat(1, (int)body.size() - 1, CV_8UC1, &body[0] + 1), cv::IMREAD_COLOR);
+        if (img.empty())
+            error = "Cannot decode an image";
+        return !img.empty();
+    }
+    if (kind != 'G' && kind != 'B')
+    {
+        error = "Unknown kind of a request";
+        return false;
+    }
+    uint32_t size[2];
+    if (body.size() < 9)
+    {
+        error = "Request is too short";
+        return false;
+    }
+    memcpy(size, &body[1], 8);
+    const uint64_t width = ntohl(size[0]), height = ntohl(size[1]);
+    const int channels = kind == 'G' ? 1 : 3;
+    if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX ||
+        width * height * channels != body.size() - 9)
+    {
+        error = "Size of pixels doesn't match width and height";
+        return false;
+    }
+    img = cv::Mat((int)height, (int)width, channels == 1 ? CV_8UC1 : CV_8UC3, &body[0] + 9);
+    return true;
+}
+
+static std::string errorResponse(const std::string& error)
+{
+    std::ostringstream out;
+    out << "{\"error\": ";
+    writeJsonString(out, error);
+    out << "}";
+    return out.str();
+}
+
+DecodeServer::DecodeServer(const Params& params)
+    : params(params), listenFd(-1), stopped(false), numRequests(0), numBatches(0),
+      nextRequest(0), numPending(0)
+{
+    CV_Assert(params.maxBatch > 0 && params.maxLatencyMs >= 0);
+}
+
+DecodeServer::~DecodeServer()
+{
+    stop();
+}
+
+bool DecodeServer::start(const std::string& socketPath)
+{
+    CV_Assert(listenFd < 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+        return false;
+    unlink(socketPath.c_str());
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+    {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    path = socketPath;
+    stopped = false;
+    int numWorkers = params.numWorkers;
+    if (numWorkers < 1)
+        numWorkers = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < numWorkers; ++i)
+        workers.push_back(std::thread(&DecodeServer::work, this));
+    acceptThread = std::thread(&DecodeServer::accept, this);
+    batchThread = std::thread(&DecodeServer::batch, this);
+    return true;
+}
+
+void DecodeServer::stop()
+{
+    if (listenFd < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopped = true;
+    }
+    queueCondition.notify_all();
+    doneCondition.notify_all();
+    acceptThread.join();
+    batchThread.join();
+    {
+        // The last batch is finished by now. Workers see the flag under their mutex.
+        std::lock_guard<std::mutex> lock(batchMutex);
+    }
+    workCondition.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    workers.clear();
+
+    // Unblock reads of connections and wait until their threads are over.
+    std::unique_lock<std::mutex> lock(connectionsMutex);
+    for (std::set<int>::iterator it = connections.begin(); it != connections.end(); ++it)
+        shutdown(*it, SHUT_RDWR);
+    connectionsCondition.wait(lock, [this] { return connections.empty(); });
+
+    close(listenFd);
+    listenFd = -1;
+    unlink(path.c_str());
+}
+
+void DecodeServer::accept()
+{
+    pollfd listener = {listenFd, POLLIN, 0};
+    while (!stopped)
+    {
+        // Timeout to check the stop flag.
+        if (poll(&listener, 1, 100) <= 0)
+            continue;
+        const int fd = ::accept(listenFd, 0, 0);
+        if (fd < 0)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.insert(fd);
+        }
+        // Connection threads are detached. stop() waits for them by the set of sockets.
+        std::thread(&DecodeServer::serve, this, fd).detach();
+    }
+}
+
+void DecodeServer::serve(int fd)
+{
+    std::vector<uint8_t> body;
+    Request request;
+    while (!stopped && readMessage(fd, body))
+    {
+        std::string error;
+        request.arrival = Clock::now();
+        bool parsed = false;
+        try
+        {
+            parsed = parseRequest(body, request.img, error);
+        }
+        catch (const std::exception& e)
+        {
+            // Corrupt data mustn't take the thread and the process down.
+            error = e.what();
+        }
+        if (parsed)
+            submit(request);
+        else
+            request.response = errorResponse(error);
+        if (!writeMessage(fd, request.response))
+            break;
+    }
+    {
+        // Forget the socket before closing it so stop() never shuts down a reused number.
+        // The server may be gone once the mutex is released, so only the fd is used after.
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(fd);
+        connectionsCondition.notify_all();
+    }
+    close(fd);
+}
+
+void DecodeServer::submit(Request& request)
+{
+    request.done = false;
+    request.queued = true;
+    std::unique_lock<std::mutex> lock(queueMutex);
+    queue.push_back(&request);
+    queueCondition.notify_one();
+    // A request taken by a batch is always finished since the batch uses its image.
+    doneCondition.wait(lock, [&] { return request.done || (stopped && request.queued); });
+    if (!request.done)
+    {
+        queue.erase(std::find(queue.begin(), queue.end(), &request));
+        request.response = errorResponse("Server is stopped");
+    }
+}
+
+void DecodeServer::batch()
+{
+    const Clock::duration maxLatency = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(params.maxLatencyMs));
+    std::vector<Request*> requests;
+    for (;;)
+    {
+        {
+            // Wait for the first request, then for more until the batch is full.
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this] { return !queue.empty() || stopped; });
+            if (stopped)
+                break;
+            const Clock::time_point deadline = queue.front()->arrival + maxLatency;
+            queueCondition.wait_until(lock, deadline, [this]
+            {
+                return (int)queue.size() >= params.maxBatch || stopped;
+            });
+            if (stopped)
+                break;
+            const size_t size = std::min(queue.size(), (size_t)params.maxBatch);
+            requests.assign(queue.begin(), queue.begin() + size);
+            queue.erase(queue.begin(), queue.begin() + size);
+            for (size_t i = 0; i < size; ++i)
+                requests[i]->queued = false;
+        }
+
+        {
+            // Workers take requests one by one, so a slow image doesn't hold others.
+            std::unique_lock<std::mutex> lock(batchMutex);
+            batchRequests.swap(requests);
+            nextRequest = 0;
+            numPending = batchRequests.size();
+            workCondition.notify_all();
+            batchDoneCondition.wait(lock, [this] { return numPending == 0; });
+            batchRequests.swap(requests);
+        }
+
+        {
+            // Counters are updated before clients get responses.
+            std::lock_guard<std::mutex> lock(queueMutex);
+            numRequests += requests.size();
+            numBatches += 1;
+            for (size_t i = 0; i < requests.size(); ++i)
+                requests[i]->done = true;
+        }
+        doneCondition.notify_all();
+    }
+}
+
+void DecodeServer::work()
+{
+    // Images are already processed in parallel so a frame is binarized
+    // and scanned by a single thread.
+    QrDetector::Params workerParams = params.detector;
+    workerParams.numStripes = 1;
+    workerParams.adaptiveThreshold.numTiles = 1;
+    workerParams.tracking = false;
+    QrDetector detector(workerParams);
+    for (;;)
+    {
+        Request* request;
+        size_t batchSize;
+        {
+            std::unique_lock<std::mutex> lock(batchMutex);
+            workCondition.wait(lock, [this] { return nextRequest < batchRequests.size() || stopped; });
+            if (nextRequest >= batchRequests.size())
+                break;
+            request = batchRequests[nextRequest++];
+            batchSize = batchRequests.size();
+        }
+
+        const cv::Mat& img = request->img;
+        try
+        {
+            const ImageView view(img.data, img.cols, img.rows, img.step,
+                                 img.channels() == 1 ? PIXEL_GRAY : PIXEL_BGR);
+            const std::vector<QrCode>& codes = detector.detectMulti(view);
+            const double latency = std::chrono::duration<double, std::milli>(
+                Clock::now() - request->arrival).count();
+            std::ostringstream out;
+            out << "{\"latency_ms\": " << std::fixed << std::setprecision(3) << latency
+                << ", \"batch\": " << batchSize << ", \"codes\": ";
+            writeCodes(out, codes);
+            out << "}";
+            request->response = out.str();
+        }
+        catch (const std::exception& e)
+        {
+            request->response = errorResponse(e.what());
+        }
+
+        std::lock_guard<std::mutex> lock(batchMutex);
+        if (--numPending == 0)
+            batchDoneCondition.notify_one();
+    }
+}
+
+DecodeClient::DecodeClient() : fd(-1) {}
+
+DecodeClient::~DecodeClient()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+bool DecodeClient::connect(const std::string& path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, path.c_str());
+
+    if (fd >= 0)
+        close(fd);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && ::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0)
+        return true;
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    return false;
+}
+
+bool DecodeClient::decode(const cv::Mat& img, std::string& response)
+{
+    CV_Assert(img.type() == CV_8UC1 || img.type() == CV_8UC3);
+    const size_t rowSize = img.cols * img.elemSize();
+    uint8_t header[13];
+    const uint32_t size = htonl((uint32_t)(9 + rowSize * img.rows));
+    const uint32_t width = htonl(img.cols), height = htonl(img.rows);
+    memcpy(header, &size, 4);
+    header[4] = img.channels() == 1 ? 'G' : 'B';
+    memcpy(header + 5, &width, 4);
+    memcpy(header + 9, &height, 4);
+    if (fd < 0 || !writeAll(fd, header, sizeof(header)))
+        return false;
+    // Rows are sent as is without packing into a single buffer.
+    for (int y = 0; y < img.rows; ++y)
+    {
+        if (!writeAll(fd, img.ptr(y), rowSize))
+            return false;
+    }
+    return receive(response);
+}
+
+bool DecodeClient::decodeEncoded(const std::vector<uint8_t>& data, std::string& response)
+{
+    const uint32_t size = htonl((uint32_t)(1 + data.size()));
+    const char kind = 'E';
+    return fd >= 0 && writeAll(fd, &size, 4) && writeAll(fd, &kind, 1) &&
+           (data.empty() || writeAll(fd, &data[0], data.size())) && receive(response);
+}
+
+bool DecodeClient::receive(std::string& response)
+{
+    if (!readMessage(fd, buffer))
+        return false;
+    response.assign(buffer.begin(), buffer.end());
+    return true;
+}
+
+static bool readFile(const std::string& path, std::vector<uint8_t>& data)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+int runServer(const std::string& path, int jobs, int maxBatch, double maxLatencyMs,
+              const QrDetector::Params& detector)
+{
+    // SIGINT and SIGTERM are received by sigwait. Threads inherit the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    DecodeServer::Params params;
+    params.numWorkers = jobs;
+    params.maxBatch = maxBatch;
+    params.maxLatencyMs = maxLatencyMs;
+    params.detector = detector;
+    DecodeServer server(params);
+    if (!server.start(path))
+    {
+        std::cerr << "Cannot listen on " << path << std::endl;
+        return 1;
+    }
+    std::cerr << "Listening on " << path << std::endl;
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+
+    std::cout << "{\"summary\": {\"requests\": " << server.requests() << ", \"batches\": "
+              << server.batches() << std::fixed << std::setprecision(2) << ", \"mean_batch\": "
+              << (server.batches() ? (double)server.requests() / server.batches() : 0.0) << "}}"
+              << std::endl;
+    return 0;
+}
+
+int runClient(const std::string& path, const std::vector<std::string>& inputs)
+{
+    DecodeClient client;
+    if (!client.connect(path))
+    {
+        std::cerr << "Cannot connect to " << path << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> data;
+    std::string response;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (!readFile(inputs[i], data))
+        {
+            std::cerr << "Cannot read " << inputs[i] << std::endl;
+            continue;
+        }
+        if (!client.decodeEncoded(data, response))
+        {
+            std::cerr << "Connection to " << path << " is lost" << std::endl;
+            return 1;
+        }
+        std::cout << "{\"input\": ";
+        writeJsonString(std::cout, inputs[i]);
+        std::cout << ", \"result\": " << response << "}" << std::endl;
+    }
+    return 0;
+}
+
+int runLoad(const std::string& path, const std::string& input, int numClients, int numRequests)
+{
+    // An encoded input or raw pixels of a synthetic frame.
+    std::vector<uint8_t> data;
+    cv::Mat img;
+    if (!input.empty())
+    {
+        if (!readFile(input, data))
+        {
+            std::cerr << "Cannot read " << input << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        cv::Mat modules;
+        encodeQr("LOAD TEST", modules);
+        SyntheticParams synthetic;
+        img.create(480, 640, CV_8UC3);
+        renderQr(modules, synthetic, img);
+    }
+
+    std::atomic<int> nextRequest(0), numErrors(0), numLost(0);
+    std::vector<std::vector<double> > latencies(numClients);
+    std::vector<std::thread> clients;
+    const int64_t start = cv::getTickCount();
+    for (int i = 0; i < numClients; ++i)
+    {
+        clients.push_back(std::thread([&, i]
+        {
+            DecodeClient client;
+            if (!client.connect(path))
+            {
+                numLost += 1;
+                return;
+            }
+            std::string response;
+            while (nextRequest++ < numRequests)
+            {
+                const int64_t sent = cv::getTickCount();
+                const bool ok = data.empty() ? client.decode(img, response)
+                                             : client.decodeEncoded(data, response);
+                if (!ok)
+                {
+                    numLost += 1;
+                    return;
+                }
+                latencies[i].push_back((cv::getTickCount() - sent) * 1e3 / cv::getTickFrequency());
+                numErrors += response.compare(0, 9, "{\"error\":") == 0;
+            }
+        }));
+    }
+    for (size_t i = 0; i < clients.size(); ++i)
+        clients[i].join();
+    const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    // Round trip latencies of all the clients.
+    std::vector<double> all;
+    for (int i = 0; i < numClients; ++i)
+        all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    std::sort(all.begin(), all.end());
+    std::cout << "{\"summary\": {\"clients\": " << numClients << ", \"requests\": " << all.size()
+              << ", \"errors\": " << numErrors << ", \"lost_connections\": " << numLost
+              << std::fixed << std::setprecision(3) << ", \"seconds\": " << seconds
+              << ", \"rps\": " << (seconds > 0 ? all.size() / seconds : 0) << ", \"latency_ms\": ";
+    writePercentiles(std::cout, all);
+    std::cout << "}}" << std::endl;
+    return numLost ? 1 : 0;
+}
+
+#else
+
+int runServer(const std::string&, int, int, double, const QrDetector::Params&)
+{
+    std::cerr << "Server mode requires UNIX domain sockets" << std::endl;
+    return 1;
+}
+
+int runClient(const std::string&, const std::vector<std::string>&)
+{
+    std::cerr << "Client mode requires UNIX domain sockets" << std::endl;
+    return 1;
+}
+
+int runLoad(const std::string&, const std::string&, int, int)
+{
+    std::cerr << "Load generator requires UNIX domain sockets" << std::endl;
+    return 1;
+}
+
+#endif  // _WIN32
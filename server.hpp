@@ -0,0 +1,134 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+// Decoding service over a UNIX domain socket (not available on Windows).
+//
+// Every message is a 32-bit length in network byte order followed by a body.
+// A request body starts with a kind byte:
+//   'E' - an encoded image (PNG, JPEG, ...) follows.
+//   'G' - raw grayscale pixels follow after 32-bit width and height (network
+//         byte order), rows without padding.
+//   'B' - the same for BGR pixels.
+// A response body is a JSON object:
+//   {"latency_ms": 1.5, "batch": 4, "codes": [...]} or {"error": "..."}
+// where latency is measured on the server from receipt of a request and batch
+// is the number of requests decoded together. Requests of a connection are
+// answered in order, one at a time.
+#ifndef _WIN32
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "qrcode.hpp"
+
+// Long-running decoder. Connections are served by their own threads which
+// put requests into a queue. A batching thread takes up to maxBatch requests
+// from it and hands them to workers. The first request of a batch waits for
+// others at most maxLatencyMs, so a single client isn't delayed much and
+// concurrent ones share the workers. Workers live as long as the server and
+// every one owns a QrDetector, so its buffers and payload cache are reused.
+class DecodeServer
+{
+public:
+    struct Params
+    {
+        Params() : numWorkers(0), maxBatch(16), maxLatencyMs(2) {}
+
+        int numWorkers;       // Decoding threads. 0 uses all the cores.
+        int maxBatch;         // Maximal number of requests decoded together.
+        double maxLatencyMs;  // How long the first request of a batch waits for others.
+        QrDetector::Params detector;
+    };
+
+    explicit DecodeServer(const Params& params = Params());
+    ~DecodeServer();
+
+    // Listen on a socket. An existing file at the path is replaced.
+    // @returns false if the socket can't be created.
+    bool start(const std::string& path);
+
+    // Close all the connections and wait for the threads.
+    void stop();
+
+    int64_t requests() const { return numRequests; }
+    int64_t batches() const { return numBatches; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request
+    {
+        cv::Mat img;
+        Clock::time_point arrival;
+        std::string response;
+        bool queued;  // Waits for a batch.
+        bool done;
+    };
+
+    void accept();
+    void serve(int fd);
+    void batch();
+    void work();
+    // Put a request to the queue and wait for its response.
+    void submit(Request& request);
+
+    Params params;
+    std::string path;
+    int listenFd;
+    std::atomic<bool> stopped;
+    std::atomic<int64_t> numRequests, numBatches;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;  // New requests.
+    std::condition_variable doneCondition;   // Finished batches.
+    std::deque<Request*> queue;
+
+    std::mutex batchMutex;
+    std::condition_variable workCondition;       // New batches.
+    std::condition_variable batchDoneCondition;  // All requests of a batch are decoded.
+    std::vector<Request*> batchRequests;         // The batch being decoded.
+    size_t nextRequest, numPending;
+
+    std::mutex connectionsMutex;
+    std::condition_variable connectionsCondition;
+    std::set<int> connections;  // Sockets of served clients.
+
+    std::thread acceptThread, batchThread;
+    std::vector<std::thread> workers;
+};
+
+// Connection to a DecodeServer.
+class DecodeClient
+{
+public:
+    DecodeClient();
+    ~DecodeClient();
+
+    // @returns false if there is no server at the path.
+    bool connect(const std::string& path);
+
+    // Send raw pixels of a grayscale or BGR image and wait for a response.
+    // @returns false if the connection is lost.
+    bool decode(const cv::Mat& img, std::string& response);
+
+    // The same for an encoded image.
+    bool decodeEncoded(const std::vector<uint8_t>& data, std::string& response);
+
+private:
+    bool receive(std::string& response);
+
+    int fd;
+    std::vector<uint8_t> buffer;
+};
+
+#endif  // _WIN32
+#endif  // SERVER_HPP
@@ -1,314 +1,1675 @@
-#include "qrcode.hpp"
-
-#include <iostream>
-
-#define RUN_TEST(name) \
-    std::cout << "run test " << #name << std::endl; \
-    try { \
-        name(); \
-        std::cout << "OK"<< std::endl; \
-    } catch (const std::exception& ex) { \
-        std::cout << ex.what() << std::endl; \
-        std::cout << "FAILED"<< std::endl; \
-        passed = false; \
-    } \
-    std::cout << std::endl;
-
-#define CHECK_EQ(a, b) \
-    if (a != b) { \
-        std::stringstream ss; \
-        ss << __FILE__ << ":" << __LINE__ << " Expects " << #a << " == " << #b << " (" << a << " != " << b << ")"; \
-        CV_Error(cv::Error::StsAssert, ss.str()); \
-    }
-
-void test_bgr2gray()
-{
-    cv::Mat src = (cv::Mat_<cv::Vec3b>(2, 3) <<
-                   cv::Vec3b(91, 2, 79), cv::Vec3b(179, 52, 205), cv::Vec3b(236, 8, 181),
-                   cv::Vec3b(239, 26, 248), cv::Vec3b(207, 218, 45), cv::Vec3b(183, 158, 101));
-    cv::Mat ref = (cv::Mat_<uint8_t>(2, 3) << 35, 112, 86, 117, 165, 144);
-    cv::Mat dst;
-    bgr2gray(src, dst);
-    CHECK_EQ(cv::countNonZero(ref != dst), 0);
-}
-
-void test_gray2bin()
-{
-    cv::Mat src(14, 15, CV_8U);
-    randu(src, 0, 255);
-    cv::Mat dst(src.size(), src.type());
-
-    uint8_t thresh = 127;
-    gray2bin(src, dst);
-    CHECK_EQ(cv::countNonZero((dst > thresh) != dst), 0);
-}
-
-void test_countPixels_1()
-{
-    uint8_t data[] = {255, 255, 0, 255, 0, 0, 255, 255, 255, 0, 0};
-
-    std::vector<int> counts, xs;
-    countPixels(&data[0], sizeof(data), counts, xs);
-
-    int targetCounts[] = {1, 1, 2, 3, 2};
-    int targetXs[] = {2, 3, 4, 6, 9};
-
-    CHECK_EQ(counts.size(), 5);
-    CHECK_EQ(xs.size(), 5);
-    for (int i = 0; i < 5; ++i)
-    {
-        CHECK_EQ(counts[i], targetCounts[i]);
-        CHECK_EQ(xs[i], targetXs[i]);
-    }
-}
-
-void test_countPixels_2()
-{
-    uint8_t data[] = {0, 0, 255, 255, 0, 255, 0, 0, 255, 255, 255, 0, 0};
-
-    std::vector<int> counts, xs;
-    countPixels(&data[0], sizeof(data), counts, xs);
-
-    int targetCounts[] = {2, 2, 1, 1, 2, 3, 2};
-    int targetXs[] = {0, 2, 4, 5, 6, 8, 11};
-
-    CHECK_EQ(counts.size(), 7);
-    CHECK_EQ(xs.size(), 7);
-    for (int i = 0; i < 7; ++i)
-    {
-        CHECK_EQ(counts[i], targetCounts[i]);
-        CHECK_EQ(xs[i], targetXs[i]);
-    }
-}
-
-
-void test_checkRatios()
-{
-    //       ((
-    //      <(0)
-    //  ..    (\)/
-    //  ....  ^ ^
-    {
-        int counts[] = {1, 1, 3, 1, 1};
-        CHECK_EQ(checkRatios(&counts[0]), true);
-    }
-    {
-        int counts[] = {2, 2, 6, 2, 2};
-        CHECK_EQ(checkRatios(&counts[0]), true);
-    }
-    {
-        int counts[] = {3, 3, 10, 2, 3};
-        CHECK_EQ(checkRatios(&counts[0]), true);
-    }
-    {
-        int counts[] = {3, 1, 9, 3, 3};
-        CHECK_EQ(checkRatios(&counts[0]), false);
-    }
-}
-
-void test_computeCenters_simple_1()
-{
-    std::vector<cv::Rect> rects;
-    rects.push_back(cv::Rect(0, 0, 3, 3));
-    rects.push_back(cv::Rect(1, 1, 3, 3));
-
-    std::vector<cv::Point> centers;
-    computeCenters(rects, centers);
-
-    CHECK_EQ(centers.size(), 1);
-    CHECK_EQ(centers[0], cv::Point(2, 2));
-}
-
-void test_computeCenters_simple_2()
-{
-    std::vector<cv::Rect> rects;
-    rects.push_back(cv::Rect(-1, -1, 3, 3));
-
-    std::vector<cv::Point> centers;
-    computeCenters(rects, centers);
-
-    CHECK_EQ(centers.size(), 1);
-    CHECK_EQ(centers[0], cv::Point(0, 0));
-}
-
-void test_computeCenters_hard()
-{
-    std::vector<cv::Rect> rects;
-    //                      left top width height
-    rects.push_back(cv::Rect(393, 185, 30, 30));
-    rects.push_back(cv::Rect(393, 185, 31, 30));
-    rects.push_back(cv::Rect(394, 184, 30, 31));
-    rects.push_back(cv::Rect(395, 184, 30, 31));
-    rects.push_back(cv::Rect(396, 184, 30, 31));
-    rects.push_back(cv::Rect(394, 184, 31, 31));
-    rects.push_back(cv::Rect(395, 184, 31, 31));
-    rects.push_back(cv::Rect(304, 208, 31, 31));
-    rects.push_back(cv::Rect(305, 208, 31, 31));
-    rects.push_back(cv::Rect(306, 208, 31, 31));
-    rects.push_back(cv::Rect(303, 208, 32, 31));
-    rects.push_back(cv::Rect(304, 208, 32, 31));
-    rects.push_back(cv::Rect(305, 208, 32, 31));
-    rects.push_back(cv::Rect(306, 207, 32, 32));
-    rects.push_back(cv::Rect(333, 297, 32, 31));
-    rects.push_back(cv::Rect(334, 296, 32, 32));
-    rects.push_back(cv::Rect(335, 296, 32, 32));
-
-    std::vector<cv::Point> centers;
-    computeCenters(rects, centers);
-
-    CHECK_EQ(centers.size(), 3);
-    CHECK_EQ(centers[0], cv::Point(409, 200));
-    CHECK_EQ(centers[1], cv::Point(320, 223));
-    CHECK_EQ(centers[2], cv::Point(350, 312));
-}
-
-void test_sortMarkers_1()
-{
-    std::vector<cv::Point> centers;
-    //                         x   y
-    centers.push_back(cv::Point(60, 60));
-    centers.push_back(cv::Point(158, 60));
-    centers.push_back(cv::Point(60, 158));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(60, 60));
-    CHECK_EQ(topRight, cv::Point(158, 60));
-    CHECK_EQ(bottomLeft, cv::Point(60, 158));
-}
-
-void test_sortMarkers_2()
-{
-    std::vector<cv::Point> centers;
-    //                            x   y
-    centers.push_back(cv::Point(873, 360));
-    centers.push_back(cv::Point(1347, 564));
-    centers.push_back(cv::Point(663, 815));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(873, 360));
-    CHECK_EQ(topRight, cv::Point(1347, 564));
-    CHECK_EQ(bottomLeft, cv::Point(663, 815));
-}
-
-void test_sortMarkers_3()
-{
-    std::vector<cv::Point> centers;
-    //                            x   y
-    centers.push_back(cv::Point(409, 200));
-    centers.push_back(cv::Point(320, 223));
-    centers.push_back(cv::Point(350, 312));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(320, 223));
-    CHECK_EQ(topRight, cv::Point(409, 200));
-    CHECK_EQ(bottomLeft, cv::Point(350, 312));
-}
-
-void test_sortMarkers_4()
-{
-    std::vector<cv::Point> centers;
-    //                            x   y
-    centers.push_back(cv::Point(331, 226));
-    centers.push_back(cv::Point(290, 309));
-    centers.push_back(cv::Point(376, 346));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(290, 309));
-    CHECK_EQ(topRight, cv::Point(331, 226));
-    CHECK_EQ(bottomLeft, cv::Point(376, 346));
-}
-
-void test_sortMarkers_5()
-{
-    std::vector<cv::Point> centers;
-    //                            x   y
-    centers.push_back(cv::Point(445, 199));
-    centers.push_back(cv::Point(371, 257));
-    centers.push_back(cv::Point(497, 274));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(445, 199));
-    CHECK_EQ(topRight, cv::Point(497, 274));
-    CHECK_EQ(bottomLeft, cv::Point(371, 257));
-}
-
-void test_sortMarkers_6()
-{
-    std::vector<cv::Point> centers;
-    //                            x   y
-    centers.push_back(cv::Point(444, 270));
-    centers.push_back(cv::Point(501, 344));
-    centers.push_back(cv::Point(426, 397));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(501, 344));
-    CHECK_EQ(topRight, cv::Point(426, 397));
-    CHECK_EQ(bottomLeft, cv::Point(444, 270));
-}
-
-void test_sortMarkers_7()
-{
-    std::vector<cv::Point> centers;
-    //                            x   y
-    centers.push_back(cv::Point(308, 339));
-    centers.push_back(cv::Point(434, 338));
-    centers.push_back(cv::Point(371, 406));
-
-    cv::Point topLeft, topRight, bottomLeft;
-    sortMarkers(centers, topLeft, topRight, bottomLeft);
-
-    CHECK_EQ(topLeft, cv::Point(371, 406));
-    CHECK_EQ(topRight, cv::Point(308, 339));
-    CHECK_EQ(bottomLeft, cv::Point(434, 338));
-}
-
-void test_decode()
-{
-#ifdef WIN32
-    cv::Mat img = cv::imread("..\\qrcode.png");
-#else
-    cv::Mat img = cv::imread("../qrcode.png");
-#endif
-    cv::Mat gray, bin, mask;
-
-    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-    cv::threshold(gray, bin, 127, 255, cv::THRESH_BINARY);
-    std::string msg = decode(bin, img, mask);
-
-    CHECK_EQ(msg, "OpenCV");
-}
-
-
-bool runTests()
-{
-    bool passed = true;
-    RUN_TEST(test_bgr2gray);
-    RUN_TEST(test_gray2bin);
-    RUN_TEST(test_countPixels_1);
-    RUN_TEST(test_countPixels_2);
-    RUN_TEST(test_checkRatios);
-    RUN_TEST(test_computeCenters_simple_1);
-    RUN_TEST(test_computeCenters_simple_2);
-    RUN_TEST(test_computeCenters_hard);
-    RUN_TEST(test_sortMarkers_1);
-    RUN_TEST(test_sortMarkers_2);
-    RUN_TEST(test_sortMarkers_3);
-    RUN_TEST(test_sortMarkers_4);
-    RUN_TEST(test_sortMarkers_5);
-    RUN_TEST(test_sortMarkers_6);
-    RUN_TEST(test_sortMarkers_7);
-    RUN_TEST(test_decode);
-    return passed;
-}
+#include "app.hpp"
+#include "generator.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "qrcode.hpp"
+#include "server.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef QRCODE_COUNT_ALLOCATIONS
+// Counting allocator hook: every operator new in the process increments it.
+// It's built into the test executable only, allocations are checked there.
+static std::atomic<int> allocationsCounter(0);
+
+void* operator new(size_t size)
+{
+    allocationsCounter += 1;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+    free(ptr);
+}
+#endif
+
+#define RUN_TEST(name) \
+    std::cout << "run test " << #name << std::endl; \
+    try { \
+        name(); \
+        std::cout << "OK"<< std::endl; \
+    } catch (const std::exception& ex) { \
+        std::cout << ex.what() << std::endl; \
+        std::cout << "FAILED"<< std::endl; \
+        passed = false; \
+    } \
+    std::cout << std::endl;
+
+#define CHECK_EQ(a, b) \
+    if (a != b) { \
+        std::stringstream ss; \
+        ss << __FILE__ << ":" << __LINE__ << " Expects " << #a << " == " << #b << " (" << a << " != " << b << ")"; \
+        CV_Error(cv::Error::StsAssert, ss.str()); \
+    }
+
+void test_bgr2gray()
+{
+    cv::Mat src = (cv::Mat_<cv::Vec3b>(2, 3) <<
+                   cv::Vec3b(91, 2, 79), cv::Vec3b(179, 52, 205), cv::Vec3b(236, 8, 181),
+                   cv::Vec3b(239, 26, 248), cv::Vec3b(207, 218, 45), cv::Vec3b(183, 158, 101));
+    cv::Mat ref = (cv::Mat_<uint8_t>(2, 3) << 35, 112, 86, 117, 165, 144);
+    cv::Mat dst;
+    bgr2gray(src, dst);
+    CHECK_EQ(cv::countNonZero(ref != dst), 0);
+}
+
+void test_gray2bin()
+{
+    cv::Mat src(14, 15, CV_8U);
+    randu(src, 0, 255);
+    cv::Mat dst(src.size(), src.type());
+
+    uint8_t thresh = 127;
+    gray2bin(src, dst);
+    CHECK_EQ(cv::countNonZero((dst > thresh) != dst), 0);
+}
+
+void test_bgr2bin()
+{
+    // Odd width to cover both vectorized body and scalar tail.
+    cv::Mat src(7, 67, CV_8UC3);
+    randu(src, 0, 255);
+
+    const SimdPath paths[] = {SIMD_SCALAR, SIMD_SSSE3, SIMD_AVX2, SIMD_NEON};
+    const uint8_t thresholds[] = {0, 127, 200, 255};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!hasSimdPath(paths[i]))
+            continue;
+        cv::Mat gray, ref, dst;
+        bgr2gray(src, gray, SIMD_SCALAR);
+        for (int j = 0; j < 4; ++j)
+        {
+            gray2bin(gray, ref, thresholds[j], SIMD_SCALAR);
+            bgr2bin(src, dst, thresholds[j], paths[i]);
+            CHECK_EQ(cv::countNonZero(ref != dst), 0);
+
+            gray2bin(gray, dst, thresholds[j], paths[i]);
+            CHECK_EQ(cv::countNonZero(ref != dst), 0);
+        }
+        bgr2gray(src, dst, paths[i]);
+        CHECK_EQ(cv::countNonZero(gray != dst), 0);
+    }
+}
+
+void test_bin_packed()
+{
+    cv::Mat src(5, 131, CV_8UC3), gray, ref;
+    randu(src, 0, 255);
+    bgr2gray(src, gray);
+    gray2bin(gray, ref);
+
+    // The same pixels with a random alpha channel.
+    cv::Mat bgra(src.size(), CV_8UC4);
+    randu(bgra, 0, 255);
+    for (int y = 0; y < src.rows; ++y)
+    {
+        for (int x = 0; x < src.cols; ++x)
+        {
+            for (int c = 0; c < 3; ++c)
+                bgra.ptr<uint8_t>(y)[x * 4 + c] = src.ptr<uint8_t>(y)[x * 3 + c];
+        }
+    }
+
+    const SimdPath paths[] = {SIMD_SCALAR, SIMD_SSSE3, SIMD_AVX2, SIMD_NEON};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!hasSimdPath(paths[i]))
+            continue;
+        BitImage fromGray, fromBgr, fromBgra;
+        gray2bin(gray, fromGray, 127, paths[i]);
+        bgr2bin(src, fromBgr, 127, paths[i]);
+        bgra2bin(bgra, fromBgra, 127, paths[i]);
+        CHECK_EQ(fromGray.wordsPerRow, 3);
+
+        // Grayscale of BGRA pixels is the same so adaptive thresholds are the same too.
+        cv::Mat grayBgra;
+        bgr2gray(bgra, grayBgra, paths[i]);
+        CHECK_EQ(cv::countNonZero(gray != grayBgra), 0);
+        const AdaptiveThreshold thresh(9, 5, 1);
+        AdaptiveBuffers buffers;
+        BitImage adaptiveBgr, adaptiveBgra;
+        view2bin(ImageView(src.data, src.cols, src.rows, src.step, PIXEL_BGR), adaptiveBgr, thresh,
+                 buffers, paths[i]);
+        view2bin(ImageView(bgra.data, bgra.cols, bgra.rows, bgra.step, PIXEL_BGRA), adaptiveBgra,
+                 thresh, buffers, paths[i]);
+
+        for (int y = 0; y < ref.rows; ++y)
+        {
+            for (int x = 0; x < ref.cols; ++x)
+            {
+                bool white = ref.at<uint8_t>(y, x) == 255;
+                CHECK_EQ(fromGray.get(y, x), white);
+                CHECK_EQ(fromBgr.get(y, x), white);
+                CHECK_EQ(fromBgra.get(y, x), white);
+                CHECK_EQ(adaptiveBgra.get(y, x), adaptiveBgr.get(y, x));
+            }
+            // Padding is black.
+            uint64_t grayPadding = fromGray.ptr(y)[2] >> (131 - 128);
+            uint64_t bgrPadding = fromBgr.ptr(y)[2] >> (131 - 128);
+            uint64_t bgraPadding = fromBgra.ptr(y)[2] >> (131 - 128);
+            CHECK_EQ(grayPadding, 0);
+            CHECK_EQ(bgrPadding, 0);
+            CHECK_EQ(bgraPadding, 0);
+        }
+    }
+}
+
+void test_gray2bin_adaptive()
+{
+    // Odd width to cover both vectorized body and scalar tail. Windows of the
+    // first and the last rows and columns cross borders so they are replicated.
+    cv::Mat src(75, 83, CV_8UC1);
+    randu(src, 0, 255);
+    const int windowSize = 9, delta = 5, radius = windowSize / 2;
+
+    cv::Mat ref(src.size(), CV_8UC1);
+    for (int y = 0; y < src.rows; ++y)
+    {
+        for (int x = 0; x < src.cols; ++x)
+        {
+            int sum = 0;
+            for (int dy = -radius; dy <= radius; ++dy)
+            {
+                for (int dx = -radius; dx <= radius; ++dx)
+                {
+                    const int yy = std::max(0, std::min(y + dy, src.rows - 1));
+                    const int xx = std::max(0, std::min(x + dx, src.cols - 1));
+                    sum += src.at<uint8_t>(yy, xx);
+                }
+            }
+            ref.at<uint8_t>(y, x) = (src.at<uint8_t>(y, x) + delta) * windowSize * windowSize > sum ? 255 : 0;
+        }
+    }
+
+    const SimdPath paths[] = {SIMD_SCALAR, SIMD_SSSE3, SIMD_AVX2, SIMD_NEON};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!hasSimdPath(paths[i]))
+            continue;
+        // A single stripe and several ones give the same result. Buffers of
+        // a caller are reused by stripes of all the calls.
+        AdaptiveBuffers buffers;
+        for (int numTiles = 1; numTiles <= 4; numTiles += 3)
+        {
+            const AdaptiveThreshold thresh(windowSize, delta, numTiles);
+            cv::Mat dst, reused;
+            BitImage bits;
+            gray2bin(src, dst, thresh, paths[i]);
+            gray2bin(src, reused, thresh, buffers, paths[i]);
+            gray2bin(src, bits, thresh, buffers, paths[i]);
+            CHECK_EQ(cv::countNonZero(ref != dst), 0);
+            CHECK_EQ(cv::countNonZero(ref != reused), 0);
+            for (int y = 0; y < ref.rows; ++y)
+            {
+                for (int x = 0; x < ref.cols; ++x)
+                {
+                    bool white = ref.at<uint8_t>(y, x) == 255;
+                    CHECK_EQ(bits.get(y, x), white);
+                }
+            }
+        }
+    }
+}
+
+void test_countPixels_1()
+{
+    uint8_t data[] = {255, 255, 0, 255, 0, 0, 255, 255, 255, 0, 0};
+
+    std::vector<int> counts, xs;
+    countPixels(&data[0], sizeof(data), counts, xs);
+
+    int targetCounts[] = {1, 1, 2, 3, 2};
+    int targetXs[] = {2, 3, 4, 6, 9};
+
+    CHECK_EQ(counts.size(), 5);
+    CHECK_EQ(xs.size(), 5);
+    for (int i = 0; i < 5; ++i)
+    {
+        CHECK_EQ(counts[i], targetCounts[i]);
+        CHECK_EQ(xs[i], targetXs[i]);
+    }
+}
+
+void test_countPixels_2()
+{
+    uint8_t data[] = {0, 0, 255, 255, 0, 255, 0, 0, 255, 255, 255, 0, 0};
+
+    std::vector<int> counts, xs;
+    countPixels(&data[0], sizeof(data), counts, xs);
+
+    int targetCounts[] = {2, 2, 1, 1, 2, 3, 2};
+    int targetXs[] = {0, 2, 4, 5, 6, 8, 11};
+
+    CHECK_EQ(counts.size(), 7);
+    CHECK_EQ(xs.size(), 7);
+    for (int i = 0; i < 7; ++i)
+    {
+        CHECK_EQ(counts[i], targetCounts[i]);
+        CHECK_EQ(xs[i], targetXs[i]);
+    }
+}
+
+
+void test_countPixels_packed()
+{
+    cv::Mat row(1, 200, CV_8UC1);
+    for (int i = 0; i < 10; ++i)
+    {
+        // Long runs to cross words boundaries and short ones.
+        for (int x = 0; x < row.cols; )
+        {
+            int len = i % 2 ? cv::theRNG().uniform(1, 100) : cv::theRNG().uniform(1, 4);
+            row.colRange(x, std::min(x + len, row.cols)).setTo(cv::theRNG().uniform(0, 2) * 255);
+            x += len;
+        }
+        BitImage packed;
+        gray2bin(row, packed);
+
+        std::vector<int> counts, xs, refCounts, refXs;
+        countPixels(row.ptr<uint8_t>(), row.cols, refCounts, refXs);
+        countPixels(packed.ptr(0), row.cols, counts, xs);
+        CHECK_EQ(counts.size(), refCounts.size());
+        CHECK_EQ(xs.size(), refXs.size());
+        for (size_t j = 0; j < refCounts.size(); ++j)
+        {
+            CHECK_EQ(counts[j], refCounts[j]);
+            CHECK_EQ(xs[j], refXs[j]);
+        }
+    }
+}
+
+void test_checkRatios()
+{
+    //       ((
+    //      <(0)
+    //  ..    (\)/
+    //  ....  ^ ^
+    {
+        int counts[] = {1, 1, 3, 1, 1};
+        CHECK_EQ(checkRatios(&counts[0]), true);
+    }
+    {
+        int counts[] = {2, 2, 6, 2, 2};
+        CHECK_EQ(checkRatios(&counts[0]), true);
+    }
+    {
+        int counts[] = {3, 3, 10, 2, 3};
+        CHECK_EQ(checkRatios(&counts[0]), true);
+    }
+    {
+        int counts[] = {3, 1, 9, 3, 3};
+        CHECK_EQ(checkRatios(&counts[0]), false);
+    }
+
+    // Windows of a row at once give the same as one by one. Every fifth group
+    // is three times longer so windows which start from it match sometimes.
+    cv::RNG rng(7);
+    int numMatches = 0;
+    for (int numCounts = 0; numCounts < 200; numCounts += 1 + numCounts / 8)
+    {
+        std::vector<int> counts(numCounts);
+        const int module = rng.uniform(1, 20);
+        for (int i = 0; i < numCounts; ++i)
+            counts[i] = std::max(1, (int)(module * (i % 5 == 2 ? 3 : 1) * rng.uniform(0.6, 1.4)));
+        std::vector<uint64_t> mask;
+        checkRatios(counts.data(), numCounts, mask);
+        const int numWindows = numCounts >= 5 ? (numCounts - 3) / 2 : 0;
+        CHECK_EQ(mask.size(), (numWindows + 63) / 64);
+        for (int k = 0; k < numWindows; ++k)
+        {
+            bool match = (mask[k >> 6] >> (k & 63)) & 1;
+            CHECK_EQ(match, checkRatios(&counts[2 * k]));
+            numMatches += match;
+        }
+    }
+    bool someMatch = numMatches > 0;
+    CHECK_EQ(someMatch, true);
+
+    // Central groups at the limits of the 6 * total bound in every lane of a
+    // group of 4 windows.
+    const int boundaries[2][5] = {{2, 2, 12, 2, 2}, {4, 4, 3, 4, 4}};
+    for (int i = 0; i < 2; ++i)
+    {
+        const bool ref = checkRatios(boundaries[i]);
+        CHECK_EQ(ref, (i == 0));
+        for (int k = 0; k < 4; ++k)
+        {
+            std::vector<int> counts(13, 1);
+            std::copy(boundaries[i], boundaries[i] + 5, counts.begin() + 2 * k);
+            std::vector<uint64_t> mask;
+            checkRatios(counts.data(), (int)counts.size(), mask);
+            bool match = (mask[0] >> k) & 1;
+            CHECK_EQ(match, ref);
+        }
+    }
+}
+
+// Draw a finder pattern 7x7 modules with top-left corner at (x, y).
+static void drawFinderPattern(cv::Mat& bin, int x, int y, int module)
+{
+    bin(cv::Rect(x, y, 7 * module, 7 * module)).setTo(0);
+    bin(cv::Rect(x + module, y + module, 5 * module, 5 * module)).setTo(255);
+    bin(cv::Rect(x + 2 * module, y + 2 * module, 3 * module, 3 * module)).setTo(0);
+}
+
+void test_findCandidates_parallel()
+{
+    cv::Mat bin(480, 640, CV_8UC1, cv::Scalar(255));
+    drawFinderPattern(bin, 40, 30, 5);
+    drawFinderPattern(bin, 300, 32, 5);
+    drawFinderPattern(bin, 42, 290, 5);
+    drawFinderPattern(bin, 500, 200, 3);
+    // A pattern crossing boundaries of several stripes.
+    drawFinderPattern(bin, 200, 150, 20);
+
+    std::vector<cv::Rect> ref, candidates;
+    std::vector<int> refRows, rows;
+    findCandidates(bin, ref, refRows, 1);
+    CHECK_EQ(ref.empty(), false);
+
+    const int numStripes[] = {0, 2, 7, 30};
+    for (int i = 0; i < 4; ++i)
+    {
+        findCandidates(bin, candidates, rows, numStripes[i]);
+        CHECK_EQ(candidates.size(), ref.size());
+        CHECK_EQ(rows.size(), ref.size());
+        for (size_t j = 0; j < ref.size(); ++j)
+        {
+            CHECK_EQ(candidates[j], ref[j]);
+            CHECK_EQ(rows[j], refRows[j]);
+        }
+    }
+}
+
+void test_findCandidates_packed()
+{
+    cv::Mat bin(300, 250, CV_8UC1, cv::Scalar(255));
+    drawFinderPattern(bin, 10, 10, 4);
+    drawFinderPattern(bin, 150, 12, 4);
+    drawFinderPattern(bin, 60, 200, 9);
+    BitImage packed;
+    gray2bin(bin, packed);
+
+    std::vector<cv::Rect> ref, candidates;
+    std::vector<int> refRows, rows;
+    findCandidates(bin, ref, refRows);
+    findCandidates(packed, candidates, rows);
+    CHECK_EQ(ref.empty(), false);
+    CHECK_EQ(candidates.size(), ref.size());
+    for (size_t i = 0; i < ref.size(); ++i)
+    {
+        CHECK_EQ(candidates[i], ref[i]);
+        CHECK_EQ(rows[i], refRows[i]);
+    }
+}
+
+void test_findCandidates_run_index()
+{
+    cv::Mat bin(240, 330, CV_8UC1, cv::Scalar(255));
+    for (int i = 0; i < 100; ++i)
+    {
+        int size = cv::theRNG().uniform(1, 12);
+        cv::Rect block(cv::theRNG().uniform(0, bin.cols - size), cv::theRNG().uniform(0, bin.rows - size), size, size);
+        bin(block).setTo(0);
+    }
+    drawFinderPattern(bin, 0, 0, 3);
+    drawFinderPattern(bin, 120, 20, 4);
+    drawFinderPattern(bin, 20, 160, 5);
+    drawFinderPattern(bin, 330 - 7 * 6, 240 - 7 * 6, 6);
+    BitImage packed;
+    gray2bin(bin, packed);
+
+    QrDetector::Params params;
+    params.numStripes = 1;
+    QrDetector walk(params);
+    params.verification = QrDetector::Params::VERIFY_RUN_INDEX;
+    QrDetector index(params);
+    cv::Mat img;
+
+    walk.decode(bin, img);
+    const std::vector<cv::Rect> ref = walk.candidates();
+    CHECK_EQ(ref.empty(), false);
+    for (int i = 0; i < 2; ++i)
+    {
+        if (i == 0)
+            index.decode(bin, img);
+        else
+            index.decode(packed, img);
+        CHECK_EQ(index.candidates().size(), ref.size());
+        for (size_t j = 0; j < ref.size(); ++j)
+            CHECK_EQ(index.candidates()[j], ref[j]);
+    }
+}
+
+void test_QrDetector_coarse()
+{
+    const int modules[] = {8, 2};
+    for (int i = 0; i < 2; ++i)
+    {
+        // Small markers are missed by a coarse search so the full scan is used.
+        const int module = modules[i];
+        cv::Mat bin(720, 960, CV_8UC1, cv::Scalar(255));
+        drawFinderPattern(bin, 300, 200, module);
+        drawFinderPattern(bin, 300 + 20 * module, 203, module);
+        drawFinderPattern(bin, 298, 200 + 20 * module, module);
+        BitImage packed;
+        gray2bin(bin, packed);
+
+        QrDetector::Params params;
+        params.numStripes = 1;
+        QrDetector full(params);
+        params.coarseScale = 4;
+        QrDetector coarse(params);
+        cv::Mat img;
+
+        full.decode(bin, img);
+        const std::vector<cv::Rect> ref = full.candidates();
+        CHECK_EQ(ref.empty(), false);
+        for (int j = 0; j < 2; ++j)
+        {
+            if (j == 0)
+                coarse.decode(bin, img);
+            else
+                coarse.decode(packed, img);
+            CHECK_EQ(coarse.candidates().size(), ref.size());
+            for (size_t k = 0; k < ref.size(); ++k)
+                CHECK_EQ(coarse.candidates()[k], ref[k]);
+        }
+    }
+}
+
+static cv::Mat drawMarkers(int x, int y, int module)
+{
+    cv::Mat bin(480, 640, CV_8UC1, cv::Scalar(255));
+    drawFinderPattern(bin, x, y, module);
+    drawFinderPattern(bin, x + 20 * module, y, module);
+    drawFinderPattern(bin, x, y + 20 * module, module);
+    return bin;
+}
+
+void test_QrDetector_tracking()
+{
+    QrDetector::Params params;
+    params.numStripes = 1;
+    params.debugMask = true;
+    params.tracking = true;
+    params.trackingRefresh = 3;
+    QrDetector detector(params);
+    cv::Mat img;
+
+    detector.decode(drawMarkers(100, 100, 5), img);
+    CHECK_EQ(detector.mask().empty(), false);
+
+    // A marker far from the code is out of tracking region till a periodic full scan.
+    cv::Mat bin = drawMarkers(104, 98, 5);
+    drawFinderPattern(bin, 550, 400, 5);
+    for (int i = 0; i < 4; ++i)
+    {
+        detector.decode(bin, img);
+        bool tracked = true;
+        for (size_t j = 0; j < detector.candidates().size(); ++j)
+            tracked = tracked && detector.candidates()[j].x < 500;
+        bool expected = i < 3;
+        CHECK_EQ(tracked, expected);
+    }
+
+    // Lost markers are found by a full scan.
+    detector.decode(drawMarkers(100, 100, 5), img);
+    detector.decode(drawMarkers(400, 200, 4), img);
+    bool found = !detector.candidates().empty() && detector.candidates()[0].x >= 400;
+    CHECK_EQ(found, true);
+}
+
+void test_QrDetector_detectMulti()
+{
+    cv::Mat bin(480, 640, CV_8UC1, cv::Scalar(255));
+    const int xs[] = {40, 380}, ys[] = {60, 200}, module = 6;
+    for (int i = 0; i < 2; ++i)
+    {
+        drawFinderPattern(bin, xs[i], ys[i], module);
+        drawFinderPattern(bin, xs[i] + 14 * module, ys[i], module);
+        drawFinderPattern(bin, xs[i], ys[i] + 14 * module, module);
+    }
+    // A marker without a pair.
+    drawFinderPattern(bin, 250, 400, 5);
+
+    QrDetector detector;
+    const std::vector<QrCode>& codes = detector.detectMulti(bin);
+    CHECK_EQ(codes.size(), 2);
+    for (int i = 0; i < 2; ++i)
+    {
+        // Codes may come in any order.
+        const QrCode& code = codes[codes[0].corners[0].x < 200 ? i : 1 - i];
+        CHECK_EQ(code.version, 1);
+        const cv::Point2f corners[] = {cv::Point2f(xs[i], ys[i]),
+                                       cv::Point2f(xs[i] + 21 * module, ys[i]),
+                                       cv::Point2f(xs[i] + 21 * module, ys[i] + 21 * module),
+                                       cv::Point2f(xs[i], ys[i] + 21 * module)};
+        for (int j = 0; j < 4; ++j)
+        {
+            cv::Point2f diff = code.corners[j] - corners[j];
+            bool close = std::abs(diff.x) <= 2 && std::abs(diff.y) <= 2;
+            CHECK_EQ(close, true);
+        }
+    }
+}
+
+void test_QrDetector_detectMulti_grid()
+{
+    // Identical codes on a regular grid. Gaps of 5 modules make top-left markers
+    // of neighbour codes as far as markers of a code of version 4.
+    const int module = 4, size = 21 * module, gaps[] = {5, 8};
+    for (int g = 0; g < 2; ++g)
+    {
+        cv::Mat bin(480, 640, CV_8UC1, cv::Scalar(255));
+        const int pitch = size + gaps[g] * module, origin = 40;
+        for (int i = 0; i < 4; ++i)
+        {
+            const int x = origin + i % 2 * pitch, y = origin + i / 2 * pitch;
+            drawFinderPattern(bin, x, y, module);
+            drawFinderPattern(bin, x + 14 * module, y, module);
+            drawFinderPattern(bin, x, y + 14 * module, module);
+        }
+
+        QrDetector detector;
+        const std::vector<QrCode>& codes = detector.detectMulti(bin);
+        CHECK_EQ(codes.size(), 4);
+        int cells = 0;
+        for (size_t i = 0; i < codes.size(); ++i)
+        {
+            CHECK_EQ(codes[i].version, 1);
+            // Every code is in its own cell of the grid.
+            const cv::Point2f offset = codes[i].corners[0] - cv::Point2f(origin, origin);
+            const int col = cvRound(offset.x / pitch), row = cvRound(offset.y / pitch);
+            const cv::Point2f diff = offset - cv::Point2f(col * pitch, row * pitch);
+            const bool close = std::abs(diff.x) <= 2 && std::abs(diff.y) <= 2 &&
+                               col >= 0 && col < 2 && row >= 0 && row < 2;
+            CHECK_EQ(close, true);
+            cells |= 1 << (row * 2 + col);
+            const cv::Point2f side = codes[i].corners[2] - codes[i].corners[0];
+            const bool square = std::abs(side.x - size) <= 2 && std::abs(side.y - size) <= 2;
+            CHECK_EQ(square, true);
+        }
+        CHECK_EQ(cells, 15);
+    }
+}
+
+void test_sampleModules()
+{
+    for (int version = 1; version <= 4; ++version)
+    {
+        // Finder patterns at three corners and a pattern of modules which
+        // has no 1:1:3:1:1 groups (random modules may form extra markers).
+        const int size = 17 + 4 * version, module = 5, border = 20;
+        cv::Mat modules(size, size, CV_8UC1);
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+                modules.at<uint8_t>(y, x) = (x * (y + 1)) % 3 ? 255 : 0;
+        }
+        drawFinderPattern(modules, 0, 0, 1);
+        drawFinderPattern(modules, size - 7, 0, 1);
+        drawFinderPattern(modules, 0, size - 7, 1);
+        // Separators.
+        modules(cv::Rect(7, 0, 1, 8)).setTo(255);
+        modules(cv::Rect(0, 7, 8, 1)).setTo(255);
+        modules(cv::Rect(size - 8, 0, 1, 8)).setTo(255);
+        modules(cv::Rect(size - 8, 7, 8, 1)).setTo(255);
+        modules(cv::Rect(7, size - 8, 1, 8)).setTo(255);
+        modules(cv::Rect(0, size - 8, 8, 1)).setTo(255);
+
+        cv::Mat bin(size * module + 2 * border, size * module + 2 * border, CV_8UC1, cv::Scalar(255));
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+                bin(cv::Rect(border + x * module, border + y * module, module, module)).setTo(modules.at<uint8_t>(y, x));
+        }
+
+        cv::Mat img, mask;
+        decode(bin, img, mask);
+        CHECK_EQ(mask.rows, size);
+        CHECK_EQ(mask.cols, size);
+        int numDiffs = 0;
+        for (int y = 0; y < size && mask.rows == size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+                numDiffs += mask.at<uint8_t>(y, x) != modules.at<uint8_t>(y, x);
+        }
+        CHECK_EQ(numDiffs, 0);
+    }
+}
+
+void test_computeCenters_simple_1()
+{
+    std::vector<cv::Rect> rects;
+    rects.push_back(cv::Rect(0, 0, 3, 3));
+    rects.push_back(cv::Rect(1, 1, 3, 3));
+
+    std::vector<cv::Point> centers;
+    computeCenters(rects, centers);
+
+    CHECK_EQ(centers.size(), 1);
+    CHECK_EQ(centers[0], cv::Point(2, 2));
+}
+
+void test_computeCenters_simple_2()
+{
+    std::vector<cv::Rect> rects;
+    rects.push_back(cv::Rect(-1, -1, 3, 3));
+
+    std::vector<cv::Point> centers;
+    computeCenters(rects, centers);
+
+    CHECK_EQ(centers.size(), 1);
+    CHECK_EQ(centers[0], cv::Point(0, 0));
+}
+
+void test_computeCenters_hard()
+{
+    std::vector<cv::Rect> rects;
+    //                      left top width height
+    rects.push_back(cv::Rect(393, 185, 30, 30));
+    rects.push_back(cv::Rect(393, 185, 31, 30));
+    rects.push_back(cv::Rect(394, 184, 30, 31));
+    rects.push_back(cv::Rect(395, 184, 30, 31));
+    rects.push_back(cv::Rect(396, 184, 30, 31));
+    rects.push_back(cv::Rect(394, 184, 31, 31));
+    rects.push_back(cv::Rect(395, 184, 31, 31));
+    rects.push_back(cv::Rect(304, 208, 31, 31));
+    rects.push_back(cv::Rect(305, 208, 31, 31));
+    rects.push_back(cv::Rect(306, 208, 31, 31));
+    rects.push_back(cv::Rect(303, 208, 32, 31));
+    rects.push_back(cv::Rect(304, 208, 32, 31));
+    rects.push_back(cv::Rect(305, 208, 32, 31));
+    rects.push_back(cv::Rect(306, 207, 32, 32));
+    rects.push_back(cv::Rect(333, 297, 32, 31));
+    rects.push_back(cv::Rect(334, 296, 32, 32));
+    rects.push_back(cv::Rect(335, 296, 32, 32));
+
+    std::vector<cv::Point> centers;
+    computeCenters(rects, centers);
+
+    CHECK_EQ(centers.size(), 3);
+    CHECK_EQ(centers[0], cv::Point(409, 200));
+    CHECK_EQ(centers[1], cv::Point(320, 223));
+    CHECK_EQ(centers[2], cv::Point(350, 312));
+}
+
+// Pairwise grouping of candidates as a reference.
+static void computeCentersNaive(const std::vector<cv::Rect>& rects, std::vector<cv::Point>& centers)
+{
+    std::vector<cv::Rect> groups;
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        size_t j = 0;
+        for (; j < groups.size() && (groups[j] & rects[i]).area() == 0; ++j) {}
+        if (j < groups.size())
+            groups[j] &= rects[i];
+        else
+            groups.push_back(rects[i]);
+    }
+    centers.resize(groups.size());
+    for (size_t i = 0; i < groups.size(); ++i)
+        centers[i] = cv::Point(groups[i].x + groups[i].width / 2, groups[i].y + groups[i].height / 2);
+}
+
+void test_computeCenters_random()
+{
+    cv::RNG rng(7);
+    for (int iter = 0; iter < 20; ++iter)
+    {
+        // Clusters of jittered rectangles of different sizes and some noise.
+        std::vector<cv::Rect> rects;
+        const int numClusters = rng.uniform(1, 50);
+        for (int i = 0; i < numClusters; ++i)
+        {
+            const int size = rng.uniform(3, 60), x = rng.uniform(-20, 600), y = rng.uniform(-20, 400);
+            for (int j = rng.uniform(1, 30); j > 0; --j)
+                rects.push_back(cv::Rect(x + rng.uniform(-3, 4), y + rng.uniform(-3, 4),
+                                         size + rng.uniform(-2, 3), size + rng.uniform(-2, 3)));
+        }
+        for (int i = rng.uniform(0, 100); i > 0; --i)
+            rects.push_back(cv::Rect(rng.uniform(0, 640), rng.uniform(0, 480), rng.uniform(0, 200), rng.uniform(0, 20)));
+        for (int i = (int)rects.size() - 1; i > 0; --i)
+            std::swap(rects[i], rects[rng.uniform(0, i + 1)]);
+
+        std::vector<cv::Point> ref, centers;
+        computeCentersNaive(rects, ref);
+        computeCenters(rects, centers);
+        CHECK_EQ(centers.size(), ref.size());
+        for (size_t i = 0; i < ref.size(); ++i)
+            CHECK_EQ(centers[i], ref[i]);
+    }
+}
+
+void test_mergeRois()
+{
+    // The first region overlaps neither of the others but their union.
+    std::vector<cv::Rect> rois;
+    rois.push_back(cv::Rect(0, 0, 10, 10));
+    rois.push_back(cv::Rect(20, 0, 10, 30));
+    rois.push_back(cv::Rect(0, 25, 25, 10));
+    rois.push_back(cv::Rect(50, 50, 5, 5));
+    mergeRois(rois);
+    CHECK_EQ(rois.size(), 2);
+    CHECK_EQ(rois[0], cv::Rect(0, 0, 30, 35));
+    CHECK_EQ(rois[1], cv::Rect(50, 50, 5, 5));
+}
+
+void test_sortMarkers_1()
+{
+    std::vector<cv::Point> centers;
+    //                         x   y
+    centers.push_back(cv::Point(60, 60));
+    centers.push_back(cv::Point(158, 60));
+    centers.push_back(cv::Point(60, 158));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(60, 60));
+    CHECK_EQ(topRight, cv::Point(158, 60));
+    CHECK_EQ(bottomLeft, cv::Point(60, 158));
+}
+
+void test_sortMarkers_2()
+{
+    std::vector<cv::Point> centers;
+    //                            x   y
+    centers.push_back(cv::Point(873, 360));
+    centers.push_back(cv::Point(1347, 564));
+    centers.push_back(cv::Point(663, 815));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(873, 360));
+    CHECK_EQ(topRight, cv::Point(1347, 564));
+    CHECK_EQ(bottomLeft, cv::Point(663, 815));
+}
+
+void test_sortMarkers_3()
+{
+    std::vector<cv::Point> centers;
+    //                            x   y
+    centers.push_back(cv::Point(409, 200));
+    centers.push_back(cv::Point(320, 223));
+    centers.push_back(cv::Point(350, 312));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(320, 223));
+    CHECK_EQ(topRight, cv::Point(409, 200));
+    CHECK_EQ(bottomLeft, cv::Point(350, 312));
+}
+
+void test_sortMarkers_4()
+{
+    std::vector<cv::Point> centers;
+    //                            x   y
+    centers.push_back(cv::Point(331, 226));
+    centers.push_back(cv::Point(290, 309));
+    centers.push_back(cv::Point(376, 346));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(290, 309));
+    CHECK_EQ(topRight, cv::Point(331, 226));
+    CHECK_EQ(bottomLeft, cv::Point(376, 346));
+}
+
+void test_sortMarkers_5()
+{
+    std::vector<cv::Point> centers;
+    //                            x   y
+    centers.push_back(cv::Point(445, 199));
+    centers.push_back(cv::Point(371, 257));
+    centers.push_back(cv::Point(497, 274));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(445, 199));
+    CHECK_EQ(topRight, cv::Point(497, 274));
+    CHECK_EQ(bottomLeft, cv::Point(371, 257));
+}
+
+void test_sortMarkers_6()
+{
+    std::vector<cv::Point> centers;
+    //                            x   y
+    centers.push_back(cv::Point(444, 270));
+    centers.push_back(cv::Point(501, 344));
+    centers.push_back(cv::Point(426, 397));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(501, 344));
+    CHECK_EQ(topRight, cv::Point(426, 397));
+    CHECK_EQ(bottomLeft, cv::Point(444, 270));
+}
+
+void test_sortMarkers_7()
+{
+    std::vector<cv::Point> centers;
+    //                            x   y
+    centers.push_back(cv::Point(308, 339));
+    centers.push_back(cv::Point(434, 338));
+    centers.push_back(cv::Point(371, 406));
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+
+    CHECK_EQ(topLeft, cv::Point(371, 406));
+    CHECK_EQ(topRight, cv::Point(308, 339));
+    CHECK_EQ(bottomLeft, cv::Point(434, 338));
+}
+
+void test_decode()
+{
+#ifdef WIN32
+    cv::Mat img = cv::imread("..\\qrcode.png");
+#else
+    cv::Mat img = cv::imread("../qrcode.png");
+#endif
+    cv::Mat gray, bin, mask;
+
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    cv::threshold(gray, bin, 127, 255, cv::THRESH_BINARY);
+    std::string msg = decode(bin, img, mask);
+
+    CHECK_EQ(msg, "OpenCV");
+}
+
+// Example of version 1-M code with "HELLO WORLD" message.
+void test_qrErrorCorrection()
+{
+    const uint8_t data[] = {32, 91, 11, 120, 209, 114, 220, 77, 67, 64, 236, 17, 236, 17, 236, 17};
+    const uint8_t ref[] = {196, 35, 39, 119, 235, 215, 231, 226, 93, 23};
+    std::vector<uint8_t> ec;
+    qrErrorCorrection(std::vector<uint8_t>(data, data + 16), 10, ec);
+    CHECK_EQ(ec.size(), 10);
+    for (int i = 0; i < 10; ++i)
+        CHECK_EQ((int)ec[i], (int)ref[i]);
+
+    // Level L with mask pattern 0.
+    CHECK_EQ(qrFormatBits(1, 0), 0x77C4);
+}
+
+// Pack modules as quirc's cell_bitmap.
+static void packCells(const cv::Mat& modules, std::vector<uint8_t>& cells)
+{
+    cells.assign((modules.total() + 7) / 8, 0);
+    for (int p = 0; p < (int)modules.total(); ++p)
+    {
+        if (modules.at<uint8_t>(p / modules.cols, p % modules.cols) == 0)
+            cells[p >> 3] |= 1 << (p & 7);
+    }
+}
+
+void test_checkFormat()
+{
+    cv::Mat modules;
+    std::vector<uint8_t> cells;
+    encodeQr("format", modules);
+    const int size = modules.cols;
+    packCells(modules, cells);
+    CHECK_EQ(checkFormat(&cells[0], size), true);
+
+    // Three errors in the first copy are corrected.
+    for (int y = 0; y < 3; ++y)
+        modules.at<uint8_t>(y, 8) ^= 255;
+    packCells(modules, cells);
+    CHECK_EQ(checkFormat(&cells[0], size), true);
+
+    // Four errors are not. The second copy is still valid.
+    modules.at<uint8_t>(3, 8) ^= 255;
+    packCells(modules, cells);
+    CHECK_EQ(checkFormat(&cells[0], size), true);
+
+    // Both copies are broken.
+    for (int x = size - 4; x < size; ++x)
+        modules.at<uint8_t>(8, x) ^= 255;
+    packCells(modules, cells);
+    CHECK_EQ(checkFormat(&cells[0], size), false);
+}
+
+// Synthetic code under small rotation, perspective, blur and noise.
+static void renderSynthetic(const std::string& msg, cv::Mat& modules, cv::Mat& bin,
+                            cv::Point2f corners[4] = 0)
+{
+    encodeQr(msg, modules);
+    SyntheticParams params;
+    params.moduleSize = 8;
+    params.angle = 7;
+    params.perspective = 0.02f;
+    params.noise = 10;
+    params.blur = 3;
+    cv::Mat img(480, 640, CV_8UC3), gray;
+    renderQr(modules, params, img, corners);
+    bgr2gray(img, gray);
+    gray2bin(gray, bin);
+}
+
+void test_extract_synthetic()
+{
+    cv::Mat modules, bin, extracted;
+    renderSynthetic("synthetic", modules, bin);
+
+    std::vector<cv::Rect> candidates;
+    std::vector<int> rows;
+    std::vector<cv::Point> centers;
+    findCandidates(bin, candidates, rows);
+    computeCenters(candidates, centers);
+    CHECK_EQ(centers.size(), 3);
+
+    cv::Point topLeft, topRight, bottomLeft;
+    sortMarkers(centers, topLeft, topRight, bottomLeft);
+    extract(bin, topLeft, topRight, bottomLeft, extracted);
+    CHECK_EQ(extracted.rows, 21);
+    CHECK_EQ(cv::countNonZero(extracted != modules), 0);
+}
+
+void test_decode_synthetic()
+{
+    cv::Mat modules, bin, img, mask;
+    renderSynthetic("synthetic", modules, bin);
+    CHECK_EQ(decode(bin, img, mask), "synthetic");
+}
+
+void test_QrDetector_detect()
+{
+    cv::Mat modules, bin;
+    cv::Point2f corners[4];
+    renderSynthetic("synthetic", modules, bin, corners);
+
+    QrDetector detector;
+    QrCode code;
+    CHECK_EQ(detector.detect(bin, code), true);
+    CHECK_EQ(code.payload, "synthetic");
+    CHECK_EQ(code.version, 1);
+    for (int i = 0; i < 4; ++i)
+    {
+        // Corners are estimated from markers centers so they are within a module.
+        const bool near = cv::norm(code.corners[i] - corners[i]) < 8;
+        CHECK_EQ(near, true);
+    }
+    // Markers are close to an isosceles right triangle. Decoding adds 0.5.
+    const bool confident = code.confidence > 0.9f;
+    CHECK_EQ(confident, true);
+
+    // The legacy overlay has candidates and centers of markers but neither
+    // a border nor a payload.
+    cv::Mat img(bin.size(), CV_8UC3, cv::Scalar(0, 0, 0));
+    CHECK_EQ(detector.decode(bin, img), "synthetic");
+    int numYellow = 0;
+    for (int y = 0; y < img.rows; ++y)
+    {
+        for (int x = 0; x < img.cols; ++x)
+        {
+            const cv::Vec3b& p = img.at<cv::Vec3b>(y, x);
+            numYellow += p[0] == 0 && p[1] == 255 && p[2] == 255;
+        }
+    }
+    CHECK_EQ(numYellow, 0);
+
+    // Nothing is found at an empty image.
+    cv::Mat empty(bin.size(), CV_8UC1, cv::Scalar(255));
+    CHECK_EQ(detector.detect(empty, code), false);
+    CHECK_EQ(code.payload, "");
+}
+
+void test_QrDetector_sparse()
+{
+    cv::Mat modules, bin;
+    cv::Point2f corners[4];
+    renderSynthetic("sparse", modules, bin, corners);
+
+    QrDetector exact;
+    QrCode ref, code;
+    CHECK_EQ(exact.detect(bin, ref), true);
+
+    // Modules are 8 pixels so markers are found with a step of 6 rows.
+    QrDetector::Params params;
+    params.minModuleSize = 4;
+    params.numStripes = 3;
+    QrDetector sparse(params);
+    CHECK_EQ(sparse.detect(bin, code), true);
+    for (int i = 0; i < 4; ++i)
+    {
+        const bool near = cv::norm(code.corners[i] - ref.corners[i]) < 2;
+        CHECK_EQ(near, true);
+    }
+
+    // Candidates are in order of rows.
+    const std::vector<int>& rows = sparse.candidateRows();
+    for (size_t i = 1; i < rows.size(); ++i)
+    {
+        const bool ordered = rows[i - 1] <= rows[i];
+        CHECK_EQ(ordered, true);
+    }
+#ifdef QRCODE_PROFILING
+    const int64_t rowsScanned = sparse.stats().counters[QrStats::ROWS_SCANNED];
+    const bool fewerRows = rowsScanned < bin.rows / 2;
+    CHECK_EQ(fewerRows, true);
+#endif
+}
+
+void test_QrDetector_budget()
+{
+    cv::Mat modules, bin, noImg;
+    renderSynthetic("budget", modules, bin);
+
+    QrDetector::Params params;
+    params.maxCandidates = 30;
+    QrDetector detector(params);
+    QrCode code;
+    CHECK_EQ(detector.detect(bin, code), true);
+    CHECK_EQ(detector.budgetStage(), QrDetector::BUDGET_OK);
+
+    // A budget of a single hit is exceeded at the first marker.
+    detector.params.budgetHits = 1;
+    CHECK_EQ(detector.detect(bin, code), false);
+    CHECK_EQ(detector.budgetStage(), QrDetector::BUDGET_EXCEEDED);
+    CHECK_EQ(detector.decode(bin, noImg), "");
+    CHECK_EQ(detector.detectMulti(bin).size(), 0);
+#ifdef QRCODE_PROFILING
+    const bool stoppedEarly = detector.stats().counters[QrStats::ROWS_SCANNED] < bin.rows;
+    CHECK_EQ(stoppedEarly, true);
+#endif
+
+    // Number of hits in the frame: the smallest budget which isn't exceeded.
+    int lo = 1, hi = 1 << 20;
+    while (lo < hi)
+    {
+        detector.params.budgetHits = (lo + hi) / 2;
+        detector.detect(bin, code);
+        if (detector.budgetStage() == QrDetector::BUDGET_EXCEEDED)
+            lo = detector.params.budgetHits + 1;
+        else
+            hi = detector.params.budgetHits;
+    }
+    const int numHits = lo;
+#ifdef QRCODE_PROFILING
+    // A budget of N hits processes exactly N of them.
+    detector.params.budgetHits = 0;
+    detector.detect(bin, code);
+    CHECK_EQ(detector.stats().counters[QrStats::HORIZONTAL_HITS], numHits);
+    detector.params.budgetHits = 5;
+    detector.detect(bin, code);
+    CHECK_EQ(detector.stats().counters[QrStats::HORIZONTAL_HITS], 5);
+#endif
+
+    // The last hits are over three quarters of the budget: candidates are thinned.
+    detector.params.budgetHits = numHits;
+    CHECK_EQ(detector.detect(bin, code), true);
+    CHECK_EQ(detector.budgetStage(), QrDetector::BUDGET_CAP_CANDIDATES);
+    CHECK_EQ(detector.candidates().size(), params.maxCandidates);
+
+    // A half: diagonal checks are skipped.
+    detector.params.budgetHits = 2 * (numHits - 1);
+    CHECK_EQ(detector.detect(bin, code), true);
+    CHECK_EQ(detector.budgetStage(), QrDetector::BUDGET_SKIP_DIAGONAL);
+
+    detector.params.budgetHits = 2 * numHits - 1;
+    CHECK_EQ(detector.detect(bin, code), true);
+    CHECK_EQ(detector.budgetStage(), QrDetector::BUDGET_OK);
+
+    // Time budget.
+    detector.params.budgetHits = 0;
+    detector.params.budgetMs = 1e-6;
+    CHECK_EQ(detector.detect(bin, code), false);
+    CHECK_EQ(detector.budgetStage(), QrDetector::BUDGET_EXCEEDED);
+}
+
+void test_decodeBatch()
+{
+    // Images of different cost: without codes, with a code and with several ones.
+    std::vector<cv::Mat> images;
+    for (int i = 0; i < 17; ++i)
+    {
+        if (i % 3 == 0)
+        {
+            images.push_back(cv::Mat(240, 320, CV_8UC1, cv::Scalar(255)));
+        }
+        else
+        {
+            cv::Mat bin = drawMarkers(20 + 5 * i, 30, 4 + i % 2);
+            if (i % 3 == 2)
+                drawFinderPattern(bin, 500, 400, 3);
+            images.push_back(bin);
+        }
+    }
+    cv::Mat modules, bgr(480, 640, CV_8UC3);
+    encodeQr("batch", modules);
+    renderQr(modules, SyntheticParams(), bgr);
+    images.push_back(bgr);
+
+    QrDetector detector;
+    std::vector<std::vector<QrCode> > results;
+    decodeBatch(images, results, QrDetector::Params(), 4);
+    CHECK_EQ(results.size(), images.size());
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        cv::Mat bin;
+        if (images[i].channels() == 3)
+            bgr2bin(images[i], bin);
+        else
+            bin = images[i];
+        const std::vector<QrCode>& codes = detector.detectMulti(bin);
+        CHECK_EQ(results[i].size(), codes.size());
+        for (size_t j = 0; j < codes.size(); ++j)
+        {
+            CHECK_EQ(results[i][j].payload, codes[j].payload);
+            for (int k = 0; k < 4; ++k)
+                CHECK_EQ(results[i][j].corners[k], codes[j].corners[k]);
+        }
+    }
+    CHECK_EQ(results.back().size(), 1);
+
+    // Every image is passed to a callback once.
+    std::vector<std::atomic<int> > calls(images.size());
+    for (size_t i = 0; i < calls.size(); ++i)
+        calls[i] = 0;
+    decodeBatch(images, [&calls](size_t index, const std::vector<QrCode>&) { calls[index] += 1; });
+    for (size_t i = 0; i < calls.size(); ++i)
+        CHECK_EQ(calls[i], 1);
+}
+
+void test_ImageView()
+{
+    // NV12 frame with padded rows. Luma has a code, chroma is arbitrary.
+    const cv::Mat bin = drawMarkers(100, 100, 6);
+    const size_t stride = bin.cols + 64;
+    std::vector<uint8_t> nv12(stride * bin.rows * 3 / 2, 77);
+    for (int y = 0; y < bin.rows; ++y)
+        memcpy(&nv12[y * stride], bin.ptr<uint8_t>(y), bin.cols);
+
+    QrDetector detector;
+    QrCode ref, code;
+    CHECK_EQ(detector.detect(bin, ref), true);
+    const PixelFormat yuv[] = {PIXEL_NV12, PIXEL_I420};
+    for (int i = 0; i < 2; ++i)
+    {
+        const ImageView view(&nv12[0], bin.cols, bin.rows, stride, yuv[i]);
+        // Luma is not copied.
+        const bool sameData = view.plane().data == &nv12[0];
+        CHECK_EQ(sameData, true);
+        CHECK_EQ(detector.detect(view, code), true);
+        for (int j = 0; j < 4; ++j)
+            CHECK_EQ(code.corners[j], ref.corners[j]);
+    }
+
+    // BGRA frame gives the same codes as BGR one.
+    cv::Mat modules, bgr(480, 640, CV_8UC3), bgrBin;
+    encodeQr("BGRA", modules);
+    renderQr(modules, SyntheticParams(), bgr);
+    std::vector<uint8_t> bgra(bgr.total() * 4, 0);
+    for (int y = 0; y < bgr.rows; ++y)
+    {
+        for (int x = 0; x < bgr.cols; ++x)
+            memcpy(&bgra[(y * bgr.cols + x) * 4], bgr.ptr<uint8_t>(y) + x * 3, 3);
+    }
+    bgr2bin(bgr, bgrBin);
+    const std::vector<QrCode> refCodes = detector.detectMulti(bgrBin);
+    const std::vector<QrCode>& codes = detector.detectMulti(ImageView(&bgra[0], bgr.cols, bgr.rows, 0, PIXEL_BGRA));
+    CHECK_EQ(refCodes.size(), 1);
+    CHECK_EQ(codes.size(), refCodes.size());
+    for (int j = 0; j < 4; ++j)
+        CHECK_EQ(codes[0].corners[j], refCodes[0].corners[j]);
+}
+
+void test_adaptive_lighting()
+{
+    // Code under a shadow: brightness falls from 100% to 10% across the frame
+    // so white modules at one side are darker than black ones at the other.
+    cv::Mat modules, bgr(480, 640, CV_8UC3), gray;
+    encodeQr("shadow", modules);
+    SyntheticParams synthetic;
+    synthetic.moduleSize = 8;
+    synthetic.noise = 4;
+    renderQr(modules, synthetic, bgr);
+    bgr2gray(bgr, gray);
+    for (int y = 0; y < gray.rows; ++y)
+    {
+        for (int x = 0; x < gray.cols; ++x)
+        {
+            uint8_t& v = gray.at<uint8_t>(y, x);
+            v = (uint8_t)(v * (1.0 - 0.9 * x / gray.cols));
+        }
+    }
+
+    QrDetector global;
+    CHECK_EQ(global.detectMulti(ImageView(gray.data, gray.cols, gray.rows, gray.step, PIXEL_GRAY)).size(), 0);
+
+    QrDetector::Params params;
+    params.adaptive = true;
+    QrDetector adaptive(params);
+    const std::vector<QrCode>& codes =
+        adaptive.detectMulti(ImageView(gray.data, gray.cols, gray.rows, gray.step, PIXEL_GRAY));
+    CHECK_EQ(codes.size(), 1);
+    CHECK_EQ(codes[0].payload, "shadow");
+
+    // Sums of stripes are kept by a caller so the next frames allocate nothing.
+    AdaptiveBuffers buffers;
+    BitImage bin;
+    const AdaptiveThreshold thresh(0, 10, 1);
+    bgr2bin(bgr, bin, thresh, buffers);
+#ifdef QRCODE_COUNT_ALLOCATIONS
+    const int allocations = allocationsCounter;
+#endif
+    gray2bin(gray, bin, thresh, buffers);
+    bgr2bin(bgr, bin, thresh, buffers);
+#ifdef QRCODE_COUNT_ALLOCATIONS
+    CHECK_EQ(allocationsCounter - allocations, 0);
+#endif
+}
+
+void test_QrDetector_allocations()
+{
+    cv::Mat bin(480, 640, CV_8UC1, cv::Scalar(255));
+    drawFinderPattern(bin, 100, 100, 6);
+    drawFinderPattern(bin, 350, 100, 6);
+    drawFinderPattern(bin, 100, 350, 6);
+
+    QrDetector::Params params;
+    params.numStripes = 1;
+    params.debugMask = true;
+    QrDetector detector(params);
+    cv::Mat img;
+
+    // Warm-up.
+    detector.decode(bin, img);
+    CHECK_EQ(detector.mask().empty(), false);
+    const uint8_t* maskData = detector.mask().data;
+
+#ifdef QRCODE_COUNT_ALLOCATIONS
+    const int allocations = allocationsCounter;
+#endif
+    for (int i = 0; i < 10; ++i)
+        detector.decode(bin, img);
+#ifdef QRCODE_COUNT_ALLOCATIONS
+    CHECK_EQ(allocationsCounter - allocations, 0);
+#endif
+    bool sameMask = detector.mask().data == maskData;
+    CHECK_EQ(sameMask, true);
+}
+
+void test_QrDetector_stats()
+{
+    cv::Mat bin(480, 640, CV_8UC1, cv::Scalar(255));
+    drawFinderPattern(bin, 100, 100, 6);
+    drawFinderPattern(bin, 350, 100, 6);
+    drawFinderPattern(bin, 100, 350, 6);
+
+    QrDetector::Params params;
+    params.numStripes = 1;
+    QrDetector detector(params);
+    cv::Mat img;
+    detector.decode(bin, img);
+    const QrStats& stats = detector.stats();
+
+#ifdef QRCODE_PROFILING
+    const int64_t* c = stats.counters;
+    CHECK_EQ(c[QrStats::ROWS_SCANNED], bin.rows);
+    CHECK_EQ(c[QrStats::CANDIDATES], detector.candidates().size());
+    CHECK_EQ(c[QrStats::CLUSTERS], 3);
+    CHECK_EQ(c[QrStats::HORIZONTAL_HITS],
+             c[QrStats::CANDIDATES] + c[QrStats::VERTICAL_REJECTS] + c[QrStats::DIAGONAL_REJECTS]);
+    // Markers without modules can't be decoded. The grid is either rejected
+    // by format information or passed to quirc which fails.
+    CHECK_EQ(c[QrStats::FORMAT_REJECTS] + c[QrStats::DECODE_CALLS], 1);
+    CHECK_EQ(c[QrStats::DECODE_FAILURES], c[QrStats::DECODE_CALLS]);
+    const bool totalCoversStages = stats.nanoseconds[QrStats::STAGE_TOTAL] >=
+                                   stats.nanoseconds[QrStats::STAGE_SCAN] +
+                                   stats.nanoseconds[QrStats::STAGE_GROUP] +
+                                   stats.nanoseconds[QrStats::STAGE_DECODE];
+    CHECK_EQ(totalCoversStages, true);
+#else
+    for (int i = 0; i < QrStats::NUM_COUNTERS; ++i)
+        CHECK_EQ(stats.counters[i], 0);
+#endif
+
+    // Stats are reset by every call.
+    QrProfile profile;
+    profile.add(stats);
+    detector.decode(bin, img);
+    profile.add(detector.stats());
+    CHECK_EQ(profile.calls(), 2);
+    CHECK_EQ(detector.stats().counters[QrStats::CLUSTERS], stats.counters[QrStats::CLUSTERS]);
+}
+
+void test_PayloadCache()
+{
+    // Grids of 21x21 modules which differ by a single module. Buffers are
+    // large enough for 25x25 modules as well.
+    std::vector<uint8_t> a(79, 0x5A), b(a), c(a);
+    b[10] ^= 4;
+    c[55] ^= 1;
+
+    PayloadCache cache(2);
+    std::string payload = "none";
+    CHECK_EQ(cache.find(&a[0], 21, payload), false);
+    CHECK_EQ(payload, "none");
+    cache.insert(&a[0], 21, "a");
+    cache.insert(&b[0], 21, "b");
+    CHECK_EQ(cache.find(&a[0], 21, payload), true);
+    CHECK_EQ(payload, "a");
+
+    // b is the least recently used one so it's replaced.
+    cache.insert(&c[0], 21, "c");
+    CHECK_EQ(cache.find(&b[0], 21, payload), false);
+    CHECK_EQ(cache.find(&c[0], 21, payload), true);
+    CHECK_EQ(payload, "c");
+    CHECK_EQ(cache.find(&a[0], 21, payload), true);
+    CHECK_EQ(payload, "a");
+    // The same bytes as a grid of another size.
+    CHECK_EQ(cache.find(&a[0], 25, payload), false);
+    CHECK_EQ(cache.hits(), 3);
+    CHECK_EQ(cache.misses(), 3);
+
+    // Disabled cache keeps nothing and doesn't count lookups.
+    cache.setCapacity(0);
+    cache.insert(&a[0], 21, "a");
+    CHECK_EQ(cache.find(&a[0], 21, payload), false);
+    CHECK_EQ(cache.misses(), 3);
+}
+
+void test_QrDetector_cache()
+{
+    cv::Mat modules, bin;
+    renderSynthetic("cached", modules, bin);
+
+    QrDetector detector;
+    QrCode first, second;
+    CHECK_EQ(detector.detect(bin, first), true);
+    CHECK_EQ(first.payload, "cached");
+    CHECK_EQ(detector.cache().hits(), 0);
+    CHECK_EQ(detector.cache().misses(), 1);
+
+    // The same grid is found in the cache and isn't decoded again.
+    CHECK_EQ(detector.detect(bin, second), true);
+    CHECK_EQ(second.payload, "cached");
+    CHECK_EQ(detector.cache().hits(), 1);
+    CHECK_EQ(detector.cache().misses(), 1);
+#ifdef QRCODE_PROFILING
+    const int64_t* c = detector.stats().counters;
+    CHECK_EQ(c[QrStats::CACHE_HITS], 1);
+    CHECK_EQ(c[QrStats::CACHE_MISSES], 0);
+    CHECK_EQ(c[QrStats::DECODE_CALLS], 0);
+#endif
+
+    // Without the cache every frame is decoded.
+    detector.params.cacheSize = 0;
+    CHECK_EQ(detector.detect(bin, second), true);
+    CHECK_EQ(second.payload, "cached");
+    CHECK_EQ(detector.cache().hits(), 1);
+#ifdef QRCODE_PROFILING
+    CHECK_EQ(detector.stats().counters[QrStats::DECODE_CALLS], 1);
+#endif
+}
+
+void test_FrameRing()
+{
+    Frame frames[4];
+    FrameRing ring(3);
+    for (int i = 0; i < 3; ++i)
+        CHECK_EQ(ring.push(&frames[i]), true);
+    CHECK_EQ(ring.push(&frames[3]), false);
+    CHECK_EQ(ring.size(), 3);
+
+    // Wraps around the end.
+    CHECK_EQ(ring.pop(), &frames[0]);
+    CHECK_EQ(ring.push(&frames[3]), true);
+    for (int i = 1; i < 4; ++i)
+        CHECK_EQ(ring.pop(), &frames[i]);
+    bool empty = ring.pop() == 0;
+    CHECK_EQ(empty, true);
+}
+
+// Synthetic frames with an index drawn as a number of black rows.
+class FakeCapture : public cv::VideoCapture
+{
+public:
+    explicit FakeCapture(int numFrames) : numFrames(numFrames), index(0) {}
+
+    virtual bool read(cv::OutputArray image)
+    {
+        if (index == numFrames)
+            return false;
+        cv::Mat frame(64, 64, CV_8UC3, cv::Scalar(255, 255, 255));
+        frame.rowRange(0, index % 64).setTo(cv::Scalar(0, 0, 0));
+        frame.copyTo(image);
+        index += 1;
+        return true;
+    }
+
+private:
+    int numFrames, index;
+};
+
+void test_Pipeline()
+{
+    const Pipeline::Policy policies[] = {Pipeline::BLOCK, Pipeline::DROP_OLDEST};
+    for (int i = 0; i < 2; ++i)
+    {
+        FakeCapture cap(50);
+        Pipeline::Params params;
+        params.policy = policies[i];
+        Pipeline pipeline(cap, params);
+
+        // Slow consumer makes drops.
+        int numFrames = 0;
+        int64_t lastIndex = -1;
+        bool ordered = true;
+        while (Frame* frame = pipeline.next())
+        {
+            ordered = ordered && frame->index > lastIndex &&
+                      frame->bin.rows == 64 && frame->bin.at<uint8_t>(63, 0) == 255 &&
+                      (frame->index % 64 == 0 || frame->bin.at<uint8_t>(frame->index % 64 - 1, 0) == 0);
+            lastIndex = frame->index;
+            numFrames += 1;
+            pipeline.release(frame);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK_EQ(ordered, true);
+        CHECK_EQ(lastIndex, 49);
+        if (policies[i] == Pipeline::BLOCK)
+            CHECK_EQ(numFrames, 50);
+    }
+}
+
+void test_MultiStream()
+{
+    const int numFrames[] = {30, 5, 17};
+    FakeCapture cap0(numFrames[0]), cap1(numFrames[1]), cap2(numFrames[2]);
+    cv::VideoCapture* caps[] = {&cap0, &cap1, &cap2};
+    std::vector<MultiStream::Input> inputs;
+    for (int i = 0; i < 3; ++i)
+        inputs.push_back(MultiStream::Input(caps[i], Pipeline::BLOCK));
+
+    // Frames of every stream come in order even though workers are shared.
+    std::mutex mutex;
+    std::vector<int64_t> lastIndex(3, -1);
+    bool ordered = true;
+    MultiStream::Params params;
+    params.numWorkers = 2;
+    MultiStream streams(inputs, [&](int stream, const Frame& frame, const std::vector<QrCode>&,
+                                    double latency)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ordered = ordered && frame.index == lastIndex[stream] + 1 && latency >= 0 &&
+                  frame.bin.rows == 64 && frame.bin.at<uint8_t>(63, 0) == 255;
+        lastIndex[stream] = frame.index;
+    }, params);
+    streams.wait();
+
+    CHECK_EQ(ordered, true);
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK_EQ(lastIndex[i], numFrames[i] - 1);
+        CHECK_EQ(streams.stats(i).captured, numFrames[i]);
+        CHECK_EQ(streams.stats(i).latencies.size(), numFrames[i]);
+        CHECK_EQ(streams.stats(i).profile.calls(), numFrames[i]);
+    }
+}
+
+static std::string jsonString(const std::string& str)
+{
+    std::ostringstream out;
+    writeJsonString(out, str);
+    return out.str();
+}
+
+void test_writeJsonString()
+{
+    CHECK_EQ(jsonString("a\"b\\c\n\x01"), "\"a\\\"b\\\\c\\n\\u0001\"");
+    // Valid UTF-8 of 2, 3 and 4 bytes is kept.
+    CHECK_EQ(jsonString("\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80"), "\"\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80\"");
+    // Other bytes are escaped one by one: a stray continuation, a truncated
+    // sequence, an overlong form, a surrogate and a code point above U+10FFFF.
+    CHECK_EQ(jsonString("\x80\xFF"), "\"\\u0080\\u00ff\"");
+    CHECK_EQ(jsonString("x\xC3("), "\"x\\u00c3(\"");
+    CHECK_EQ(jsonString("\xE2\x82"), "\"\\u00e2\\u0082\"");
+    CHECK_EQ(jsonString("\xC0\xAF"), "\"\\u00c0\\u00af\"");
+    CHECK_EQ(jsonString("\xED\xA0\x80"), "\"\\u00ed\\u00a0\\u0080\"");
+    CHECK_EQ(jsonString("\xF4\x90\x80\x80"), "\"\\u00f4\\u0090\\u0080\\u0080\"");
+}
+
+#ifndef _WIN32
+void test_DecodeServer()
+{
+    // The socket is created in a private temporary directory.
+    const char* tmp = getenv("TMPDIR");
+    std::string dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/qrcode_testXXXXXX";
+    CHECK_EQ((mkdtemp(&dir[0]) != 0), true);
+    const std::string path = dir + "/server.sock";
+
+    DecodeServer::Params params;
+    params.numWorkers = 2;
+    params.maxBatch = 4;
+    params.maxLatencyMs = 20;
+    DecodeServer server(params);
+    CHECK_EQ(server.start(path), true);
+
+    // Concurrent clients share batches. Every client keeps its connection for all the requests.
+    cv::Mat img(48, 64, CV_8UC1, cv::Scalar(255));
+    std::atomic<int> numConnected(0), numDecoded(0), maxBatch(0);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < 4; ++i)
+    {
+        clients.push_back(std::thread([&]
+        {
+            DecodeClient client;
+            if (!client.connect(path))
+                return;
+            numConnected += 1;
+            std::string response;
+            for (int j = 0; j < 5; ++j)
+            {
+                if (!client.decode(img, response) || response.find("\"codes\": []") == std::string::npos)
+                    break;
+                numDecoded += 1;
+                const int batch = std::atoi(response.c_str() + response.find("\"batch\": ") + 9);
+                int seen = maxBatch;
+                while (batch > seen && !maxBatch.compare_exchange_weak(seen, batch)) {}
+            }
+        }));
+    }
+    for (size_t i = 0; i < clients.size(); ++i)
+        clients[i].join();
+    CHECK_EQ(numConnected, 4);
+    CHECK_EQ(numDecoded, 20);
+    CHECK_EQ(server.requests(), 20);
+    const bool batched = maxBatch > 1 && maxBatch <= params.maxBatch;
+    CHECK_EQ(batched, true);
+
+    // Broken requests get errors and the connection is kept.
+    DecodeClient client;
+    std::string response;
+    CHECK_EQ(client.connect(path), true);
+    CHECK_EQ(client.decodeEncoded(std::vector<uint8_t>(10, 0), response), true);
+    CHECK_EQ(response.compare(0, 9, "{\"error\":"), 0);
+    CHECK_EQ(client.decodeEncoded(std::vector<uint8_t>(), response), true);
+    CHECK_EQ(response.compare(0, 9, "{\"error\":"), 0);
+    CHECK_EQ(client.decode(img, response), true);
+    CHECK_EQ(server.requests(), 21);
+    server.stop();
+    CHECK_EQ(client.decode(img, response), false);
+    CHECK_EQ(rmdir(dir.c_str()), 0);
+}
+#endif
+
+bool runTests()
+{
+    bool passed = true;
+    RUN_TEST(test_bgr2gray);
+    RUN_TEST(test_gray2bin);
+    RUN_TEST(test_bgr2bin);
+    RUN_TEST(test_bin_packed);
+    RUN_TEST(test_gray2bin_adaptive);
+    RUN_TEST(test_countPixels_1);
+    RUN_TEST(test_countPixels_2);
+    RUN_TEST(test_countPixels_packed);
+    RUN_TEST(test_checkRatios);
+    RUN_TEST(test_findCandidates_parallel);
+    RUN_TEST(test_findCandidates_packed);
+    RUN_TEST(test_findCandidates_run_index);
+    RUN_TEST(test_computeCenters_simple_1);
+    RUN_TEST(test_computeCenters_simple_2);
+    RUN_TEST(test_computeCenters_hard);
+    RUN_TEST(test_computeCenters_random);
+    RUN_TEST(test_mergeRois);
+    RUN_TEST(test_sortMarkers_1);
+    RUN_TEST(test_sortMarkers_2);
+    RUN_TEST(test_sortMarkers_3);
+    RUN_TEST(test_sortMarkers_4);
+    RUN_TEST(test_sortMarkers_5);
+    RUN_TEST(test_sortMarkers_6);
+    RUN_TEST(test_sortMarkers_7);
+    RUN_TEST(test_decode);
+    RUN_TEST(test_QrDetector_allocations);
+    RUN_TEST(test_QrDetector_stats);
+    RUN_TEST(test_PayloadCache);
+    RUN_TEST(test_QrDetector_cache);
+    RUN_TEST(test_FrameRing);
+    RUN_TEST(test_Pipeline);
+    RUN_TEST(test_MultiStream);
+    RUN_TEST(test_writeJsonString);
+#ifndef _WIN32
+    RUN_TEST(test_DecodeServer);
+#endif
+    RUN_TEST(test_QrDetector_coarse);
+    RUN_TEST(test_QrDetector_tracking);
+    RUN_TEST(test_QrDetector_detectMulti);
+    RUN_TEST(test_QrDetector_detectMulti_grid);
+    RUN_TEST(test_QrDetector_sparse);
+    RUN_TEST(test_sampleModules);
+    RUN_TEST(test_qrErrorCorrection);
+    RUN_TEST(test_checkFormat);
+    RUN_TEST(test_extract_synthetic);
+    RUN_TEST(test_decode_synthetic);
+    RUN_TEST(test_QrDetector_detect);
+    RUN_TEST(test_QrDetector_budget);
+    RUN_TEST(test_decodeBatch);
+    RUN_TEST(test_ImageView);
+    RUN_TEST(test_adaptive_lighting);
+    return passed;
+}